@@ -10,14 +10,24 @@
 #pragma once
 
 #include <iostream>
+#include <chrono>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
 #include "physics.h"
+#include "physicsWorld.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "trajectory.h"
+#include "playback.h"
+#include "offscreen.h"
 #include "renderer.h"
 #include "camera.h"
+#include "jobs.h"
+#include "asyncLoad.h"
+#include "assetCache.h"
 
 // Window settings
 static GLFWwindow* window;
@@ -42,7 +52,7 @@ static void error_callback(int error, const char* description);
 class Engine {
 public:
 	template<typename Game>
-	static int InitializeEngine() 
+	static int InitializeEngine(const Jobs::Config& jobConfig = Jobs::Config()) 
 	{
 		std::cout << "INITIALIZING::JELLY ENGINE VERSION 1.0.0 ..." << std::endl;
 
@@ -84,6 +94,11 @@ public:
 		std::cout << "COMPLETE::JELLY ENGINE SETUP" << std::endl;
 		std::cout << std::endl;
 
+		std::cout << "INITIALIZING::JOB SYSTEM ..." << std::endl;
+		Jobs::Initialize(jobConfig);
+		std::cout << "COMPLETE::JOB SYSTEM" << std::endl;
+		std::cout << std::endl;
+
 		std::cout << "INITIALIZING::RENDERER SETUP ..." << std::endl;
 		Renderer::Setup();
 		std::cout << "COMPLETE::RENDERER SETUP" << std::endl;
@@ -122,8 +137,90 @@ public:
 			}	
 
 		}
+
+		// Workers finish queued jobs and join before the engine returns
+		game.Exit();
+		Jobs::Shutdown();
 		return 0;
 	}
+
+	// Batch rendering without a display: hidden window on an OSMesa (or EGL) context, frames drawn into an
+	// FBO with Renderer::Draw and written out by OffscreenTarget. The game steps with a fixed dt per frame.
+	template<typename Game>
+	static int RenderHeadless(const HeadlessConfig& config, const Jobs::Config& jobConfig = Jobs::Config())
+	{
+		std::cout << "INITIALIZING::JELLY ENGINE VERSION 1.0.0 (HEADLESS) ..." << std::endl;
+
+		glfwSetErrorCallback(error_callback);
+
+		// OSMesa renders in software with no display server, so the null platform is enough
+		if (config.context == HeadlessConfig::Context::OSMesa) glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+
+		if (!glfwInit()) {
+			std::cerr << "Failed to initialize GLFW" << std::endl;
+			return -1;
+		}
+
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, config.context == HeadlessConfig::Context::OSMesa ? GLFW_OSMESA_CONTEXT_API : GLFW_EGL_CONTEXT_API);
+
+		window = glfwCreateWindow(config.width, config.height, "Jelly Engine", nullptr, nullptr);
+
+		if (!window) {
+			std::cerr << "Failed to create headless GL context" << std::endl;
+			glfwTerminate();
+			return -1;
+		}
+
+		glfwMakeContextCurrent(window);
+
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return -1;
+		}
+
+		std::cout << "COMPLETE::JELLY ENGINE SETUP " << glGetString(GL_RENDERER) << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "INITIALIZING::JOB SYSTEM ..." << std::endl;
+		Jobs::Initialize(jobConfig);
+		std::cout << "COMPLETE::JOB SYSTEM" << std::endl;
+		std::cout << std::endl;
+
+		std::cout << "INITIALIZING::RENDERER SETUP ..." << std::endl;
+		Renderer::Setup();
+		std::cout << "COMPLETE::RENDERER SETUP" << std::endl;
+		std::cout << std::endl;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		int rendered = 0;
+		{
+			OffscreenTarget target(config);
+
+			Game game;
+			game.Start();
+
+			for (int frame = 0; frame < config.frames && !glfwWindowShouldClose(window); frame++) {
+				target.Bind();
+				Renderer::Draw(light, scene);
+				target.Capture();
+
+				game.Update(config.dt);
+				rendered++;
+			}
+
+			target.Finish();
+			game.Exit();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "::HEADLESS:: " << rendered << " frames to " << config.output << " in " << seconds << " s (" << rendered / seconds << " fps)" << std::endl;
+
+		Jobs::Shutdown();
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return 0;
+	}
+
 	virtual void Start() = 0;
 	virtual void Update(float dt) = 0;
 	virtual void Exit() = 0;
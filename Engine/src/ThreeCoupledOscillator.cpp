@@ -1,30 +1,49 @@
-#include "ThreeCoupledOscillator.h"
+#include "physics.h"
 
-void HeartOscillatorSystem::update( double dt)
-{
-    // SA Node
-    double x1 = sa.x;
-    double x2 = sa.dx;
-    double x3 = av.x;
-    double x5 = hpc.x;
-    
-    double dx1 = x2;
-    double dx2 = -sa.a* x2 * (x1 - sa.w1) * (x1 - sa.w2) - x1 * (x1 + sa.d) * (x1 + sa.e) + sa.q* glm::sin(sa.omega * t) + sa.kSA_to_AV * (x1 - x3) + sa.kSA_to_HP * (x1 - x5);
+// HeartOscillatorSystem::update lives in physics.cpp next to the zone sweep it drives
 
-    // AV Node
-    double x4 = av.dx;
-    double x6 = hpc.dx;
+double HeartOscillatorSystem::getECG() const
+{
+    return a0 + a1*sa.x +  a3 * av.x + a5 * hpc.x;
+}
 
-    double dx3 = x4;
-    double dx4 = -av.a* x4 * (x3 - av.w1) * (x2 - av.w2) - x3 * (x3 + av.d) * (x3 + av.e) + av.q* glm::sin(av.omega * t) + av.kAV_to_SA * (x3 - x1) + av.kAV_to_HP * (x3 - x5);
+void HeartOscillatorSystem::setDefaults()
+{
+    // SA node variables
+    sa.a = 3;
+    sa.w1 = 0.2;
+    sa.w2 = -1.9;
+    sa.d = 3;
+    sa.e = 4.9;
+    sa.omega = 1;
+    sa.q = 1;
+    sa.kSA_to_AV = 0;
+    sa.kSA_to_HP = 0;
 
-    // HisPurkinjeComplex
-    double dx5 = x6;
-    double dx6 = -hpc.a* x6 * (x5 - hpc.w1) * (x5 - hpc.w2) - x5 * (x5 + hpc.d) * (x5 + hpc.e) + hpc.q* glm::sin(hpc.omega * t) + hpc.kHP_to_SA * (x5 - x1) + hpc.kHP_to_AV * (x5 - x3);
+    // AV node variables
+    av.a = 3;
+    av.w1 = 0.1;
+    av.w2 = -0.1;
+    av.d = 3;
+    av.e = 3;
+    av.omega = 0;
+    av.q = 1;
+    av.kAV_to_HP = 0;
+    av.kAV_to_SA = 5;
 
-}   
+    // HPC Node
+    hpc.a = 5;
+    hpc.w1 = 1;
+    hpc.w2 = -1;
+    hpc.d = 3;
+    hpc.e = 7;
+    hpc.omega = 0;
+    hpc.q = 20;
+    hpc.kHP_to_SA = 0;
+    hpc.kHP_to_AV = 20;
 
-double HeartOscillatorSystem::getECG()
-{
-    return a0 + a1*sa.x +  a3 * av.x + a5 * hpc.x;
-}
\ No newline at end of file
+    a0 = 1;
+    a1 = 0.1;
+    a3 = 0.05;
+    a5 = 0.4;
+}
@@ -0,0 +1,26 @@
+/*
+ * ARENA: Monotonic per-load memory for import temporaries, released in one go
+ */
+
+#include <iostream>
+#include "arena.h"
+
+Arena::Arena(size_t initialBytes)
+	: heap(std::pmr::new_delete_resource(), stats.blocks, stats.peak),
+	  arena(initialBytes > 0 ? initialBytes : 1, &heap),
+	  front(&arena, stats.allocations, stats.bytes)
+{
+}
+
+void* Arena::Counter::do_allocate(size_t size, size_t alignment)
+{
+	count++;
+	bytes += size;
+	return next->allocate(size, alignment);
+}
+
+void Arena::Report(const char* what) const
+{
+	std::cout << "::ARENA:: " << what << ": " << stats.allocations << " allocations, " << stats.bytes / 1024 << " KB requested, "
+		<< stats.blocks << " heap blocks, peak " << stats.peak / 1024 << " KB" << std::endl;
+}
@@ -0,0 +1,48 @@
+/*
+ * ARENA: Monotonic per-load memory for import temporaries, released in one go
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+// Bump allocation out of blocks taken from the heap. Deallocation is a no-op, everything goes back when the
+// arena is destroyed, so a load's temporaries never fragment the heap. Containers use it through std::pmr;
+// sizing the first block from the load gives a single heap allocation. Not thread safe, one per load.
+class Arena {
+public:
+	explicit Arena(size_t initialBytes = 64 * 1024);
+
+	std::pmr::memory_resource* Resource() { return &front; }
+
+	struct Stats {
+		size_t allocations = 0; // requests served
+		size_t bytes = 0;       // requested in total
+		size_t blocks = 0;      // heap allocations behind them
+		size_t peak = 0;        // heap bytes held, nothing is returned before the arena goes away
+	};
+	const Stats& GetStats() const { return stats; }
+	void Report(const char* what) const; // ::ARENA:: line
+
+private:
+	// Counts one side of the arena and forwards to the next resource
+	class Counter : public std::pmr::memory_resource {
+	public:
+		Counter(std::pmr::memory_resource* next, size_t& count, size_t& bytes) : next(next), count(count), bytes(bytes) {}
+
+	private:
+		std::pmr::memory_resource* next;
+		size_t& count;
+		size_t& bytes;
+
+		void* do_allocate(size_t size, size_t alignment) override;
+		void do_deallocate(void* p, size_t size, size_t alignment) override { next->deallocate(p, size, alignment); }
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+	};
+
+	Stats stats;
+	Counter heap;                                // blocks the arena takes from the heap
+	std::pmr::monotonic_buffer_resource arena;
+	Counter front;                               // requests made to the arena
+};
@@ -0,0 +1,68 @@
+/*
+ * ASSET CACHE: Process-wide cache of immutable imported and derived data, shared between instances
+ */
+
+#include <iostream>
+#include <unordered_map>
+#include "assetCache.h"
+
+namespace AssetCache {
+	static std::mutex cacheLock;
+	static std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+	static Stats stats;
+
+	std::shared_ptr<Entry> Find(const std::string& key)
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		std::shared_ptr<Entry>& entry = entries[key];
+		if (!entry) entry = std::make_shared<Entry>();
+		return entry;
+	}
+
+	void Record(const std::string& key, bool hit)
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		if (hit) {
+			stats.hits++;
+			return;
+		}
+		stats.misses++;
+		std::cout << "::ASSET CACHE:: miss " << key << std::endl;
+	}
+
+	size_t Trim()
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		size_t dropped = 0;
+		for (auto it = entries.begin(); it != entries.end();) {
+			std::shared_ptr<Entry>& entry = it->second;
+			std::unique_lock<std::mutex> entryGuard(entry->lock, std::try_to_lock);
+
+			// Still loading, or handed out to someone: keep it
+			if (!entryGuard.owns_lock() || !entry->value || entry->value.use_count() > 1) {
+				++it;
+				continue;
+			}
+			entryGuard.unlock();
+			it = entries.erase(it);
+			dropped++;
+		}
+		std::cout << "::ASSET CACHE:: trimmed " << dropped << ", entries: " << entries.size() << ", hits: " << stats.hits
+			<< ", misses: " << stats.misses << std::endl;
+		return dropped;
+	}
+
+	void Clear()
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		entries.clear();
+	}
+
+	Stats GetStats()
+	{
+		std::lock_guard<std::mutex> guard(cacheLock);
+		Stats result = stats;
+		result.entries = entries.size();
+		return result;
+	}
+}
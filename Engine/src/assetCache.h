@@ -0,0 +1,46 @@
+/*
+ * ASSET CACHE: Process-wide cache of immutable imported and derived data, shared between instances
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+
+namespace AssetCache {
+	struct Stats {
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t entries = 0;
+	};
+
+	// Type erased slot, the first caller builds the value and later callers for the same key wait for it
+	struct Entry {
+		std::mutex lock;
+		std::shared_ptr<const void> value;
+	};
+
+	std::shared_ptr<Entry> Find(const std::string& key);
+	void Record(const std::string& key, bool hit); // counts every lookup, prints misses only
+
+	// Returns the asset stored under key, building it once with build() on a miss. Entries are reference
+	// counted: every holder shares the same immutable object, Trim drops the ones only the cache still holds.
+	template<typename T>
+	std::shared_ptr<const T> Get(const std::string& key, const std::function<std::shared_ptr<T>()>& build) {
+		std::string typedKey = std::string(typeid(T).name()) + "|" + key;
+		std::shared_ptr<Entry> entry = Find(typedKey);
+
+		std::lock_guard<std::mutex> guard(entry->lock);
+		bool hit = entry->value != nullptr;
+		if (!hit) entry->value = std::shared_ptr<const T>(build());
+		Record(key, hit);
+		return std::static_pointer_cast<const T>(entry->value);
+	}
+
+	size_t Trim(); // returns the number of entries dropped, prints a summary of the cache
+	void Clear();
+	Stats GetStats();
+}
@@ -0,0 +1,59 @@
+/*
+ * ASYNC LOAD: Builds a model on a background worker, GL resources are created later on the main thread
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include "jobs.h"
+
+// T needs CreateGLResources(), build must construct T with its GL work deferred
+template<typename T>
+class AsyncLoad {
+public:
+	AsyncLoad() = default;
+
+	explicit AsyncLoad(std::function<T*()> build) : result(std::make_shared<T*>(nullptr)) {
+		std::shared_ptr<T*> out = result;
+		job = Jobs::SubmitBackground([out, build]() { *out = build(); });
+	}
+
+	~AsyncLoad() {
+		// A load still in flight owns its result, wait for it so nothing leaks
+		if (job) delete Wait();
+	}
+
+	AsyncLoad(AsyncLoad&&) = default;
+	AsyncLoad& operator=(AsyncLoad&& other) {
+		if (this != &other) {
+			if (job) delete Wait();
+			job = std::move(other.job);
+			result = std::move(other.result);
+		}
+		return *this;
+	}
+
+	bool Pending() const { return job != nullptr; }
+	bool Ready() const { return job && job->done; }
+
+	// Main thread only: finishes the GL side and hands ownership to the caller, nullptr while still loading
+	T* Take() {
+		if (!Ready()) return nullptr;
+		T* object = *result;
+		job.reset();
+		result.reset();
+		if (object) object->CreateGLResources();
+		return object;
+	}
+
+	// Blocks until the CPU side is done, for loads the first frame cannot do without
+	T* Wait() {
+		Jobs::Wait(job);
+		return Take();
+	}
+
+private:
+	Jobs::Handle job;
+	std::shared_ptr<T*> result;
+};
@@ -0,0 +1,252 @@
+/*
+ * CHECKPOINT: Binary snapshots of a soft body's dynamic state, saved in the background and restored with memcpy
+ */
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <chrono>
+#include "checkpoint.h"
+#include "physics.h"
+
+namespace Checkpoint {
+	void Capture(const SoftBody& body, std::vector<unsigned char>& buffer)
+	{
+		Header header;
+		header.particleCount = body.particles.size();
+		header.springCount = body.topology->springs.size();
+		header.simTime = body.simTime;
+		const HeartOscillatorSystem& o = body.oscillator;
+		double state[6] = { o.sa.x, o.sa.dx, o.av.x, o.av.dx, o.hpc.x, o.hpc.dx };
+		std::memcpy(header.oscillator, state, sizeof(state));
+
+		const MonodomainSolver* excitation = body.excitation && body.excitation->Active() ? body.excitation.get() : nullptr;
+		size_t fieldBytes = 0;
+		if (excitation) {
+			header.blocks |= Excitation;
+			header.excitationNodes = excitation->NodeCount();
+			header.excitationTime = excitation->Time();
+			header.nextPace = excitation->NextPace();
+			fieldBytes = header.excitationNodes * sizeof(float);
+		}
+		const std::vector<float>& tension = body.Tension();
+		size_t tensionBytes = 0;
+		if (tension.size() == body.particles.size() && !tension.empty()) {
+			header.blocks |= Tension;
+			tensionBytes = tension.size() * sizeof(float);
+		}
+		size_t doubleBytes = 0;
+		if (body.GetPrecision() == Precision::Double && body.doubleState.size() == body.particles.size()) {
+			header.blocks |= DoubleState;
+			doubleBytes = header.particleCount * sizeof(glm::dvec3);
+		}
+
+		size_t arrayBytes = header.particleCount * sizeof(glm::vec3);
+		buffer.resize(sizeof(Header) + 2 * arrayBytes + 2 * fieldBytes + tensionBytes + 2 * doubleBytes);
+		unsigned char* out = buffer.data();
+		std::memcpy(out, &header, sizeof(Header));
+		out += sizeof(Header);
+		std::memcpy(out, body.particles.position.data(), arrayBytes);
+		out += arrayBytes;
+		std::memcpy(out, body.particles.velocity.data(), arrayBytes);
+		out += arrayBytes;
+		if (excitation) {
+			std::memcpy(out, excitation->Potential().data(), fieldBytes);
+			std::memcpy(out + fieldBytes, excitation->Recovery().data(), fieldBytes);
+			out += 2 * fieldBytes;
+		}
+		if (tensionBytes) {
+			std::memcpy(out, tension.data(), tensionBytes);
+			out += tensionBytes;
+		}
+		if (doubleBytes) {
+			std::memcpy(out, body.doubleState.position.data(), doubleBytes);
+			std::memcpy(out + doubleBytes, body.doubleState.velocity.data(), doubleBytes);
+		}
+	}
+
+	bool Write(const std::vector<unsigned char>& buffer, const std::string& path)
+	{
+		// Write next to the target and rename, so a crash mid-write keeps the previous checkpoint
+		std::string temp = path + ".tmp";
+		{
+			std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+			if (!file) {
+				std::cout << "ERROR::CHECKPOINT::Cannot open " << temp << std::endl;
+				return false;
+			}
+			file.write((const char*)buffer.data(), (std::streamsize)buffer.size());
+			if (!file) {
+				std::cout << "ERROR::CHECKPOINT::Write failed " << temp << std::endl;
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temp, path, error);
+		if (error) {
+			std::cout << "ERROR::CHECKPOINT::" << error.message() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	bool Save(const SoftBody& body, const std::string& path)
+	{
+		std::vector<unsigned char> buffer;
+		Capture(body, buffer);
+		return Write(buffer, path);
+	}
+
+	bool Load(SoftBody& body, const std::string& path)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			std::cout << "ERROR::CHECKPOINT::Cannot open " << path << std::endl;
+			return false;
+		}
+
+		Header header, expected;
+		file.read((char*)&header, sizeof(Header));
+		if (!file || std::memcmp(header.magic, expected.magic, 4) != 0) {
+			std::cout << "ERROR::CHECKPOINT::Not a checkpoint " << path << std::endl;
+			return false;
+		}
+		if (header.version != expected.version) {
+			std::cout << "ERROR::CHECKPOINT::Version " << header.version << " not supported, expected " << expected.version << " " << path << std::endl;
+			return false;
+		}
+		MonodomainSolver* excitation = body.excitation && body.excitation->Active() ? body.excitation.get() : nullptr;
+		if (header.particleCount != body.particles.size() || header.springCount != body.topology->springs.size()
+			|| (excitation && (header.blocks & Excitation) && header.excitationNodes != excitation->NodeCount())) {
+			std::cout << "ERROR::CHECKPOINT::Mesh mismatch " << path << std::endl;
+			return false;
+		}
+
+		// Raw reads into spare arrays then a swap: no per particle work, and a truncated file leaves the body as it was
+		std::streamsize arrayBytes = (std::streamsize)(header.particleCount * sizeof(glm::vec3));
+		std::vector<glm::vec3> position(header.particleCount), velocity(header.particleCount);
+		file.read((char*)position.data(), arrayBytes);
+		file.read((char*)velocity.data(), arrayBytes);
+		std::vector<float> potential, recovery;
+		if (header.blocks & Excitation) {
+			std::streamsize fieldBytes = (std::streamsize)(header.excitationNodes * sizeof(float));
+			potential.resize(header.excitationNodes);
+			recovery.resize(header.excitationNodes);
+			file.read((char*)potential.data(), fieldBytes);
+			file.read((char*)recovery.data(), fieldBytes);
+		}
+		std::vector<float> tension;
+		if (header.blocks & Tension) {
+			tension.resize(header.particleCount);
+			file.read((char*)tension.data(), (std::streamsize)(header.particleCount * sizeof(float)));
+		}
+		bool useDouble = body.GetPrecision() == Precision::Double && (header.blocks & DoubleState);
+		std::vector<glm::dvec3> doublePosition, doubleVelocity;
+		if (useDouble) {
+			std::streamsize doubleBytes = (std::streamsize)(header.particleCount * sizeof(glm::dvec3));
+			doublePosition.resize(header.particleCount);
+			doubleVelocity.resize(header.particleCount);
+			file.read((char*)doublePosition.data(), doubleBytes);
+			file.read((char*)doubleVelocity.data(), doubleBytes);
+		}
+		if (!file) {
+			std::cout << "ERROR::CHECKPOINT::Truncated " << path << std::endl;
+			return false;
+		}
+		body.particles.position.swap(position);
+		body.particles.velocity.swap(velocity);
+		std::fill(body.particles.force.begin(), body.particles.force.end(), glm::vec3(0.0f));
+
+		// Double bodies get the full precision state back, or rebuild it from the floats of an older precision run
+		if (body.GetPrecision() == Precision::Double) {
+			ParticleStoreT<double>& state = body.doubleState;
+			state.resize(header.particleCount);
+			if (useDouble) {
+				state.position.swap(doublePosition);
+				state.velocity.swap(doubleVelocity);
+			}
+			else {
+				for (size_t i = 0; i < header.particleCount; i++) {
+					state.position[i] = glm::dvec3(body.particles.position[i]);
+					state.velocity[i] = glm::dvec3(body.particles.velocity[i]);
+				}
+			}
+			std::fill(state.force.begin(), state.force.end(), glm::dvec3(0.0));
+		}
+
+		// No saved tension means it was off: start relaxed
+		if (header.blocks & Tension) body.SetTension(std::move(tension));
+		else body.SetTension(std::vector<float>(body.Tension().size(), 0.0f));
+
+		body.simTime = header.simTime;
+		HeartOscillatorSystem& o = body.oscillator;
+		o.sa.x = header.oscillator[0];
+		o.sa.dx = header.oscillator[1];
+		o.av.x = header.oscillator[2];
+		o.av.dx = header.oscillator[3];
+		o.hpc.x = header.oscillator[4];
+		o.hpc.dx = header.oscillator[5];
+
+		// A field saved without excitation restarts from rest, one the body has no solver for is dropped
+		if (excitation) {
+			if (header.blocks & Excitation) excitation->Restore(potential.data(), recovery.data(), header.excitationTime, header.nextPace);
+			else excitation->Reset();
+		}
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "::CHECKPOINT:: restored " << path << " t=" << header.simTime << " s in " << ms << " ms" << std::endl;
+		return true;
+	}
+}
+
+Checkpointer::~Checkpointer()
+{
+	Flush();
+}
+
+void Checkpointer::Step(const SoftBody& body)
+{
+	if (interval <= 0.0) return;
+	if (nextTime < 0.0) nextTime = body.simTime + interval;
+	if (body.simTime < nextTime) return;
+
+	nextTime = body.simTime + interval;
+	Request(body);
+}
+
+void Checkpointer::Request(const SoftBody& body)
+{
+	// The previous write still owns the other buffer, skip rather than stall the step
+	if (writing && !writing->done) {
+		std::cout << "::CHECKPOINT:: previous write still running, skipped t=" << body.simTime << std::endl;
+		return;
+	}
+
+	std::vector<unsigned char>& buffer = buffers[filling];
+	Checkpoint::Capture(body, buffer);
+	filling = 1 - filling;
+
+	std::string target = path;
+	double time = body.simTime;
+	writing = Jobs::SubmitBackground([&buffer, target, time]() {
+		if (Checkpoint::Write(buffer, target)) {
+			std::cout << "::CHECKPOINT:: saved " << target << " t=" << time << " s (" << buffer.size() / 1024 << " KB)" << std::endl;
+		}
+	});
+}
+
+void Checkpointer::Flush()
+{
+	Jobs::Wait(writing);
+	writing.reset();
+}
+
+bool Checkpointer::Restore(SoftBody& body)
+{
+	Flush();
+	if (!Checkpoint::Load(body, path)) return false;
+	nextTime = -1.0; // simTime went back, the next Step schedules from it
+	return true;
+}
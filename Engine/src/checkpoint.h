@@ -0,0 +1,73 @@
+/*
+ * CHECKPOINT: Binary snapshots of a soft body's dynamic state, saved in the background and restored with memcpy
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "jobs.h"
+
+class SoftBody;
+
+namespace Checkpoint {
+	// Optional blocks, stored after the particles in this order when the flag is set
+	enum Block : uint32_t {
+		Excitation = 1 << 0,  // excitationNodes potentials then recoveries (float)
+		Tension = 1 << 1,     // particleCount active tensions (float)
+		DoubleState = 1 << 2, // particleCount positions then velocities (glm::dvec3), Precision::Double only
+	};
+
+	// File layout: header, then particleCount positions and particleCount velocities (glm::vec3, tightly packed),
+	// then the blocks flagged in blocks
+	struct Header {
+		char magic[4] = { 'J', 'C', 'K', 'P' };
+		uint32_t version = 2;
+		uint64_t particleCount = 0;
+		uint64_t springCount = 0;   // guards against restoring into a different mesh
+		double simTime = 0.0;
+		double oscillator[6] = {};  // sa, av, hpc: x then dx
+		uint32_t blocks = 0;
+		uint32_t reserved = 0;
+		uint64_t excitationNodes = 0;
+		double excitationTime = 0.0; // monodomain clock and its next pacing stimulus, seconds
+		double nextPace = 0.0;
+	};
+
+	// Serialises the body into buffer (header + raw arrays), the only work done on the simulation thread
+	void Capture(const SoftBody& body, std::vector<unsigned char>& buffer);
+
+	bool Write(const std::vector<unsigned char>& buffer, const std::string& path);
+	bool Save(const SoftBody& body, const std::string& path);
+
+	// Reads the raw arrays back with no per particle work, returns false (body untouched) if the file does not match
+	bool Load(SoftBody& body, const std::string& path);
+}
+
+// Periodic checkpoints written by a background job, the step loop only pays for the memcpy
+class Checkpointer {
+public:
+	std::string path = "softbody.jckp";
+	double interval = 60.0; // simulated seconds between checkpoints (<= 0 disables)
+
+	~Checkpointer();
+
+	// Call after each step, captures and queues a write when the interval has passed
+	void Step(const SoftBody& body);
+
+	// Checkpoint now, regardless of the interval
+	void Request(const SoftBody& body);
+
+	// Blocks until the write in flight (if any) is on disk
+	void Flush();
+
+	// Flushes, then loads the last checkpoint into body. The interval restarts from the restored time.
+	bool Restore(SoftBody& body);
+
+private:
+	std::vector<unsigned char> buffers[2]; // one being written, one being filled
+	int filling = 0;
+	Jobs::Handle writing;
+	double nextTime = -1.0;
+};
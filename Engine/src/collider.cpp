@@ -0,0 +1,378 @@
+/*
+ * COLLIDER: Rigid collision shapes registered on the scene and resolved against soft body particles
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include "collider.h"
+#include "model.h"
+#include "jobs.h"
+
+// Closest point on triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+	float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+/*
+ * Triangle BVH
+ */
+
+static const unsigned int BVH_LEAF_SIZE = 4;
+
+TriangleBVH::TriangleBVH(std::vector<glm::vec3> positions, std::vector<unsigned int> triangles)
+	: positions(std::move(positions)), triangles(std::move(triangles))
+{
+	unsigned int count = (unsigned int)(this->triangles.size() / 3);
+	std::vector<glm::vec3> centroids(count);
+	order.resize(count);
+	for (unsigned int t = 0; t < count; t++) {
+		order[t] = t;
+		centroids[t] = (this->positions[this->triangles[t * 3]] + this->positions[this->triangles[t * 3 + 1]] + this->positions[this->triangles[t * 3 + 2]]) / 3.0f;
+	}
+
+	nodes.reserve(count > 0 ? 2 * count / BVH_LEAF_SIZE + 1 : 1);
+	build(0, count, centroids, 0);
+	lo = nodes[0].lo;
+	hi = nodes[0].hi;
+}
+
+unsigned int TriangleBVH::build(unsigned int begin, unsigned int end, const std::vector<glm::vec3>& centroids, unsigned int level)
+{
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(Node());
+	depth = std::max(depth, level);
+
+	glm::vec3 lo(FLT_MAX), hi(-FLT_MAX), clo(FLT_MAX), chi(-FLT_MAX);
+	for (unsigned int i = begin; i < end; i++) {
+		unsigned int t = order[i];
+		for (int k = 0; k < 3; k++) {
+			lo = glm::min(lo, positions[triangles[t * 3 + k]]);
+			hi = glm::max(hi, positions[triangles[t * 3 + k]]);
+		}
+		clo = glm::min(clo, centroids[t]);
+		chi = glm::max(chi, centroids[t]);
+	}
+	nodes[index].lo = lo;
+	nodes[index].hi = hi;
+
+	if (end - begin <= BVH_LEAF_SIZE) {
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return index;
+	}
+
+	// Median split along the widest centroid axis
+	glm::vec3 extent = chi - clo;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	unsigned int mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+		[&](unsigned int x, unsigned int y) { return centroids[x][axis] < centroids[y][axis]; });
+
+	// The left child comes right after its parent, the right one after the whole left subtree
+	build(begin, mid, centroids, level + 1);
+	unsigned int right = build(mid, end, centroids, level + 1);
+	nodes[index].first = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+static inline float boxDistance2(const glm::vec3& p, const glm::vec3& lo, const glm::vec3& hi)
+{
+	glm::vec3 d = glm::max(glm::max(lo - p, p - hi), glm::vec3(0.0f));
+	return glm::dot(d, d);
+}
+
+bool TriangleBVH::Closest(const glm::vec3& p, float maxDistance, glm::vec3& point, glm::vec3& normal) const
+{
+	float best = maxDistance * maxDistance;
+	unsigned int bestTriangle = UINT32_MAX;
+
+	// Each level pops one node and pushes two, so depth + 1 entries always suffice
+	unsigned int local[64];
+	std::vector<unsigned int> deep;
+	unsigned int* stack = local;
+	if (depth + 1 > 64) {
+		deep.resize(depth + 1);
+		stack = deep.data();
+	}
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		unsigned int index = stack[--top];
+		const Node& node = nodes[index];
+		if (boxDistance2(p, node.lo, node.hi) >= best) continue;
+
+		if (node.count > 0) {
+			for (unsigned int i = node.first; i < node.first + node.count; i++) {
+				unsigned int t = order[i];
+				glm::vec3 q = ClosestPointOnTriangle(p, positions[triangles[t * 3]], positions[triangles[t * 3 + 1]], positions[triangles[t * 3 + 2]]);
+				float d2 = glm::dot(p - q, p - q);
+				if (d2 < best) {
+					best = d2;
+					bestTriangle = t;
+					point = q;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first so the far one is more likely to be culled
+		unsigned int left = index + 1, right = node.first;
+		const Node& l = nodes[left];
+		const Node& r = nodes[right];
+		bool leftFirst = boxDistance2(p, l.lo, l.hi) < boxDistance2(p, r.lo, r.hi);
+		stack[top++] = leftFirst ? right : left;
+		stack[top++] = leftFirst ? left : right;
+	}
+
+	if (bestTriangle == UINT32_MAX) return false;
+
+	glm::vec3 a = positions[triangles[bestTriangle * 3]];
+	normal = glm::normalize(glm::cross(positions[triangles[bestTriangle * 3 + 1]] - a, positions[triangles[bestTriangle * 3 + 2]] - a));
+	return true;
+}
+
+/*
+ * Collider set
+ */
+
+int ColliderSet::AddPlane(glm::vec3 normal, float offset, float restitution, float friction)
+{
+	Collider c;
+	c.type = ColliderType::Plane;
+	c.a = glm::normalize(normal);
+	c.offset = offset;
+	c.restitution = restitution;
+	c.friction = friction;
+	colliders.push_back(c);
+	return (int)colliders.size() - 1;
+}
+
+int ColliderSet::AddSphere(glm::vec3 center, float radius, float restitution, float friction, bool inverted)
+{
+	Collider c;
+	c.type = ColliderType::Sphere;
+	c.a = center;
+	c.radius = radius;
+	c.restitution = restitution;
+	c.friction = friction;
+	c.inverted = inverted;
+	colliders.push_back(c);
+	return (int)colliders.size() - 1;
+}
+
+int ColliderSet::AddCapsule(glm::vec3 a, glm::vec3 b, float radius, float restitution, float friction, bool inverted)
+{
+	Collider c;
+	c.type = ColliderType::Capsule;
+	c.a = a;
+	c.b = b;
+	c.radius = radius;
+	c.restitution = restitution;
+	c.friction = friction;
+	c.inverted = inverted;
+	colliders.push_back(c);
+	return (int)colliders.size() - 1;
+}
+
+int ColliderSet::AddBox(glm::vec3 center, glm::vec3 halfExtents, glm::mat3 rotation, float restitution, float friction, bool inverted)
+{
+	Collider c;
+	c.type = ColliderType::Box;
+	c.a = center;
+	c.b = halfExtents;
+	c.rotation = rotation;
+	c.restitution = restitution;
+	c.friction = friction;
+	c.inverted = inverted;
+	colliders.push_back(c);
+	return (int)colliders.size() - 1;
+}
+
+int ColliderSet::AddTriangleMesh(Model& model, float contactDistance, float restitution, float friction, bool inverted)
+{
+	// Bake the model's current transform, the collider is static afterwards
+	glm::mat4 transform = model.getTransform();
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> triangles;
+	for (const Mesh& mesh : model.meshes) {
+		unsigned int base = (unsigned int)positions.size();
+		for (const Vertex& v : mesh.Vertices()) {
+			positions.push_back(glm::vec3(transform * glm::vec4(v.position, 1.0f)));
+		}
+		for (unsigned int idx : mesh.Indices()) {
+			triangles.push_back(base + idx);
+		}
+	}
+
+	Collider c;
+	c.type = ColliderType::TriangleMesh;
+	c.mesh = std::make_shared<TriangleBVH>(std::move(positions), std::move(triangles));
+	c.radius = contactDistance;
+	c.restitution = restitution;
+	c.friction = friction;
+	c.inverted = inverted;
+	colliders.push_back(c);
+	return (int)colliders.size() - 1;
+}
+
+void ColliderSet::evaluate(const Collider& c, long count, ColliderScratch& scratch) const
+{
+	// Signed distance (negative = penetrating) and outward normal for every particle.
+	// The shape is chosen once per collider so each loop body is branch-light and vectorisable.
+	const glm::vec3* p = scratch.world.data();
+	float* dist = scratch.distance.data();
+	glm::vec3* n = scratch.normal.data();
+	const float sign = c.inverted ? -1.0f : 1.0f;
+
+	switch (c.type) {
+	case ColliderType::Plane:
+		Jobs::ParallelFor(0, count, 1024, [&](long i) {
+			dist[i] = glm::dot(c.a, p[i]) - c.offset;
+			n[i] = c.a;
+		});
+		break;
+
+	case ColliderType::Sphere:
+		Jobs::ParallelFor(0, count, 1024, [&](long i) {
+			glm::vec3 d = p[i] - c.a;
+			float len = glm::max(glm::length(d), 1e-12f);
+			dist[i] = sign * (len - c.radius);
+			n[i] = d * (sign / len);
+		});
+		break;
+
+	case ColliderType::Capsule: {
+		glm::vec3 ab = c.b - c.a;
+		float invLen2 = 1.0f / glm::max(glm::dot(ab, ab), 1e-12f);
+		Jobs::ParallelFor(0, count, 1024, [&](long i) {
+			float t = glm::clamp(glm::dot(p[i] - c.a, ab) * invLen2, 0.0f, 1.0f);
+			glm::vec3 d = p[i] - (c.a + ab * t);
+			float len = glm::max(glm::length(d), 1e-12f);
+			dist[i] = sign * (len - c.radius);
+			n[i] = d * (sign / len);
+		});
+		break;
+	}
+
+	case ColliderType::Box: {
+		glm::mat3 toBox = glm::transpose(c.rotation);
+		Jobs::ParallelFor(0, count, 1024, [&](long i) {
+			glm::vec3 q = toBox * (p[i] - c.a);
+			glm::vec3 d = glm::abs(q) - c.b;
+			glm::vec3 outside = glm::max(d, glm::vec3(0.0f));
+			float outLen = glm::length(outside);
+			float inside = glm::min(glm::max(d.x, glm::max(d.y, d.z)), 0.0f);
+
+			// Gradient: towards the nearest face from inside, along the outside offset otherwise
+			glm::vec3 axis = (d.x >= d.y && d.x >= d.z) ? glm::vec3(1, 0, 0) : (d.y >= d.z ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1));
+			glm::vec3 gradient = outLen > 0.0f ? outside / outLen : axis;
+			gradient *= glm::sign(q) + glm::vec3(q.x == 0.0f, q.y == 0.0f, q.z == 0.0f);
+
+			dist[i] = sign * (outLen + inside);
+			n[i] = c.rotation * gradient * sign;
+		});
+		break;
+	}
+
+	case ColliderType::TriangleMesh: {
+		const TriangleBVH& bvh = *c.mesh;
+		Jobs::ParallelFor(0, count, 256, [&](long i) {
+			// Only particles within the contact distance of the surface can be in contact
+			glm::vec3 q, faceNormal;
+			if (boxDistance2(p[i], bvh.lo, bvh.hi) > c.radius * c.radius || !bvh.Closest(p[i], c.radius, q, faceNormal)) {
+				dist[i] = c.radius;
+				n[i] = glm::vec3(0.0f);
+				return;
+			}
+			glm::vec3 d = p[i] - q;
+			float len = glm::length(d);
+			bool front = glm::dot(d, faceNormal) >= 0.0f;
+			glm::vec3 outward = len > 1e-6f ? (front ? d / len : -d / len) : faceNormal;
+			float signedDist = front ? len : -len;
+
+			dist[i] = sign * signedDist;
+			n[i] = outward * sign;
+		});
+		break;
+	}
+	}
+}
+
+void ColliderSet::Resolve(ParticleStore& particles, const glm::mat4& transform, float bodyRestitution, ColliderScratch& scratch) const
+{
+	const long count = (long)particles.size();
+	if (colliders.empty() || count == 0) return;
+
+	scratch.world.resize(count);
+	scratch.distance.resize(count);
+	scratch.normal.resize(count);
+	glm::vec3* world = scratch.world.data();
+	const float* distance = scratch.distance.data();
+	const glm::vec3* normal = scratch.normal.data();
+
+	// Particles live in the body's local space, colliders in world space
+	glm::mat3 toWorld = glm::mat3(transform);
+	glm::mat3 toLocal = glm::inverse(toWorld);
+	glm::vec3* position = particles.position.data();
+	glm::vec3* velocity = particles.velocity.data();
+
+	Jobs::ParallelFor(0, count, 1024, [&](long i) {
+		world[i] = glm::vec3(transform * glm::vec4(position[i], 1.0f));
+	});
+
+	for (const Collider& c : colliders) {
+		evaluate(c, count, scratch);
+
+		const float restitution = glm::max(c.restitution, bodyRestitution);
+		const float friction = c.friction;
+
+		Jobs::ParallelFor(0, count, 1024, [&](long i) {
+			float d = distance[i];
+			if (d >= 0.0f) return;
+
+			// Project out of the collider
+			glm::vec3 n = normal[i];
+			glm::vec3 correction = n * -d;
+			world[i] += correction;
+			position[i] += toLocal * correction;
+
+			// Reflect the approaching normal velocity, Coulomb friction on the tangential part
+			glm::vec3 v = toWorld * velocity[i];
+			float vn = glm::dot(v, n);
+			if (vn >= 0.0f) return;
+
+			glm::vec3 vt = v - n * vn;
+			float vtLen = glm::length(vt);
+			float impulse = -(1.0f + restitution) * vn;
+			if (vtLen > 1e-12f) {
+				vt *= glm::max(0.0f, 1.0f - friction * impulse / vtLen);
+			}
+			velocity[i] = toLocal * (vt - n * (vn * restitution));
+		});
+	}
+}
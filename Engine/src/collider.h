@@ -0,0 +1,90 @@
+/*
+ * COLLIDER: Rigid collision shapes registered on the scene and resolved against soft body particles
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <glm/glm.hpp>
+#include "particles.h"
+
+class Model;
+
+glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+// Bounding volume hierarchy over a static triangle soup (world space)
+class TriangleBVH {
+public:
+	TriangleBVH(std::vector<glm::vec3> positions, std::vector<unsigned int> triangles);
+
+	// Closest point on the mesh within maxDistance, returns false if nothing is that close
+	bool Closest(const glm::vec3& p, float maxDistance, glm::vec3& point, glm::vec3& normal) const;
+
+	glm::vec3 lo, hi; // bounds of the whole mesh
+
+private:
+	struct Node {
+		glm::vec3 lo, hi;
+		unsigned int first; // right child (inner, the left one follows the node) or first triangle slot (leaf)
+		unsigned int count; // 0 for inner nodes
+	};
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> triangles;
+	std::vector<unsigned int> order; // triangle ids, leaves index contiguous ranges
+	std::vector<Node> nodes;
+	unsigned int depth = 0; // deepest level below the root, sizes the traversal stack
+
+	unsigned int build(unsigned int begin, unsigned int end, const std::vector<glm::vec3>& centroids, unsigned int level);
+};
+
+enum class ColliderType {
+	Plane,
+	Sphere,
+	Capsule,
+	Box,
+	TriangleMesh
+};
+
+struct Collider {
+	ColliderType type;
+	float restitution = 0.0f;
+	float friction = 0.0f;
+	bool inverted = false; // keep particles inside instead of outside (e.g. the pericardial sac)
+
+	// Shape data, all in world space
+	glm::vec3 a = glm::vec3(0.0f);      // plane normal, sphere/box centre, capsule start
+	glm::vec3 b = glm::vec3(0.0f);      // capsule end, box half extents
+	float offset = 0.0f;                // plane offset (dot(normal, p) >= offset is free space)
+	float radius = 0.0f;                // sphere/capsule radius, mesh contact distance
+	glm::mat3 rotation = glm::mat3(1.0f); // box orientation (columns are the box axes)
+	std::shared_ptr<TriangleBVH> mesh;
+};
+
+// Per body scratch for ColliderSet::Resolve, so bodies stepped concurrently never share it
+struct ColliderScratch {
+	std::vector<glm::vec3> world;
+	std::vector<float> distance;
+	std::vector<glm::vec3> normal;
+
+	size_t Bytes() const { return (world.size() + normal.size()) * sizeof(glm::vec3) + distance.size() * sizeof(float); }
+};
+
+class ColliderSet {
+public:
+	std::vector<Collider> colliders;
+
+	int AddPlane(glm::vec3 normal, float offset, float restitution, float friction);
+	int AddSphere(glm::vec3 center, float radius, float restitution, float friction, bool inverted = false);
+	int AddCapsule(glm::vec3 a, glm::vec3 b, float radius, float restitution, float friction, bool inverted = false);
+	int AddBox(glm::vec3 center, glm::vec3 halfExtents, glm::mat3 rotation, float restitution, float friction, bool inverted = false);
+	int AddTriangleMesh(Model& model, float contactDistance, float restitution, float friction, bool inverted = false);
+
+	// Batched contact pass: every collider's SDF is evaluated over all particles, then penetrating
+	// particles are pushed out and their velocity reflected. bodyRestitution is combined with max().
+	// Read only on the set, all per pass state lives in the caller's scratch.
+	void Resolve(ParticleStore& particles, const glm::mat4& transform, float bodyRestitution, ColliderScratch& scratch) const;
+
+private:
+	void evaluate(const Collider& c, long count, ColliderScratch& scratch) const;
+};
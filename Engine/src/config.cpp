@@ -0,0 +1,448 @@
+/*
+ * CONFIG: JSON scene and parameter files, watched on disk so edits reach the running simulation
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include "config.h"
+#include "physics.h"
+#include "physicsWorld.h"
+
+namespace Config {
+	// Recursive descent over the whole text, the files are small
+	class Parser {
+	public:
+		Parser(const std::string& text) : text(text) {}
+
+		bool Document(Value& out) {
+			skip();
+			if (!value(out, 0)) return false;
+			skip();
+			if (pos != text.size()) return fail("unexpected text after the document");
+			return true;
+		}
+
+		std::string error;
+
+	private:
+		const std::string& text;
+		size_t pos = 0;
+
+		static constexpr int maxDepth = 64;
+
+		bool fail(const std::string& what) {
+			int line = 1;
+			for (size_t i = 0; i < pos && i < text.size(); i++) line += text[i] == '\n';
+			error = "line " + std::to_string(line) + ": " + what;
+			return false;
+		}
+
+		// Whitespace and // comments
+		void skip() {
+			while (pos < text.size()) {
+				char c = text[pos];
+				if (c == ' ' || c == '\t' || c == '\n' || c == '\r') pos++;
+				else if (c == '/' && pos + 1 < text.size() && text[pos + 1] == '/') {
+					while (pos < text.size() && text[pos] != '\n') pos++;
+				}
+				else break;
+			}
+		}
+
+		bool literal(const char* word) {
+			size_t n = std::char_traits<char>::length(word);
+			if (text.compare(pos, n, word) != 0) return false;
+			pos += n;
+			return true;
+		}
+
+		bool value(Value& out, int depth) {
+			if (depth > maxDepth) return fail("nested too deeply");
+			if (pos >= text.size()) return fail("unexpected end of file");
+
+			char c = text[pos];
+			if (c == '{') return object(out, depth);
+			if (c == '[') return array(out, depth);
+			if (c == '"') {
+				out = Value();
+				out.type = Value::Type::String;
+				return string(out.string);
+			}
+			if (literal("true")) { out = Value(true); return true; }
+			if (literal("false")) { out = Value(false); return true; }
+			if (literal("null")) { out = Value(); return true; }
+			return number(out);
+		}
+
+		bool object(Value& out, int depth) {
+			out = Value();
+			out.type = Value::Type::Object;
+			pos++;
+			skip();
+			if (pos < text.size() && text[pos] == '}') { pos++; return true; }
+			while (true) {
+				skip();
+				if (pos >= text.size() || text[pos] != '"') return fail("expected a key");
+				std::string key;
+				if (!string(key)) return false;
+				skip();
+				if (pos >= text.size() || text[pos] != ':') return fail("expected ':' after \"" + key + "\"");
+				pos++;
+				skip();
+				if (!value(out.members[key], depth + 1)) return false;
+				skip();
+				if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+				if (pos < text.size() && text[pos] == '}') { pos++; return true; }
+				return fail("expected ',' or '}'");
+			}
+		}
+
+		bool array(Value& out, int depth) {
+			out = Value();
+			out.type = Value::Type::Array;
+			pos++;
+			skip();
+			if (pos < text.size() && text[pos] == ']') { pos++; return true; }
+			while (true) {
+				skip();
+				out.items.emplace_back();
+				if (!value(out.items.back(), depth + 1)) return false;
+				skip();
+				if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+				if (pos < text.size() && text[pos] == ']') { pos++; return true; }
+				return fail("expected ',' or ']'");
+			}
+		}
+
+		bool string(std::string& out) {
+			pos++; // opening quote
+			while (pos < text.size()) {
+				char c = text[pos++];
+				if (c == '"') return true;
+				if (c == '\n') return fail("unterminated string");
+				if (c != '\\') { out += c; continue; }
+				if (pos >= text.size()) break;
+				char e = text[pos++];
+				switch (e) {
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/': out += '/'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u': {
+					// Paths and names only, so code points are written as UTF-8 without surrogate pairing
+					if (pos + 4 > text.size()) return fail("bad \\u escape");
+					unsigned long code = std::strtoul(text.substr(pos, 4).c_str(), nullptr, 16);
+					pos += 4;
+					if (code < 0x80) out += (char)code;
+					else if (code < 0x800) {
+						out += (char)(0xC0 | (code >> 6));
+						out += (char)(0x80 | (code & 0x3F));
+					}
+					else {
+						out += (char)(0xE0 | (code >> 12));
+						out += (char)(0x80 | ((code >> 6) & 0x3F));
+						out += (char)(0x80 | (code & 0x3F));
+					}
+					break;
+				}
+				default: return fail(std::string("bad escape \\") + e);
+				}
+			}
+			return fail("unterminated string");
+		}
+
+		bool number(Value& out) {
+			const char* start = text.c_str() + pos;
+			char* end = nullptr;
+			double n = std::strtod(start, &end);
+			if (end == start) return fail(std::string("unexpected '") + text[pos] + "'");
+			pos += end - start;
+			out = Value(n);
+			return true;
+		}
+	};
+
+	const Value& Value::operator[](const std::string& key) const
+	{
+		static const Value null;
+		if (type != Type::Object) return null;
+		auto it = members.find(key);
+		return it != members.end() ? it->second : null;
+	}
+
+	const Value& Value::operator[](size_t index) const
+	{
+		static const Value null;
+		if (type != Type::Array || index >= items.size()) return null;
+		return items[index];
+	}
+
+	glm::vec3 Value::Vec3(const glm::vec3& fallback) const
+	{
+		if (type == Type::Number) return glm::vec3((float)number);
+		if (type != Type::Array || items.size() != 3) return fallback;
+		return glm::vec3(items[0].Float(fallback.x), items[1].Float(fallback.y), items[2].Float(fallback.z));
+	}
+
+	bool Value::operator==(const Value& other) const
+	{
+		if (type != other.type) return false;
+		switch (type) {
+		case Type::Bool: return boolean == other.boolean;
+		case Type::Number: return number == other.number;
+		case Type::String: return string == other.string;
+		case Type::Array: return items == other.items;
+		case Type::Object: return members == other.members;
+		default: return true;
+		}
+	}
+
+	bool Parse(const std::string& text, Value& out, std::string& error)
+	{
+		Parser parser(text);
+		Value document;
+		if (!parser.Document(document)) {
+			error = parser.error;
+			return false;
+		}
+		out = std::move(document);
+		return true;
+	}
+
+	bool Load(const std::string& path, Value& out)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			std::cout << "ERROR::CONFIG::Cannot open " << path << std::endl;
+			return false;
+		}
+		std::stringstream text;
+		text << file.rdbuf();
+
+		std::string error;
+		if (!Parse(text.str(), out, error)) {
+			std::cout << "ERROR::CONFIG::" << path << " " << error << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	void ApplyBody(const Value& body, SoftBody& softBody)
+	{
+		softBody.restitution = body["restitution"].Float(softBody.restitution);
+		softBody.mass = body["mass"].Float(softBody.mass);
+		softBody.stiffness = body["stiffness"].Float(softBody.stiffness);
+		softBody.damping = body["damping"].Float(softBody.damping);
+		softBody.color = body["color"].Vec3(softBody.color);
+
+		// Surface repulsion is opt in, scaled with the springs
+		softBody.selfCollision.enabled = body["selfCollision"].Bool(softBody.selfCollision.enabled);
+		softBody.selfCollision.stiffness = softBody.stiffness;
+
+		const Value& zones = body["zones"];
+		if (!zones.IsNull()) {
+			HeartZoneSettings settings = softBody.Zones();
+			const std::string& method = zones["method"].String("");
+			if (method == "colours") settings.method = HeartZoneSettings::Method::Colours;
+			else if (method == "groups") settings.method = HeartZoneSettings::Method::Groups;
+			else if (method == "nearest") settings.method = HeartZoneSettings::Method::NearestSeed;
+			else if (method == "geodesic") settings.method = HeartZoneSettings::Method::Geodesic;
+			else if (!method.empty()) std::cout << "ERROR::CONFIG::Unknown zone method " << method << std::endl;
+
+			settings.delta = zones["delta"].Float(settings.delta);
+			settings.sa = zones["sa"].Vec3(settings.sa);
+			settings.av = zones["av"].Vec3(settings.av);
+			settings.hpc = zones["hpc"].Vec3(settings.hpc);
+			for (const auto& [zone, group] : zones["groups"].Members()) settings.groups[zone] = group.String(zone);
+
+			// "seeds": { "zone": [[x, y, z], ...] }, replaces all seeds when present
+			const Value& seeds = zones["seeds"];
+			if (!seeds.IsNull()) {
+				settings.seeds.clear();
+				for (const auto& [zone, points] : seeds.Members()) {
+					for (const Value& point : points.Items()) settings.seeds.push_back({ zone, point.Vec3(glm::vec3(0.0f)) });
+				}
+			}
+			settings.radius = zones["radius"].Float(settings.radius);
+			softBody.SetZones(settings);
+		}
+	}
+
+	// The three nodes share their parameter names, the coupling constants differ
+	template<typename Node>
+	static void applyNode(const Value& node, Node& target)
+	{
+		target.a = node["a"].Number(target.a);
+		target.d = node["d"].Number(target.d);
+		target.e = node["e"].Number(target.e);
+		target.w1 = node["w1"].Number(target.w1);
+		target.w2 = node["w2"].Number(target.w2);
+		target.q = node["q"].Number(target.q);
+		target.omega = node["omega"].Number(target.omega);
+	}
+
+	void ApplyOscillator(const Value& oscillator, HeartOscillatorSystem& system)
+	{
+		const Value& sa = oscillator["sa"];
+		applyNode(sa, system.sa);
+		system.sa.kSA_to_AV = sa["kSA_to_AV"].Number(system.sa.kSA_to_AV);
+		system.sa.kSA_to_HP = sa["kSA_to_HP"].Number(system.sa.kSA_to_HP);
+
+		const Value& av = oscillator["av"];
+		applyNode(av, system.av);
+		system.av.kAV_to_SA = av["kAV_to_SA"].Number(system.av.kAV_to_SA);
+		system.av.kAV_to_HP = av["kAV_to_HP"].Number(system.av.kAV_to_HP);
+
+		const Value& hpc = oscillator["hpc"];
+		applyNode(hpc, system.hpc);
+		system.hpc.kHP_to_SA = hpc["kHP_to_SA"].Number(system.hpc.kHP_to_SA);
+		system.hpc.kHP_to_AV = hpc["kHP_to_AV"].Number(system.hpc.kHP_to_AV);
+
+		// ECG weights
+		system.a0 = oscillator["a0"].Number(system.a0);
+		system.a1 = oscillator["a1"].Number(system.a1);
+		system.a3 = oscillator["a3"].Number(system.a3);
+		system.a5 = oscillator["a5"].Number(system.a5);
+	}
+
+	void ApplyExcitation(const Value& excitation, SoftBody& softBody)
+	{
+		if (excitation.IsNull()) return;
+		if (!excitation["enabled"].Bool(softBody.excitation != nullptr)) {
+			softBody.DisableExcitation();
+			return;
+		}
+		if (!softBody.EnableExcitation()) return;
+
+		MonodomainSolver& solver = *softBody.excitation;
+		const std::string& model = excitation["model"].String("");
+		if (model == "aliev-panfilov") solver.model = MonodomainSolver::Model::AlievPanfilov;
+		else if (model == "fitzhugh-nagumo") solver.model = MonodomainSolver::Model::FitzHughNagumo;
+		else if (!model.empty()) std::cout << "ERROR::CONFIG::Unknown excitation model " << model << std::endl;
+
+		solver.diffusivity = excitation["diffusivity"].Float(solver.diffusivity);
+		solver.timeScale = excitation["timeScale"].Float(solver.timeScale);
+		solver.maxStep = excitation["maxStep"].Float(solver.maxStep);
+		solver.maxSubsteps = excitation["maxSubsteps"].Int(solver.maxSubsteps);
+		solver.pacingPeriod = excitation["pacingPeriod"].Float(solver.pacingPeriod);
+		solver.reportInterval = excitation["reportInterval"].Int(solver.reportInterval);
+
+		const Value& ap = excitation["alievPanfilov"];
+		solver.k = ap["k"].Float(solver.k);
+		solver.a = ap["a"].Float(solver.a);
+		solver.epsilon0 = ap["epsilon0"].Float(solver.epsilon0);
+		solver.mu1 = ap["mu1"].Float(solver.mu1);
+		solver.mu2 = ap["mu2"].Float(solver.mu2);
+
+		const Value& fhn = excitation["fitzhughNagumo"];
+		solver.fhnA = fhn["a"].Float(solver.fhnA);
+		solver.fhnB = fhn["b"].Float(solver.fhnB);
+		solver.fhnC1 = fhn["c1"].Float(solver.fhnC1);
+		solver.fhnC2 = fhn["c2"].Float(solver.fhnC2);
+		solver.fhnD = fhn["d"].Float(solver.fhnD);
+	}
+
+	void ApplyActive(const Value& settings, SoftBody& softBody)
+	{
+		if (settings.IsNull()) return;
+		ActiveTension active = softBody.Active();
+		const std::string& source = settings["source"].String("");
+		if (source == "off") active.source = ActiveTension::Source::Off;
+		else if (source == "oscillator") active.source = ActiveTension::Source::Oscillator;
+		else if (source == "excitation") active.source = ActiveTension::Source::Excitation;
+		else if (!source.empty()) std::cout << "ERROR::CONFIG::Unknown active tension source " << source << std::endl;
+
+		const std::string& fibres = settings["fibres"].String("");
+		if (fibres == "axis") active.fibres = ActiveTension::Fibres::Axis;
+		else if (fibres == "helical") active.fibres = ActiveTension::Fibres::Helical;
+		else if (!fibres.empty()) std::cout << "ERROR::CONFIG::Unknown fibre layout " << fibres << std::endl;
+
+		active.contraction = settings["contraction"].Float(active.contraction);
+		active.timeConstant = settings["timeConstant"].Float(active.timeConstant);
+		const Value& range = settings["oscillatorRange"];
+		active.oscillatorRange = glm::vec2(range[size_t(0)].Float(active.oscillatorRange.x), range[size_t(1)].Float(active.oscillatorRange.y));
+		active.axis = settings["axis"].Vec3(active.axis);
+		active.helixAngle = settings["helixAngle"].Float(active.helixAngle);
+		softBody.SetActiveTension(active);
+	}
+
+	void ApplyEcg(const Value& ecg, SoftBody& softBody)
+	{
+		if (ecg.IsNull()) return;
+		if (!ecg["enabled"].Bool(false)) {
+			softBody.DisableECG();
+			return;
+		}
+
+		// The standard placement around the mesh, any electrode can be moved (model space)
+		Ecg::ElectrodeLayout layout = softBody.StandardElectrodes(ecg["distance"].Float(2.0f));
+		const Value& electrodes = ecg["electrodes"];
+		for (int e = 0; e < Ecg::ElectrodeCount; e++) {
+			layout.positions[e] = electrodes[Ecg::ElectrodeName(e)].Vec3(layout.positions[e]);
+		}
+		softBody.EnableECG(layout, ecg["sampleRate"].Float(1000.0f));
+	}
+
+	void ApplyWorld(const Value& world, PhysicsWorld& physicsWorld)
+	{
+		physicsWorld.gravity = world["gravity"].Vec3(physicsWorld.gravity);
+		physicsWorld.interBodyCollision = world["interBodyCollision"].Bool(physicsWorld.interBodyCollision);
+	}
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+	Jobs::Wait(parsing);
+}
+
+bool ConfigWatcher::Open(const std::string& path)
+{
+	Jobs::Wait(parsing);
+	parsing.reset();
+	this->path = path;
+	root = Config::Value();
+	previous = Config::Value();
+	sinceCheck = 0.0f;
+
+	std::error_code error;
+	stamp = std::filesystem::last_write_time(path, error);
+	return Config::Load(path, root);
+}
+
+bool ConfigWatcher::Poll(float dt)
+{
+	if (path.empty()) return false;
+
+	// A finished parse is swapped in here, on the thread that reads Root()
+	if (parsing && parsing->done) {
+		parsing.reset();
+		if (parsedOk) {
+			previous = std::move(root);
+			root = std::move(*parsed);
+			std::cout << "::CONFIG:: reloaded " << path << std::endl;
+			return true;
+		}
+	}
+
+	sinceCheck += dt;
+	if (sinceCheck < interval || parsing) return false;
+	sinceCheck = 0.0f;
+
+	std::error_code error;
+	std::filesystem::file_time_type now = std::filesystem::last_write_time(path, error);
+	if (error || now == stamp) return false;
+	stamp = now;
+
+	// Reading and parsing stay off the frame
+	parsed = std::make_shared<Config::Value>();
+	parsing = Jobs::SubmitBackground([this]() {
+		parsedOk = Config::Load(path, *parsed);
+	});
+	return false;
+}
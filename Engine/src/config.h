@@ -0,0 +1,113 @@
+/*
+ * CONFIG: JSON scene and parameter files, watched on disk so edits reach the running simulation
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "jobs.h"
+
+class SoftBody;
+class PhysicsWorld;
+struct HeartOscillatorSystem;
+
+namespace Config {
+	// Parsed JSON document. Lookups never fail: a missing key or an index past the end gives a null value,
+	// and the typed getters return their fallback for anything that is not of their type.
+	class Value {
+	public:
+		enum class Type { Null, Bool, Number, String, Array, Object };
+
+		Value() = default;
+		explicit Value(bool b) : type(Type::Bool), boolean(b) {}
+		explicit Value(double n) : type(Type::Number), number(n) {}
+		explicit Value(std::string s) : type(Type::String), string(std::move(s)) {}
+
+		Type GetType() const { return type; }
+		bool IsNull() const { return type == Type::Null; }
+		bool Has(const std::string& key) const { return type == Type::Object && members.count(key) != 0; }
+		size_t Size() const { return type == Type::Array ? items.size() : type == Type::Object ? members.size() : 0; }
+
+		const Value& operator[](const std::string& key) const;
+		const Value& operator[](size_t index) const;
+
+		bool Bool(bool fallback) const { return type == Type::Bool ? boolean : fallback; }
+		double Number(double fallback) const { return type == Type::Number ? number : fallback; }
+		float Float(float fallback) const { return type == Type::Number ? (float)number : fallback; }
+		int Int(int fallback) const { return type == Type::Number ? (int)number : fallback; }
+		const std::string& String(const std::string& fallback) const { return type == Type::String ? string : fallback; }
+		glm::vec3 Vec3(const glm::vec3& fallback) const; // [x, y, z], a single number fills all three
+
+		const std::vector<Value>& Items() const { return items; }
+		const std::map<std::string, Value>& Members() const { return members; }
+
+		bool operator==(const Value& other) const;
+		bool operator!=(const Value& other) const { return !(*this == other); }
+
+	private:
+		friend class Parser;
+
+		Type type = Type::Null;
+		bool boolean = false;
+		double number = 0.0;
+		std::string string;
+		std::vector<Value> items;
+		std::map<std::string, Value> members;
+	};
+
+	// Standard JSON plus // line comments. On failure error holds "line N: what".
+	bool Parse(const std::string& text, Value& out, std::string& error);
+
+	// Reads and parses a file, printing ERROR::CONFIG on failure (out is untouched then)
+	bool Load(const std::string& path, Value& out);
+
+	// Apply the parameter sections to live objects. Only the keys present are changed, so a file can hold
+	// just what is being tuned. Nothing here reloads a mesh.
+	void ApplyBody(const Value& body, SoftBody& softBody);           // restitution, mass, stiffness, damping, color, zones
+	void ApplyOscillator(const Value& oscillator, HeartOscillatorSystem& system); // sa/av/hpc parameters, a0..a5
+	void ApplyWorld(const Value& world, PhysicsWorld& physicsWorld); // gravity, interBodyCollision
+	void ApplyExcitation(const Value& excitation, SoftBody& softBody); // enabled, model and monodomain parameters
+	void ApplyActive(const Value& active, SoftBody& softBody);         // active tension source, contraction and fibres
+	void ApplyEcg(const Value& ecg, SoftBody& softBody);               // enabled, sampleRate, distance, electrodes
+}
+
+// Polls a config file's modification time and re-parses it on a background job when it changes, so an
+// editor save shows up in the simulation within interval seconds. A file that does not parse (for example
+// one caught half written) is reported and the last good document stays in place.
+class ConfigWatcher {
+public:
+	float interval = 0.25f; // seconds between modification time checks
+
+	ConfigWatcher() = default;
+	ConfigWatcher(const ConfigWatcher&) = delete;
+	ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+	~ConfigWatcher();
+
+	// Parses the file now, returns false if it is missing or invalid (Root() is then an empty document)
+	bool Open(const std::string& path);
+	bool Watching() const { return !path.empty(); }
+	const std::string& Path() const { return path; }
+
+	// Main thread, once per frame: true when a changed document was just swapped in
+	bool Poll(float dt);
+
+	const Config::Value& Root() const { return root; }
+	const Config::Value& Previous() const { return previous; } // the document before the last reload
+
+private:
+	std::string path;
+	Config::Value root;
+	Config::Value previous;
+	std::filesystem::file_time_type stamp{};
+	float sinceCheck = 0.0f;
+
+	// Background parse, read by the main thread once the job is done
+	Jobs::Handle parsing;
+	std::shared_ptr<Config::Value> parsed;
+	bool parsedOk = false;
+};
@@ -0,0 +1,178 @@
+/*
+ * HEART ZONES: Assignment of the particles to the conduction zones (sa, av, hpc, not)
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <queue>
+#include <sstream>
+#include "heartZones.h"
+#include "kdTree.h"
+#include "jobs.h"
+
+std::string HeartZoneSettings::Key() const
+{
+	std::ostringstream key;
+	key << "#zones:" << (int)method;
+	switch (method) {
+	case Method::Colours:
+		key << ":" << delta << ":" << sa.r << "," << sa.g << "," << sa.b << ":" << av.r << "," << av.g << "," << av.b
+			<< ":" << hpc.r << "," << hpc.g << "," << hpc.b;
+		break;
+	case Method::Groups:
+		for (const auto& [zone, group] : groups) key << ":" << zone << "=" << group;
+		break;
+	case Method::NearestSeed:
+	case Method::Geodesic:
+		key << ":" << radius;
+		for (const ZoneSeed& seed : seeds) key << ":" << seed.zone << "@" << seed.position.x << "," << seed.position.y << "," << seed.position.z;
+		break;
+	}
+	return key.str();
+}
+
+namespace HeartZoning {
+	// Zone names of the labels, then the particles of each label in ascending order ("not" for -1)
+	static HeartZoneMap gather(const std::vector<int>& labels, const std::vector<std::string>& names)
+	{
+		HeartZoneMap zones;
+		for (unsigned int i = 0; i < (unsigned int)labels.size(); i++) {
+			zones[labels[i] < 0 ? std::string("not") : names[labels[i]]].push_back(i);
+		}
+		return zones;
+	}
+
+	// Distinct seed zones in name order, and each seed's index into them
+	static std::vector<std::string> seedZones(const HeartZoneSettings& settings, std::vector<int>& seedZone)
+	{
+		std::vector<std::string> names;
+		for (const ZoneSeed& seed : settings.seeds) names.push_back(seed.zone);
+		std::sort(names.begin(), names.end());
+		names.erase(std::unique(names.begin(), names.end()), names.end());
+		seedZone.resize(settings.seeds.size());
+		for (size_t s = 0; s < settings.seeds.size(); s++) {
+			seedZone[s] = (int)(std::lower_bound(names.begin(), names.end(), settings.seeds[s].zone) - names.begin());
+		}
+		return names;
+	}
+
+	static void report(const char* method, const HeartZoneMap& zones, std::chrono::steady_clock::time_point start)
+	{
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "::HEART ZONES:: " << method << " in " << ms << " ms";
+		for (const auto& [zone, verts] : zones) std::cout << ", " << zone << ": " << verts.size();
+		std::cout << std::endl;
+	}
+
+	HeartZoneMap FromGroups(size_t count, const std::map<std::string, std::vector<unsigned int>>& nodeGroups, const HeartZoneSettings& settings)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		// Same precedence as the colour match where groups overlap: hpc, then av, then sa
+		std::vector<std::string> names;
+		for (const char* zone : { "hpc", "av", "sa" }) {
+			if (settings.groups.count(zone)) names.push_back(zone);
+		}
+		for (const auto& [zone, group] : settings.groups) {
+			if (std::find(names.begin(), names.end(), zone) == names.end()) names.push_back(zone);
+		}
+
+		std::vector<int> labels(count, -1);
+		for (int z = (int)names.size() - 1; z >= 0; z--) {
+			auto group = nodeGroups.find(settings.groups.at(names[z]));
+			if (group == nodeGroups.end()) {
+				std::cout << "ERROR::ZONES::No physical group " << settings.groups.at(names[z]) << " for zone " << names[z] << std::endl;
+				continue;
+			}
+			for (unsigned int i : group->second) {
+				if (i < count) labels[i] = z;
+			}
+		}
+		HeartZoneMap zones = gather(labels, names);
+		report("groups", zones, start);
+		return zones;
+	}
+
+	HeartZoneMap NearestSeed(const std::vector<glm::vec3>& positions, const HeartZoneSettings& settings)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<int> seedZone;
+		std::vector<std::string> names = seedZones(settings, seedZone);
+
+		std::vector<glm::vec3> seeds(settings.seeds.size());
+		for (size_t s = 0; s < seeds.size(); s++) seeds[s] = settings.seeds[s].position;
+		KdTree tree;
+		tree.Build(seeds);
+
+		float limit = settings.radius > 0.0f ? settings.radius : std::numeric_limits<float>::infinity();
+		std::vector<int> labels(positions.size(), -1);
+		Jobs::ParallelFor(0, (long)positions.size(), 1024, [&](long i) {
+			int seed = tree.Nearest(positions[i], limit);
+			if (seed >= 0) labels[i] = seedZone[seed];
+		});
+		HeartZoneMap zones = gather(labels, names);
+		report("nearest seed", zones, start);
+		return zones;
+	}
+
+	HeartZoneMap Geodesic(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& offsets,
+		const std::vector<unsigned int>& neighbours, const HeartZoneSettings& settings)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<int> seedZone;
+		std::vector<std::string> names = seedZones(settings, seedZone);
+		const size_t count = positions.size();
+
+		// Seeds start at the particle nearest to them
+		KdTree tree;
+		tree.Build(positions);
+		std::vector<unsigned int> sources(settings.seeds.size());
+		for (size_t s = 0; s < sources.size(); s++) sources[s] = (unsigned int)std::max(0, tree.Nearest(settings.seeds[s].position));
+
+		// One Dijkstra per zone, each in its own job with its own distance field
+		const float infinity = std::numeric_limits<float>::infinity();
+		std::vector<std::vector<float>> distance(names.size());
+		Jobs::ParallelFor(0, (long)names.size(), 1, [&](long z) {
+			std::vector<float>& d = distance[z];
+			d.assign(count, infinity);
+			using Entry = std::pair<float, unsigned int>;
+			std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+			for (size_t s = 0; s < sources.size(); s++) {
+				if (seedZone[s] != z || count == 0) continue;
+				d[sources[s]] = 0.0f;
+				open.push({ 0.0f, sources[s] });
+			}
+			while (!open.empty()) {
+				auto [dist, i] = open.top();
+				open.pop();
+				if (dist > d[i]) continue;
+				for (unsigned int k = offsets[i]; k < offsets[i + 1]; k++) {
+					unsigned int j = neighbours[k];
+					float next = dist + glm::distance(positions[i], positions[j]);
+					if (next < d[j]) {
+						d[j] = next;
+						open.push({ next, j });
+					}
+				}
+			}
+		});
+
+		// Closest zone per particle, ties to the first in name order
+		float limit = settings.radius > 0.0f ? settings.radius : infinity;
+		std::vector<int> labels(count, -1);
+		Jobs::ParallelFor(0, (long)count, 1024, [&](long i) {
+			float best = infinity;
+			for (int z = 0; z < (int)names.size(); z++) {
+				if (distance[z][i] < best && distance[z][i] <= limit) {
+					best = distance[z][i];
+					labels[i] = z;
+				}
+			}
+		});
+		HeartZoneMap zones = gather(labels, names);
+		report("geodesic", zones, start);
+		return zones;
+	}
+}
@@ -0,0 +1,61 @@
+/*
+ * HEART ZONES: Assignment of the particles to the conduction zones (sa, av, hpc, not)
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Particle indices per zone, ascending. Zones nothing was assigned to are left out.
+using HeartZoneMap = std::map<std::string, std::vector<unsigned int>>;
+
+// A point in model space that the particles around it are assigned to its zone from
+struct ZoneSeed {
+	std::string zone;
+	glm::vec3 position = glm::vec3(0.0f);
+
+	bool operator==(const ZoneSeed& other) const { return zone == other.zone && position == other.position; }
+};
+
+// How the zones are found. Colours matches painted vertex colours within delta per channel, Groups takes the
+// gmsh physical groups named in groups, NearestSeed gives every particle the zone of the closest seed and
+// Geodesic the zone of the closest seed along the springs (which wraps around cavities instead of crossing them).
+struct HeartZoneSettings {
+	enum class Method { Colours, Groups, NearestSeed, Geodesic };
+
+	Method method = Method::Colours;
+
+	float delta = 0.2f;
+	glm::vec3 sa = glm::vec3(0.2784f, 0.6039f, 1.0f);
+	glm::vec3 av = glm::vec3(0.6039f, 0.251f, 1.0f);
+	glm::vec3 hpc = glm::vec3(1.0f, 0.4f, 0.8392f);
+
+	std::map<std::string, std::string> groups = { { "sa", "sa" }, { "av", "av" }, { "hpc", "hpc" } }; // zone -> group name
+
+	std::vector<ZoneSeed> seeds;
+	float radius = 0.0f; // seed methods: particles farther than this from every seed are "not" (0 = no limit)
+
+	bool operator==(const HeartZoneSettings& other) const
+	{
+		return method == other.method && delta == other.delta && sa == other.sa && av == other.av && hpc == other.hpc
+			&& groups == other.groups && seeds == other.seeds && radius == other.radius;
+	}
+
+	std::string Key() const; // AssetCache key suffix, only the fields the method uses
+};
+
+namespace HeartZoning {
+	// Particles in the named gmsh physical groups (model node indices per group name)
+	HeartZoneMap FromGroups(size_t count, const std::map<std::string, std::vector<unsigned int>>& nodeGroups, const HeartZoneSettings& settings);
+
+	// Straight line distance, k-d tree over the seeds, one parallel query per particle
+	HeartZoneMap NearestSeed(const std::vector<glm::vec3>& positions, const HeartZoneSettings& settings);
+
+	// Distance along the edges of the adjacency (CSR over the particles). Seeds snap to their nearest particle
+	// (k-d tree), then one Dijkstra per zone runs in parallel and each particle takes the closest zone.
+	HeartZoneMap Geodesic(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& offsets,
+		const std::vector<unsigned int>& neighbours, const HeartZoneSettings& settings);
+}
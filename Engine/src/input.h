@@ -20,6 +20,9 @@ std::map<std::string, int> keys = {
 	{"d", GLFW_KEY_D},
 	{"r", GLFW_KEY_R},
 	{"t", GLFW_KEY_T},
+	{"c", GLFW_KEY_C},
+	{"v", GLFW_KEY_V},
+	{"p", GLFW_KEY_P},
 	{"up", GLFW_KEY_UP},
 	{"down", GLFW_KEY_DOWN},
 	{"left", GLFW_KEY_LEFT},
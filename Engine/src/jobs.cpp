@@ -0,0 +1,282 @@
+/*
+ * JOBS: Work-stealing thread pool used by physics, loading and rendering prep
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include "jobs.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Jobs {
+	// One deque per thread: the owner pushes and pops at the back, thieves take from the front
+	struct Queue {
+		std::mutex lock;
+		std::deque<Handle> jobs;
+	};
+
+	static std::vector<std::unique_ptr<Queue>> queues;
+	static Queue background;
+	static std::vector<std::thread> workers;
+	static std::atomic<bool> running{ false };
+	static std::atomic<bool> quit{ false };
+	static std::atomic<long> queued{ 0 };
+	static std::mutex sleepLock;
+	static std::condition_variable wake;
+
+	static thread_local int threadIndex = -1;
+
+	static void pin(std::thread& thread, unsigned int core)
+	{
+		unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+		core %= cores;
+#if defined(_WIN32)
+		SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << core);
+#elif defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+	}
+
+	static void enqueue(Handle job)
+	{
+		if (!running) {
+			// No pool, dependencies are already done so run in place
+			job->fn();
+			job->fn = nullptr;
+			job->done = true;
+			return;
+		}
+		Queue& q = *queues[ThreadIndex()];
+		{
+			std::lock_guard<std::mutex> guard(q.lock);
+			q.jobs.push_back(std::move(job));
+		}
+		queued++;
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+		}
+		wake.notify_one();
+	}
+
+	static void execute(const Handle& job)
+	{
+		job->fn();
+		job->fn = nullptr;
+
+		std::vector<Handle> ready;
+		{
+			std::lock_guard<std::mutex> guard(job->lock);
+			job->done = true;
+			ready.swap(job->continuations);
+		}
+		for (Handle& next : ready) {
+			if (--next->pending == 0) enqueue(std::move(next));
+		}
+	}
+
+	// Own queue first (newest job, still warm in cache), then steal the oldest job of another thread
+	static bool tryRun(unsigned int index, bool allowBackground)
+	{
+		Handle job;
+		const unsigned int count = (unsigned int)queues.size();
+		{
+			Queue& own = *queues[index];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.jobs.empty()) {
+				job = std::move(own.jobs.back());
+				own.jobs.pop_back();
+			}
+		}
+		for (unsigned int k = 1; !job && k < count; k++) {
+			Queue& victim = *queues[(index + k) % count];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.jobs.empty()) {
+				job = std::move(victim.jobs.front());
+				victim.jobs.pop_front();
+			}
+		}
+		if (!job && allowBackground) {
+			std::lock_guard<std::mutex> guard(background.lock);
+			if (!background.jobs.empty()) {
+				job = std::move(background.jobs.front());
+				background.jobs.pop_front();
+			}
+		}
+		if (!job) return false;
+
+		queued--;
+		execute(job);
+		return true;
+	}
+
+	static void workerLoop(unsigned int index)
+	{
+		threadIndex = (int)index;
+		while (!quit) {
+			if (tryRun(index, true)) continue;
+
+			std::unique_lock<std::mutex> guard(sleepLock);
+			wake.wait(guard, [] { return queued > 0 || quit; });
+		}
+	}
+
+	void Initialize(const Config& config)
+	{
+		if (running) return;
+
+		unsigned int count = config.workers;
+		if (count == 0) count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+		queues.clear();
+		for (unsigned int i = 0; i <= count; i++) {
+			queues.push_back(std::make_unique<Queue>());
+		}
+
+		threadIndex = 0; // the initializing thread is the main thread
+		quit = false;
+		queued = 0;
+		running = true;
+		for (unsigned int i = 1; i <= count; i++) {
+			workers.emplace_back(workerLoop, i);
+			if (config.pinThreads) pin(workers.back(), i);
+		}
+
+		std::cout << "::JOBS:: workers: " << count << (config.pinThreads ? " (pinned)" : "") << std::endl;
+	}
+
+	void Shutdown()
+	{
+		if (!running) return;
+
+		// Finish whatever is still queued before the workers go away
+		while (queued > 0) {
+			if (!tryRun(0, true)) std::this_thread::yield();
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+			quit = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) worker.join();
+
+		workers.clear();
+		queues.clear();
+		running = false;
+	}
+
+	bool Running()
+	{
+		return running;
+	}
+
+	unsigned int ThreadCount()
+	{
+		return running ? (unsigned int)queues.size() : 1;
+	}
+
+	unsigned int ThreadIndex()
+	{
+		return threadIndex > 0 ? (unsigned int)threadIndex : 0;
+	}
+
+	Handle Submit(std::function<void()> fn, std::initializer_list<Handle> dependencies)
+	{
+		return Submit(std::move(fn), std::vector<Handle>(dependencies));
+	}
+
+	Handle Submit(std::function<void()> fn, const std::vector<Handle>& dependencies)
+	{
+		Handle job = std::make_shared<JobState>();
+		job->fn = std::move(fn);
+
+		// Register on every unfinished dependency, the last one to complete enqueues the job
+		for (const Handle& dependency : dependencies) {
+			if (!dependency) continue;
+			std::lock_guard<std::mutex> guard(dependency->lock);
+			if (!dependency->done) {
+				job->pending++;
+				dependency->continuations.push_back(job);
+			}
+		}
+		if (--job->pending == 0) enqueue(job);
+		return job;
+	}
+
+	Handle SubmitBackground(std::function<void()> fn)
+	{
+		Handle job = std::make_shared<JobState>();
+		job->fn = std::move(fn);
+		job->pending = 0;
+
+		if (!running || queues.size() == 1) {
+			execute(job);
+			return job;
+		}
+		{
+			std::lock_guard<std::mutex> guard(background.lock);
+			background.jobs.push_back(job);
+		}
+		queued++;
+		{
+			std::lock_guard<std::mutex> guard(sleepLock);
+		}
+		wake.notify_one();
+		return job;
+	}
+
+	void Wait(const Handle& job)
+	{
+		if (!job) return;
+		while (!job->done) {
+			if (!tryRun(ThreadIndex(), false)) std::this_thread::yield();
+		}
+	}
+
+	void Wait(const std::vector<Handle>& jobs)
+	{
+		for (const Handle& job : jobs) Wait(job);
+	}
+
+	void ParallelForChunks(long begin, long end, long grain, const std::function<void(long, long)>& body)
+	{
+		const long count = end - begin;
+		if (count <= 0) return;
+		if (grain <= 0) grain = std::max(1L, (count + 63) / 64);
+		const long chunks = (count + grain - 1) / grain;
+
+		if (!running || chunks == 1 || queues.size() == 1) {
+			for (long b = begin; b < end; b += grain) body(b, std::min(end, b + grain));
+			return;
+		}
+
+		// Helpers and the caller pull chunk numbers from a shared counter until the range is drained
+		std::atomic<long> next{ 0 };
+		auto drain = [&]() {
+			for (long c = next++; c < chunks; c = next++) {
+				long b = begin + c * grain;
+				body(b, std::min(end, b + grain));
+			}
+		};
+
+		long helperCount = std::min((long)queues.size() - 1, chunks - 1);
+		std::vector<Handle> helpers;
+		helpers.reserve(helperCount);
+		for (long h = 0; h < helperCount; h++) helpers.push_back(Submit(drain));
+		drain();
+
+		// Helpers reference this frame, so every one of them has to finish (or be run here) first
+		Wait(helpers);
+	}
+}
@@ -0,0 +1,62 @@
+/*
+ * JOBS: Work-stealing thread pool used by physics, loading and rendering prep
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Jobs {
+	struct Config {
+		unsigned int workers = 0;          // worker threads besides the main thread, 0 = hardware threads - 1
+		bool pinThreads = false;           // pin worker i to core i + 1 (the main thread keeps core 0)
+	};
+
+	// A submitted job, completion releases the jobs that depend on it
+	struct JobState {
+		std::function<void()> fn;
+		std::atomic<int> pending{ 1 };     // unfinished dependencies + the submit guard
+		std::atomic<bool> done{ false };
+		std::mutex lock;
+		std::vector<std::shared_ptr<JobState>> continuations;
+	};
+	using Handle = std::shared_ptr<JobState>;
+
+	void Initialize(const Config& config = Config());
+	void Shutdown();
+	bool Running();
+
+	unsigned int ThreadCount();  // workers + the main thread, 1 when not initialized
+	unsigned int ThreadIndex();  // 0 for the main thread (and any thread outside the pool)
+
+	// Runs fn once every dependency has finished
+	Handle Submit(std::function<void()> fn, std::initializer_list<Handle> dependencies = {});
+	Handle Submit(std::function<void()> fn, const std::vector<Handle>& dependencies);
+
+	// Long running work (asset loading). Only idle workers pick it up, never a thread helping inside Wait,
+	// so frame work is not held up behind it. Runs in place when there are no workers.
+	Handle SubmitBackground(std::function<void()> fn);
+
+	// Blocks until the job is done, running other jobs meanwhile so nested waits cannot starve the pool
+	void Wait(const Handle& job);
+	void Wait(const std::vector<Handle>& jobs);
+
+	// Splits [begin, end) into chunks of grain indices (0 = 64 equal chunks) and runs body(chunkBegin, chunkEnd)
+	// on the pool, the caller takes chunks too and returns when all are done.
+	// Chunk boundaries only depend on the range and grain, never on the thread count.
+	void ParallelForChunks(long begin, long end, long grain, const std::function<void(long, long)>& body);
+
+	// Per index version, the body is inlined into the chunk loop
+	template<typename F>
+	void ParallelFor(long begin, long end, long grain, F&& body) {
+		ParallelForChunks(begin, end, grain, [&body](long chunkBegin, long chunkEnd) {
+			for (long i = chunkBegin; i < chunkEnd; i++) body(i);
+		});
+	}
+}
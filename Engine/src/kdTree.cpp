@@ -0,0 +1,75 @@
+/*
+ * KD TREE: Static 3D k-d tree over a point set for nearest point queries
+ */
+
+#include <algorithm>
+#include <numeric>
+#include "kdTree.h"
+
+void KdTree::Build(const std::vector<glm::vec3>& input)
+{
+	order.resize(input.size());
+	std::iota(order.begin(), order.end(), 0u);
+	axis.assign(input.size(), 0);
+	build(input, 0, (int)input.size());
+
+	points.resize(input.size());
+	for (size_t k = 0; k < order.size(); k++) points[k] = input[order[k]];
+}
+
+void KdTree::build(const std::vector<glm::vec3>& input, int begin, int end)
+{
+	if (end - begin <= 1) return;
+
+	// Split along the widest extent of the range
+	glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+	for (int i = begin; i < end; i++) {
+		lo = glm::min(lo, input[order[i]]);
+		hi = glm::max(hi, input[order[i]]);
+	}
+	glm::vec3 extent = hi - lo;
+	int a = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+	// Median to the centre, ties ordered by index so the tree only depends on the input
+	int mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](unsigned int x, unsigned int y) {
+		return input[x][a] < input[y][a] || (input[x][a] == input[y][a] && x < y);
+	});
+	axis[mid] = (unsigned char)a;
+
+	build(input, begin, mid);
+	build(input, mid + 1, end);
+}
+
+int KdTree::Nearest(const glm::vec3& p, float maxDistance) const
+{
+	float best = maxDistance == std::numeric_limits<float>::infinity() ? maxDistance : maxDistance * maxDistance;
+	int slot = -1;
+	nearest(0, (int)points.size(), p, best, slot);
+	return slot < 0 ? -1 : (int)order[slot];
+}
+
+void KdTree::nearest(int begin, int end, const glm::vec3& p, float& best, int& slot) const
+{
+	if (begin >= end) return;
+	int mid = (begin + end) / 2;
+	glm::vec3 d = p - points[mid];
+	float distance = glm::dot(d, d);
+	// Ties go to the lower original index, so the answer does not depend on the visiting order
+	if (distance < best || (distance == best && slot >= 0 && order[mid] < order[slot])) {
+		best = distance;
+		slot = mid;
+	}
+	if (end - begin == 1) return;
+
+	// Near side first, the far side only if the splitting plane is closer than the best so far
+	float side = d[axis[mid]];
+	if (side < 0.0f) {
+		nearest(begin, mid, p, best, slot);
+		if (side * side <= best) nearest(mid + 1, end, p, best, slot);
+	}
+	else {
+		nearest(mid + 1, end, p, best, slot);
+		if (side * side <= best) nearest(begin, mid, p, best, slot);
+	}
+}
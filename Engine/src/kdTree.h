@@ -0,0 +1,29 @@
+/*
+ * KD TREE: Static 3D k-d tree over a point set for nearest point queries
+ */
+
+#pragma once
+
+#include <limits>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Balanced and implicit: every range of the point array holds its median split at its centre, so the tree
+// is three flat arrays with no node pointers. Queries are read only and safe from any number of threads.
+class KdTree {
+public:
+	void Build(const std::vector<glm::vec3>& points);
+
+	// Index (into the built points) of the point closest to p within maxDistance, or -1
+	int Nearest(const glm::vec3& p, float maxDistance = std::numeric_limits<float>::infinity()) const;
+
+	size_t Size() const { return points.size(); }
+
+private:
+	std::vector<glm::vec3> points;   // tree order
+	std::vector<unsigned int> order; // tree slot -> original index
+	std::vector<unsigned char> axis; // split axis of the slot at each range's centre
+
+	void build(const std::vector<glm::vec3>& input, int begin, int end);
+	void nearest(int begin, int end, const glm::vec3& p, float& best, int& slot) const;
+};
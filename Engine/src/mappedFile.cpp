@@ -0,0 +1,95 @@
+/*
+ * MAPPED FILE: Read only memory mapping of a whole file, pages are loaded by the OS on first touch
+ */
+
+#include <iostream>
+#include "mappedFile.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+	Close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cout << "ERROR::MAPPED FILE::Cannot open " << path << std::endl;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view) {
+		std::cout << "ERROR::MAPPED FILE::Cannot map " << path << std::endl;
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	fileHandle = file;
+	mappingHandle = mapping;
+	data = (const uint8_t*)view;
+	size = (size_t)fileSize.QuadPart;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cout << "ERROR::MAPPED FILE::Cannot open " << path << std::endl;
+		return false;
+	}
+	struct stat info;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd); // the mapping keeps the file alive
+	if (view == MAP_FAILED) {
+		std::cout << "ERROR::MAPPED FILE::Cannot map " << path << std::endl;
+		return false;
+	}
+	data = (const uint8_t*)view;
+	size = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (!data) return;
+#if defined(_WIN32)
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mappingHandle);
+	CloseHandle((HANDLE)fileHandle);
+	fileHandle = mappingHandle = nullptr;
+#else
+	munmap((void*)data, size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+void MappedFile::Prefetch(size_t offset, size_t bytes) const
+{
+	if (!data || offset >= size) return;
+	if (offset + bytes > size) bytes = size - offset;
+#if defined(_WIN32)
+	WIN32_MEMORY_RANGE_ENTRY range = { (void*)(data + offset), bytes };
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	// madvise wants a page aligned start
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t start = offset - offset % page;
+	madvise((void*)(data + start), bytes + (offset - start), MADV_WILLNEED);
+#endif
+}
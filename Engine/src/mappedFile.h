@@ -0,0 +1,34 @@
+/*
+ * MAPPED FILE: Read only memory mapping of a whole file, pages are loaded by the OS on first touch
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	bool Open(const std::string& path);
+	void Close();
+
+	const uint8_t* Data() const { return data; }
+	size_t Size() const { return size; }
+
+	// Hint that [offset, offset + bytes) is needed soon so the OS reads it ahead of the decoder
+	void Prefetch(size_t offset, size_t bytes) const;
+
+private:
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+#if defined(_WIN32)
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
@@ -9,36 +9,144 @@
 
 #include <glad/glad.h>
 #include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
 #include "shader.h"
 #include "mesh.h"
+#include "jobs.h"
 
 using namespace std;
 
-Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool deferGL)
+    : Mesh(std::make_shared<const vector<Vertex>>(std::move(vertices)), std::make_shared<const vector<unsigned int>>(std::move(indices)), std::move(textures), deferGL)
 {
-    this->vertices = vertices;
-    this->indices = indices;
-    this->textures = textures;
+}
+
+Mesh::Mesh(std::shared_ptr<const vector<Vertex>> vertices, std::shared_ptr<const vector<unsigned int>> indices, vector<Texture> textures, bool deferGL)
+{
+    this->vertexData = std::move(vertices);
+    this->indexData = std::move(indices);
+    this->textures = std::move(textures);
+
+    if (!deferGL) setup();
+}
+
+Mesh::~Mesh()
+{
+    release();
+}
+
+Mesh::Mesh(Mesh&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+Mesh& Mesh::operator=(Mesh&& other) noexcept
+{
+    if (this == &other) return *this;
+    release();
+
+    textures = std::move(other.textures);
+    vertexData = std::move(other.vertexData);
+    indexData = std::move(other.indexData);
+    VAO = other.VAO; VBO = other.VBO; EBO = other.EBO;
+    LVAO = other.LVAO; LEBO = other.LEBO;
+    lineIndexCount = other.lineIndexCount;
+    DVBO = other.DVBO;
+    streaming = other.streaming;
+    persistent = other.persistent;
+    format = other.format;
+    streamSlot = other.streamSlot;
+    slotBytes = other.slotBytes;
+    mapped = other.mapped;
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        fences[i] = other.fences[i];
+        slotScale[i] = other.slotScale[i];
+        slotOffset[i] = other.slotOffset[i];
+        other.fences[i] = nullptr;
+    }
+    staging = std::move(other.staging);
+    pendingStreaming = other.pendingStreaming;
+    pendingLineIndices = std::move(other.pendingLineIndices);
+
+    // The source no longer owns anything, its destructor is a no-op
+    other.VAO = other.VBO = other.EBO = 0;
+    other.LVAO = other.LEBO = 0;
+    other.DVBO = 0;
+    other.mapped = nullptr;
+    other.streaming = other.persistent = other.pendingStreaming = false;
+    return *this;
+}
+
+void Mesh::release()
+{
+    // deferGL meshes that never reached CreateGLResources own nothing, and may not even have a context
+    for (GLsync& fence : fences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (DVBO) {
+        if (mapped) {
+            glBindBuffer(GL_ARRAY_BUFFER, DVBO);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mapped = nullptr;
+        }
+        glDeleteBuffers(1, &DVBO);
+        DVBO = 0;
+    }
+    if (LVAO) glDeleteVertexArrays(1, &LVAO);
+    if (LEBO) glDeleteBuffers(1, &LEBO);
+    LVAO = LEBO = 0;
+    if (VAO) glDeleteVertexArrays(1, &VAO);
+    if (VBO) glDeleteBuffers(1, &VBO);
+    if (EBO) glDeleteBuffers(1, &EBO);
+    VAO = VBO = EBO = 0;
+}
 
+void Mesh::CreateGLResources() {
+    if (VAO) return;
     setup();
+
+    if (pendingStreaming) {
+        pendingStreaming = false;
+        EnableStreaming(format);
+    }
+    if (pendingLineIndices) {
+        SetLineIndices(std::move(pendingLineIndices));
+        pendingLineIndices.reset();
+    }
 }
 
 void Mesh::setup() {
     //For the mesh 
     glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
 
     glBindVertexArray(VAO);
 
-    // Send data to GPU
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_DYNAMIC_DRAW);
+    // Send data to GPU. A mesh that will stream gets its attributes from DVBO only (EnableStreaming)
+    if (!pendingStreaming) {
+        glGenBuffers(1, &VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        const vector<Vertex>& vertices = *vertexData;
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+        setupAttributes();
+    }
 
+    const vector<unsigned int>& indices = *indexData;
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-        &indices[0], GL_DYNAMIC_DRAW);
+        indices.data(), GL_DYNAMIC_DRAW);
+
+    glBindVertexArray(0);
+}
 
+void Mesh::setupAttributes() {
+    // Expects VAO and VBO to be bound
     // vertex positions
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -46,20 +154,299 @@ void Mesh::setup() {
     // vertex normals
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+}
+
+namespace {
+    struct FloatStreamVertex { glm::vec3 position; glm::vec3 normal; };
+    struct PackedStreamVertex { glm::vec3 position; uint32_t normal; };
+    struct QuantizedStreamVertex { uint16_t position[4]; uint32_t normal; };
 
+    // Signed normalized GL_INT_2_10_10_10_REV, w left at 0
+    inline uint32_t packNormal(const glm::vec3& n) {
+        auto q = [](float v) {
+            int i = (int)std::lround(glm::clamp(v, -1.0f, 1.0f) * 511.0f);
+            return (uint32_t)i & 0x3FFu;
+        };
+        return q(n.x) | (q(n.y) << 10) | (q(n.z) << 20);
+    }
+}
+
+size_t Mesh::DynamicStride() const {
+    switch (format) {
+    case StreamFormat::Packed: return sizeof(PackedStreamVertex);
+    case StreamFormat::Quantized: return sizeof(QuantizedStreamVertex);
+    default: return sizeof(FloatStreamVertex);
+    }
+}
+
+void Mesh::EnableStreaming(StreamFormat streamFormat) {
+    if (streaming) return;
+    if (!VAO) {
+        pendingStreaming = true;
+        format = streamFormat;
+        return;
+    }
+    streaming = true;
+    format = streamFormat;
+    const vector<Vertex>& vertices = *vertexData;
+    slotBytes = vertices.size() * DynamicStride();
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        slotScale[i] = glm::vec3(1.0f);
+        slotOffset[i] = glm::vec3(0.0f);
+    }
+
+    glBindVertexArray(VAO);
+    glGenBuffers(1, &DVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, DVBO);
+
+    // Mesa llvmpipe and any 4.4+ driver give us immutable storage, otherwise fall back to sub-data updates
+    persistent = GLAD_GL_VERSION_4_4;
+    if (persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, slotBytes * STREAM_SLOTS, nullptr, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, slotBytes * STREAM_SLOTS, flags);
+    }
+    else {
+        staging.resize(slotBytes);
+        glBufferData(GL_ARRAY_BUFFER, slotBytes, nullptr, GL_STREAM_DRAW);
+    }
+
+    // Positions and normals are the only attributes and now both come from the dynamic stream, so the
+    // full vertex buffer uploaded by setup (if any) is no longer read
+    setupDynamicAttributes();
+    if (LVAO) {
+        glBindVertexArray(LVAO);
+        setupDynamicAttributes();
+    }
     glBindVertexArray(0);
+    if (VBO) {
+        glDeleteBuffers(1, &VBO);
+        VBO = 0;
+    }
+
+    // Fill every slot with the rest pose
+    vector<glm::vec3> positions(vertices.size()), normals(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        positions[i] = vertices[i].position;
+        normals[i] = vertices[i].normal;
+    }
+    for (int i = 0; i < STREAM_SLOTS; i++) {
+        UpdateVertices(positions, normals);
+    }
 }
 
-void Mesh::UpdateVertices(vector<Vertex> vertices) {
-    // Send data to GPU
+void Mesh::setupDynamicAttributes() {
+    // Expects VAO and DVBO to be bound
+    GLsizei stride = (GLsizei)DynamicStride();
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    switch (format) {
+    case StreamFormat::Float:
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatStreamVertex, position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(FloatStreamVertex, normal));
+        break;
+    case StreamFormat::Packed:
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(PackedStreamVertex, position));
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(PackedStreamVertex, normal));
+        break;
+    case StreamFormat::Quantized:
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(QuantizedStreamVertex, position));
+        glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)offsetof(QuantizedStreamVertex, normal));
+        break;
+    }
+}
+
+unsigned char* Mesh::beginDynamicWrite() {
+    if (!persistent) return staging.data();
+
+    // Advance the ring and wait until the GPU has finished the draw that last read this slot
+    streamSlot = (streamSlot + 1) % STREAM_SLOTS;
+    GLsync& fence = fences[streamSlot];
+    if (fence) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return mapped + streamSlot * slotBytes;
+}
+
+void Mesh::endDynamicWrite() {
+    // Coherent mapping: nothing to flush for the persistent path
+    if (persistent) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, DVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, slotBytes, staging.data());
+}
+
+void Mesh::UpdateVertices(const vector<Vertex>& vertices) {
+    if (streaming) {
+        vector<glm::vec3> positions(vertices.size()), normals(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++) {
+            positions[i] = vertices[i].position;
+            normals[i] = vertices[i].normal;
+        }
+        UpdateVertices(positions, normals);
+        return;
+    }
+
+    // Send data to GPU, same size every frame so the storage is reused
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), vertices.data());
+}
+
+void Mesh::UpdateVertices(const vector<glm::vec3>& positions, const vector<glm::vec3>& normals) {
+    // Not streaming (yet): the full vertex path, the static attributes come from the rest vertices
+    if (!streaming) {
+        if (!VAO) return;
+        vector<Vertex> vertices(*vertexData);
+        size_t n = std::min(vertices.size(), std::min(positions.size(), normals.size()));
+        for (size_t i = 0; i < n; i++) {
+            vertices[i].position = positions[i];
+            vertices[i].normal = normals[i];
+        }
+        UpdateVertices(vertices);
+        return;
+    }
+
+    // A slot holds one frame of this mesh, longer arrays would run into the next one
+    assert(positions.size() * DynamicStride() <= slotBytes && normals.size() >= positions.size());
+    const long count = (long)std::min(std::min(positions.size(), normals.size()), slotBytes / DynamicStride());
+
+    // Pack positions and normals straight into the mapped slot
+    unsigned char* dst = beginDynamicWrite();
+    const glm::vec3* pos = positions.data();
+    const glm::vec3* nrm = normals.data();
+
+    if (format == StreamFormat::Float) {
+        FloatStreamVertex* out = (FloatStreamVertex*)dst;
+        Jobs::ParallelFor(0, count, 1024, [&](long i) {
+            out[i].position = pos[i];
+            out[i].normal = nrm[i];
+        });
+    }
+    else if (format == StreamFormat::Packed) {
+        PackedStreamVertex* out = (PackedStreamVertex*)dst;
+        Jobs::ParallelFor(0, count, 1024, [&](long i) {
+            out[i].position = pos[i];
+            out[i].normal = packNormal(nrm[i]);
+        });
+    }
+    else {
+        // Quantise against this frame's bounds, the shader gets them back per slot
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (long i = 0; i < count; i++) {
+            lo = glm::min(lo, pos[i]);
+            hi = glm::max(hi, pos[i]);
+        }
+        glm::vec3 extent = glm::max(hi - lo, glm::vec3(1e-6f));
+        glm::vec3 toUnit = 65535.0f / extent;
+        int slot = persistent ? streamSlot : 0;
+        slotScale[slot] = extent;
+        slotOffset[slot] = lo;
+
+        QuantizedStreamVertex* out = (QuantizedStreamVertex*)dst;
+        Jobs::ParallelFor(0, count, 1024, [&](long i) {
+            glm::vec3 q = (pos[i] - lo) * toUnit + 0.5f;
+            out[i].position[0] = (uint16_t)q.x;
+            out[i].position[1] = (uint16_t)q.y;
+            out[i].position[2] = (uint16_t)q.z;
+            out[i].position[3] = 0;
+            out[i].normal = packNormal(nrm[i]);
+        });
+    }
+
+    endDynamicWrite();
+}
+
+void Mesh::UpdateIndices(const vector<unsigned int>& indices) {
+    UpdateIndices(std::make_shared<const vector<unsigned int>>(indices));
+}
+
+void Mesh::UpdateIndices(std::shared_ptr<const vector<unsigned int>> indices) {
+    // Replace the drawn topology (e.g. tets -> extracted surface triangles)
+    indexData = std::move(indices);
+    if (!VAO) return; // uploaded by setup later
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData->size() * sizeof(unsigned int), indexData->data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+void Mesh::SetLineIndices(const vector<unsigned int>& lineIndices) {
+    SetLineIndices(std::make_shared<const vector<unsigned int>>(lineIndices));
+}
+
+void Mesh::SetLineIndices(std::shared_ptr<const vector<unsigned int>> lineIndices) {
+    if (!VAO) {
+        pendingLineIndices = std::move(lineIndices);
+        return;
+    }
+
+    // Second VAO over the same vertex buffers, only the element buffer differs
+    if (!LVAO) {
+        glGenVertexArrays(1, &LVAO);
+        glGenBuffers(1, &LEBO);
+        glBindVertexArray(LVAO);
+        if (streaming) {
+            glBindBuffer(GL_ARRAY_BUFFER, DVBO);
+            setupDynamicAttributes();
+        }
+        else {
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            setupAttributes();
+        }
+    }
+    glBindVertexArray(LVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, LEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, lineIndices->size() * sizeof(unsigned int), lineIndices->data(), GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    lineIndexCount = lineIndices->size();
+}
+
+void Mesh::bindDrawState(Shader& shader) {
+    int slot = persistent ? streamSlot : 0;
+    bool quantized = streaming && format == StreamFormat::Quantized;
+    shader.setVec3("positionScale", quantized ? slotScale[slot] : glm::vec3(1.0f));
+    shader.setVec3("positionOffset", quantized ? slotOffset[slot] : glm::vec3(0.0f));
+}
+
+void Mesh::fenceSlot() {
+    // Issued after every draw that reads the slot so the writer can't reuse it too early
+    if (fences[streamSlot]) glDeleteSync(fences[streamSlot]);
+    fences[streamSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 void Mesh::draw(Shader& shader) {
+    if (!VAO) return;
+
     // draw mesh
     // glPointSize(2.5f); 
+    bindDrawState(shader);
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    if (persistent) {
+        // Read the slot written last
+        GLint baseVertex = streamSlot * (GLint)vertexData->size();
+        glDrawElementsBaseVertex(GL_TRIANGLES, indexData->size(), GL_UNSIGNED_INT, 0, baseVertex);
+        fenceSlot();
+    }
+    else {
+        glDrawElements(GL_TRIANGLES, indexData->size(), GL_UNSIGNED_INT, 0);
+    }
+    glBindVertexArray(0);
+}
+
+void Mesh::drawLines(Shader& shader) {
+    if (!LVAO || lineIndexCount == 0) return;
+
+    bindDrawState(shader);
+    glBindVertexArray(LVAO);
+    if (persistent) {
+        GLint baseVertex = streamSlot * (GLint)vertexData->size();
+        glDrawElementsBaseVertex(GL_LINES, lineIndexCount, GL_UNSIGNED_INT, 0, baseVertex);
+        fenceSlot();
+    }
+    else {
+        glDrawElements(GL_LINES, lineIndexCount, GL_UNSIGNED_INT, 0);
+    }
     glBindVertexArray(0);
 }
\ No newline at end of file
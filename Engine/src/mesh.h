@@ -6,18 +6,18 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <glad/glad.h>
 #include <glm/glm.hpp>
 #include "shader.h"
 
 using namespace std;
 
+// Rest state as imported, 36 bytes. Simulated state lives in the soft body's particles, not here.
 struct Vertex {
 	glm::vec3 position;
 	glm::vec3 rgb; 
 	glm::vec3 normal;
-	glm::vec3 texCoords;
-	glm::vec3 updatePosition = position; // to be update by the time integrator
-	glm::vec3 updateVelocity; // to be update by the time integrator
 
 	bool operator<(const Vertex& other) const
 	{
@@ -35,18 +35,81 @@ struct Texture {
 	string type;
 };
 
+// Layout of the per-frame position/normal stream of a streaming mesh
+enum class StreamFormat {
+	Float,     // vec3 position + vec3 normal, 24 bytes
+	Packed,    // vec3 position + 2_10_10_10 normal, 16 bytes
+	Quantized  // 16 bit position in the frame's bounding box + 2_10_10_10 normal, 12 bytes
+};
+
 class Mesh {
 public:
-	vector<Vertex> vertices;
-	vector<unsigned int> indices;
 	vector<Texture> textures;
 
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures);
+	// deferGL keeps the mesh CPU only (e.g. built on a worker), CreateGLResources finishes it on the GL thread
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, bool deferGL = false);
+
+	// Vertex and index data are immutable and may be shared with other meshes (see AssetCache)
+	Mesh(std::shared_ptr<const vector<Vertex>> vertices, std::shared_ptr<const vector<unsigned int>> indices, vector<Texture> textures, bool deferGL = false);
+
+	// Owns its GL objects: move only, destroyed on the GL thread (or before CreateGLResources anywhere)
+	~Mesh();
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&& other) noexcept;
+	Mesh& operator=(Mesh&& other) noexcept;
+	const vector<Vertex>& Vertices() const { return *vertexData; }
+	const vector<unsigned int>& Indices() const { return *indexData; }
+	void CreateGLResources();
+	bool HasGLResources() const { return VAO != 0; }
 
 	void draw(Shader& shader);
-	void UpdateVertices(std::vector<Vertex> vertices);
-	
+	void UpdateVertices(const vector<Vertex>& vertices);
+	void UpdateVertices(const vector<glm::vec3>& positions, const vector<glm::vec3>& normals); // streaming meshes
+	void UpdateIndices(const vector<unsigned int>& indices);
+	void UpdateIndices(std::shared_ptr<const vector<unsigned int>> indices);
+
+	// Optional GL_LINES topology over the same vertex streams (e.g. spring debug view)
+	void SetLineIndices(const vector<unsigned int>& lineIndices);
+	void SetLineIndices(std::shared_ptr<const vector<unsigned int>> lineIndices);
+	void drawLines(Shader& shader);
+
+	// Streaming: positions and normals, the only attributes drawn, move to a tightly packed stream kept in a
+	// persistently mapped ring of STREAM_SLOTS copies and the full vertex buffer is dropped.
+	static const int STREAM_SLOTS = 3;
+	void EnableStreaming(StreamFormat format = StreamFormat::Quantized);
+	size_t DynamicStride() const;
+
 private:
-	unsigned int VAO, VBO, EBO;
+	std::shared_ptr<const vector<Vertex>> vertexData;
+	std::shared_ptr<const vector<unsigned int>> indexData;
+
+	unsigned int VAO = 0, VBO = 0, EBO = 0;
+	unsigned int LVAO = 0, LEBO = 0;
+	size_t lineIndexCount = 0;
 	void setup();
+	void setupAttributes();
+	void setupDynamicAttributes();
+	unsigned char* beginDynamicWrite();
+	void endDynamicWrite();
+	void bindDrawState(Shader& shader);
+	void fenceSlot();
+	void release(); // deletes the GL objects, handles back to 0
+
+	// Dynamic stream
+	unsigned int DVBO = 0;
+	bool streaming = false;
+	bool persistent = false;
+	StreamFormat format = StreamFormat::Float;
+	int streamSlot = 0;
+	size_t slotBytes = 0;
+	unsigned char* mapped = nullptr;
+	GLsync fences[STREAM_SLOTS] = {};
+	glm::vec3 slotScale[STREAM_SLOTS];  // dequantisation for each slot (Quantized only)
+	glm::vec3 slotOffset[STREAM_SLOTS];
+	vector<unsigned char> staging; // fallback when glBufferStorage is unavailable
+
+	// Requests made before the GL resources exist, replayed by CreateGLResources
+	bool pendingStreaming = false;
+	std::shared_ptr<const vector<unsigned int>> pendingLineIndices;
 };
\ No newline at end of file
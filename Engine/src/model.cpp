@@ -5,6 +5,11 @@
  */
 
 #include <string>
+#include <mutex>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory_resource>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
@@ -13,6 +18,13 @@
 #include <vector>
 #include <string>
 #include "model.h"
+#include "jobs.h"
+#include "assetCache.h"
+#include "arena.h"
+
+// Red-black tree links std::map stores in front of every value: colour word plus parent/left/right pointers
+// (32 bytes per node with libstdc++ on 64 bit)
+static constexpr std::size_t MapNodeLinks = 4 * sizeof(void*);
 
 void Model::draw(Shader& shader) {
     // Draw all meshes in the model
@@ -21,56 +33,76 @@ void Model::draw(Shader& shader) {
     }
 }
 
+void Model::CreateGLResources() {
+    for (Mesh& mesh : meshes) {
+        mesh.CreateGLResources();
+    }
+}
+
 bool Model::hasExtension(const std::string& path, const std::string& ext)
 {
 	return path.size()>= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
 }
 
-void Model::loadModel(const std::string& path){
+void Model::loadModel(const std::string& path, const ImportOptions& options){
+    // Imported once per path and options, later instances share the same vertex and index data
+    asset = AssetCache::Get<ModelAsset>(options.Key(path), [&]() { return importModel(path, options); });
+    directory = asset->directory;
+
+    for (const ModelAsset::MeshPart& part : asset->meshes) {
+        meshes.push_back(Mesh(part.vertices, part.indices, {}, deferGL));
+    }
+}
+
+std::shared_ptr<ModelAsset> Model::importModel(const std::string& path, const ImportOptions& options){
+    std::shared_ptr<ModelAsset> asset = std::make_shared<ModelAsset>();
 
     if (hasExtension(path, ".msh"))
     {
-        loadTetraModel(path);
+        loadTetraModel(path, *asset);
     }
     else
     {
         Assimp::Importer import;
-        const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+        const aiScene* scene = import.ReadFile(path, options.flags);
 
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
             cout << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
-            return;
+            return asset;
         }
-        directory = path.substr(0, path.find_last_of('/'));
+        asset->directory = path.substr(0, path.find_last_of('/'));
 
-        processNode(scene->mRootNode, scene);
-        std::cout << "The model have " << meshes.size() << " meshes." << std::endl;
+        processNode(scene->mRootNode, scene, *asset);
+        std::cout << "The model have " << asset->meshes.size() << " meshes." << std::endl;
     }
+    return asset;
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene)
+void Model::processNode(aiNode* node, const aiScene* scene, ModelAsset& asset)
 {
     // process all the node's meshes (if any)
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
         aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene));
+        asset.meshes.push_back(processMesh(mesh, scene));
     }
     // then do the same for each of its children
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        processNode(node->mChildren[i], scene);
+        processNode(node->mChildren[i], scene, asset);
     }
 }
 
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
+ModelAsset::MeshPart Model::processMesh(aiMesh* mesh, const aiScene* scene)
 {
-    std::set<Vertex> uniqueVertices;
-    std::map<Vertex, unsigned int> VertexToIndex; 
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<Texture> textures;
+    // Temporaries live in an arena sized for this mesh, the asset's vectors are allocated once at their final size
+    // Per vertex: a map node, a unique vertex and a remap slot; the slack covers alignment and the block header
+    Arena arena(mesh->mNumVertices * (MapNodeLinks + sizeof(std::pair<const Vertex, unsigned int>) + sizeof(Vertex) + sizeof(unsigned int)) + 4096);
+    std::pmr::map<Vertex, unsigned int> VertexToIndex(arena.Resource());
+    std::pmr::vector<Vertex> unique(arena.Resource());
+    std::pmr::vector<unsigned int> remap(mesh->mNumVertices, 0, arena.Resource()); // assimp vertex -> unique vertex
+    unique.reserve(mesh->mNumVertices);
 
     //-- DanielaHz refactor --//
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -80,104 +112,160 @@ Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
         // Processing positions, normals, textures
         vertex.position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
         vertex.normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+        vertex.rgb = glm::vec3(1.0f);
         
         if (mesh->mColors[0]) {  // Si existen colores en el primer canal
             vertex.rgb = glm::vec3(mesh->mColors[0][i].r, mesh->mColors[0][i].g, mesh->mColors[0][i].b);
         }
 
-        // Evaluate if the index are unique
-        if (uniqueVertices.insert(vertex).second)
-        {
-            VertexToIndex[vertex] = vertices.size();
-            vertices.push_back(vertex);
-        }
+        // Evaluate if the index are unique (same position and normal)
+        auto inserted = VertexToIndex.emplace(vertex, (unsigned int)unique.size());
+        if (inserted.second) unique.push_back(vertex);
+        remap[i] = inserted.first->second;
     } 
+    std::vector<Vertex> vertices(unique.begin(), unique.end());
 
     std::cout <<"vertices size:" << vertices.size() << std::endl;
 
     // Index processing
+    size_t indexCount = 0;
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++) indexCount += mesh->mFaces[i].mNumIndices;
+    std::vector<unsigned int> indices;
+    indices.reserve(indexCount);
     for (unsigned int i = 0; i < mesh->mNumFaces; i++)
     {
-        aiFace face = mesh->mFaces[i];
+        const aiFace& face = mesh->mFaces[i];
         for (unsigned int j = 0; j < face.mNumIndices; j++)
         {
-            unsigned int index = face.mIndices[j];
-            Vertex vertex;
-
-            // get the vertice to the index
-            vertex.position = glm::vec3(mesh->mVertices[index].x, mesh->mVertices[index].y, mesh->mVertices[index].z);
-            vertex.normal = glm::vec3(mesh->mNormals[index].x, mesh->mNormals[index].y, mesh->mNormals[index].z);
-
             // adding th eindex of unique vertices
-            indices.push_back(VertexToIndex[vertex]);
+            indices.push_back(remap[face.mIndices[j]]);
         }
     }
+    arena.Report("mesh import");
     // -- refactor finished -- //
-    return Mesh(vertices, indices, textures); 
+    ModelAsset::MeshPart part;
+    part.vertices = std::make_shared<const vector<Vertex>>(std::move(vertices));
+    part.indices = std::make_shared<const vector<unsigned int>>(std::move(indices));
+    part.hasColors = mesh->mColors[0] != nullptr;
+    return part; 
 } 
 
 // DanielaHz implementation
-void Model::loadTetraModel(const std::string& path) {
+void Model::loadTetraModel(const std::string& path, ModelAsset& asset) {
+    // gmsh keeps global state, only one loader may use it at a time
+    static std::mutex gmshLock;
+    std::unique_lock<std::mutex> gmshGuard(gmshLock);
+
     gmsh::initialize();
     gmsh::open(path);
 
-    std::vector<std::array<double, 3>> nodePositions;
-    std::vector<std::array<int, 4>> tetrahedra;
+    // gmsh hands its results back in std::vectors of its own, everything else below either goes into the asset
+    // (sized exactly, one allocation each) or into the load's arena
+    std::vector<std::array<int, 4>>& tetrahedra = asset.tetrahedra;
 
     std::vector<std::size_t> nodeTags;
     std::vector<double> nodeCoords, parametricCoords;
     gmsh::model::mesh::getNodes(nodeTags, nodeCoords, parametricCoords);
 
-    // Saving nodes position 
-    for (std::size_t i = 0; i < nodeCoords.size(); i += 3) {
-        nodePositions.push_back({ nodeCoords[i], nodeCoords[i+1], nodeCoords[i+2] });
-    }
-
-    // Nodetag processing
-    std::unordered_map<std::size_t, int> nodeIdToIndex;
-    for (std::size_t i = 0; i < nodeTags.size(); ++i) {
-        nodeIdToIndex[nodeTags[i]] = static_cast<int>(i);
-    }
-
     // Get tetrahedros
     std::vector<int> elementTypes;
     std::vector<std::vector<std::size_t>> elementTags, elementNodeTags;
     gmsh::model::mesh::getElements(elementTypes, elementTags, elementNodeTags);
 
+    // Node tags are usually dense (1..N), then a flat table maps them; otherwise a sorted list is searched
+    std::size_t minTag = std::numeric_limits<std::size_t>::max(), maxTag = 0;
+    for (std::size_t tag : nodeTags) {
+        minTag = std::min(minTag, tag);
+        maxTag = std::max(maxTag, tag);
+    }
+    std::size_t tagRange = nodeTags.empty() ? 0 : maxTag - minTag + 1;
+    bool dense = tagRange <= nodeTags.size() * 4;
+
+    std::size_t tetCount = 0;
+    for (std::size_t i = 0; i < elementTypes.size(); ++i) {
+        if (elementTypes[i] == 4) tetCount += elementNodeTags[i].size() / 4;
+    }
+
+    Arena arena(dense ? tagRange * sizeof(int) + 4096 : nodeTags.size() * sizeof(std::pair<std::size_t, int>) + 4096);
+    std::pmr::vector<int> tagTable(arena.Resource());
+    std::pmr::vector<std::pair<std::size_t, int>> tagList(arena.Resource());
+    if (dense) {
+        tagTable.assign(tagRange, -1); // gaps in the tag range are not nodes
+        for (std::size_t i = 0; i < nodeTags.size(); ++i) tagTable[nodeTags[i] - minTag] = static_cast<int>(i);
+    }
+    else {
+        tagList.resize(nodeTags.size());
+        for (std::size_t i = 0; i < nodeTags.size(); ++i) tagList[i] = { nodeTags[i], static_cast<int>(i) };
+        std::sort(tagList.begin(), tagList.end());
+    }
+    // Node tag to index, -1 for tags that are not nodes
+    auto nodeIndex = [&](std::size_t tag) {
+        if (dense) return tag >= minTag && tag - minTag < tagRange ? tagTable[tag - minTag] : -1;
+        auto found = std::lower_bound(tagList.begin(), tagList.end(), std::make_pair(tag, std::numeric_limits<int>::min()));
+        return found != tagList.end() && found->first == tag ? found->second : -1;
+    };
+
+    // Tets that name a node tag the mesh does not have are dropped and reported, not wired to node 0
+    tetrahedra.reserve(tetCount);
+    std::size_t unresolved = 0;
     for (std::size_t i = 0; i < elementTypes.size(); ++i) {
         if (elementTypes[i] == 4) { // tipo 4 = tetraedro
             const auto& nodes = elementNodeTags[i];
             for (std::size_t j = 0; j < nodes.size(); j += 4) {
-                tetrahedra.push_back({
-                    nodeIdToIndex[nodes[j]],
-                    nodeIdToIndex[nodes[j+1]],
-                    nodeIdToIndex[nodes[j+2]],
-                    nodeIdToIndex[nodes[j+3]]
-                });
+                std::array<int, 4> tet = { nodeIndex(nodes[j]), nodeIndex(nodes[j+1]), nodeIndex(nodes[j+2]), nodeIndex(nodes[j+3]) };
+                if (tet[0] < 0 || tet[1] < 0 || tet[2] < 0 || tet[3] < 0) {
+                    unresolved++;
+                    continue;
+                }
+                tetrahedra.push_back(tet);
             }
         }
     }
+    if (unresolved > 0) {
+        std::cout << "ERROR::GMSH::" << unresolved << " of " << tetCount << " tetrahedra reference unknown node tags, skipped: " << path << std::endl;
+    }
+
+    // Physical groups, kept by name (dim:tag when unnamed) so zones can be assigned from them
+    gmsh::vectorpair groups;
+    gmsh::model::getPhysicalGroups(groups);
+    for (const auto& [dim, tag] : groups) {
+        std::string name;
+        gmsh::model::getPhysicalName(dim, tag, name);
+        if (name.empty()) name = std::to_string(dim) + ":" + std::to_string(tag);
+
+        std::vector<std::size_t> groupTags;
+        std::vector<double> groupCoords;
+        gmsh::model::mesh::getNodesForPhysicalGroup(dim, tag, groupTags, groupCoords);
+        std::vector<unsigned int>& nodes = asset.nodeGroups[name];
+        nodes.reserve(groupTags.size());
+        for (std::size_t nodeTag : groupTags) {
+            int index = nodeIndex(nodeTag);
+            if (index >= 0) nodes.push_back(index);
+        }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+    }
 
     gmsh::finalize();
+    gmshGuard.unlock();
 
     // generate list of vertices
-    std::vector<Vertex> vertices;
-    for (auto& pos : nodePositions) {
-        Vertex v;
-        v.position = glm::vec3(pos[0], pos[1], pos[2]);
+    std::vector<Vertex> vertices(nodeCoords.size() / 3);
+    Jobs::ParallelFor(0, (long)vertices.size(), 4096, [&](long i) {
+        Vertex& v = vertices[i];
+        v.position = glm::vec3(nodeCoords[i * 3], nodeCoords[i * 3 + 1], nodeCoords[i * 3 + 2]);
         v.normal = glm::vec3(0.0f);
         v.rgb = glm::vec3(1.0f); 
-        vertices.push_back(v);
-    }
+    });
 
     // procesing thetrahedro data
-    std::vector<unsigned int> indices;
-    for (auto& tet : tetrahedra) {
-        indices.push_back(tet[0]);
-        indices.push_back(tet[1]);
-        indices.push_back(tet[2]);
-        indices.push_back(tet[3]);
-    }
-    meshes.clear();
-    meshes.push_back(Mesh(vertices, indices, {}));
+    std::vector<unsigned int> indices(tetrahedra.size() * 4);
+    Jobs::ParallelFor(0, (long)tetrahedra.size(), 4096, [&](long t) {
+        for (int k = 0; k < 4; k++) indices[t * 4 + k] = tetrahedra[t][k];
+    });
+    arena.Report(path.c_str());
+    ModelAsset::MeshPart part;
+    part.vertices = std::make_shared<const vector<Vertex>>(std::move(vertices));
+    part.indices = std::make_shared<const vector<unsigned int>>(std::move(indices));
+    asset.meshes.push_back(part);
 }
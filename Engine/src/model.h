@@ -12,25 +12,48 @@
 #include "map"
 #include  <memory>
 
+// Importer settings, part of the cache key so different options never share an asset
+struct ImportOptions {
+    unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+    std::string Key(const std::string& path) const { return path + "|" + std::to_string(flags); }
+};
+
+// Immutable result of importing a file, shared by every Model loaded with the same path and options
+struct ModelAsset {
+    struct MeshPart {
+        std::shared_ptr<const vector<Vertex>> vertices;
+        std::shared_ptr<const vector<unsigned int>> indices;
+        bool hasColors = false; // per vertex colours came from the file
+    };
+    vector<MeshPart> meshes;
+    std::vector<std::array<int, 4>> tetrahedra;
+    std::map<std::string, std::vector<unsigned int>> nodeGroups; // gmsh physical groups by name, node indices ascending
+    string directory;
+};
+
 class Model : public GameObject {
 public:
-    Model(std::string path) {
-        loadModel(path);
+    // deferGL loads on any thread, CreateGLResources must then run on the GL thread before drawing
+    Model(std::string path, bool deferGL = false, const ImportOptions& options = ImportOptions()) : deferGL(deferGL) {
+        loadModel(path, options);
     }
     ~Model() {}
 
     glm::vec3 color;
     void draw(Shader& shader);
+    void CreateGLResources();
 
     vector<Mesh> meshes;
     string directory;
-    std::vector<glm::vec3> nodes;
-    std::vector<std::array<int, 4>> tetrahedra;
+    std::shared_ptr<const ModelAsset> asset; // shared with every other instance of the same file
 
 private:
+    bool deferGL;
     static bool hasExtension(const std::string& path, const std::string& ext);
-    void loadModel(const std::string& path);
-    void processNode(aiNode* node, const aiScene* scene);
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene);
-    void loadTetraModel(const std::string& model);
+    void loadModel(const std::string& path, const ImportOptions& options);
+    static std::shared_ptr<ModelAsset> importModel(const std::string& path, const ImportOptions& options);
+    static void processNode(aiNode* node, const aiScene* scene, ModelAsset& asset);
+    static ModelAsset::MeshPart processMesh(aiMesh* mesh, const aiScene* scene);
+    static void loadTetraModel(const std::string& model, ModelAsset& asset);
 };
\ No newline at end of file
@@ -0,0 +1,251 @@
+/*
+ * MONODOMAIN: Reaction-diffusion excitation (Aliev-Panfilov or FitzHugh-Nagumo) on the nodes of a tet mesh
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include "monodomain.h"
+#include "jobs.h"
+
+std::shared_ptr<MonodomainMesh> MonodomainMesh::Build(const std::vector<glm::vec3>& nodes, const std::vector<std::array<int, 4>>& tetrahedra)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::shared_ptr<MonodomainMesh> result = std::make_shared<MonodomainMesh>();
+	MonodomainMesh& mesh = *result;
+	size_t n = nodes.size();
+
+	Sparse::CsrMatrix& L = mesh.laplacian;
+	L = Sparse::PatternFromTetrahedra(n, tetrahedra);
+
+	// Linear tet stiffness K_ij = V grad(phi_i) . grad(phi_j) and lumped mass V / 4, accumulated in double
+	std::vector<double> stiffness(L.NonZeros(), 0.0);
+	std::vector<double> mass(n, 0.0);
+	for (const std::array<int, 4>& tet : tetrahedra) {
+		glm::dvec3 p0 = nodes[tet[0]];
+		glm::dmat3 J = glm::dmat3(glm::dvec3(nodes[tet[1]]) - p0, glm::dvec3(nodes[tet[2]]) - p0, glm::dvec3(nodes[tet[3]]) - p0);
+		double det = glm::determinant(J);
+		double volume = std::abs(det) / 6.0;
+		if (volume < 1e-18) continue; // degenerate, contributes nothing
+
+		// Rows of J^-1 are the gradients of the barycentric coordinates 1..3
+		glm::dmat3 inverse = glm::inverse(J);
+		glm::dvec3 gradient[4];
+		for (int i = 0; i < 3; i++) gradient[i + 1] = glm::dvec3(inverse[0][i], inverse[1][i], inverse[2][i]);
+		gradient[0] = -(gradient[1] + gradient[2] + gradient[3]);
+
+		for (int i = 0; i < 4; i++) {
+			mass[tet[i]] += volume / 4.0;
+			for (int j = 0; j < 4; j++) {
+				stiffness[L.Find(tet[i], tet[j])] += volume * glm::dot(gradient[i], gradient[j]);
+			}
+		}
+	}
+
+	mesh.mass.resize(n);
+	float bound = 0.0f;
+	for (size_t i = 0; i < n; i++) {
+		mesh.mass[i] = (float)mass[i];
+		double invMass = mass[i] > 0.0 ? 1.0 / mass[i] : 0.0; // nodes outside every tet stay isolated
+		double rowSum = 0.0;
+		for (unsigned int k = L.rowOffsets[i]; k < L.rowOffsets[i + 1]; k++) {
+			L.values[k] = (float)(-stiffness[k] * invMass);
+			rowSum += std::abs(L.values[k]);
+		}
+		bound = std::max(bound, (float)rowSum);
+	}
+	mesh.spectralBound = bound;
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "::MONODOMAIN MESH::" << std::endl;
+	std::cout << "nodes: " << n << ", tetrahedra: " << tetrahedra.size() << ", nonzeros: " << L.NonZeros() << std::endl;
+	std::cout << "laplacian: " << mesh.Bytes() / 1024 << " KB, spectral bound: " << bound << ", built in " << ms << " ms" << std::endl;
+	std::cout << std::endl;
+	return result;
+}
+
+void MonodomainSolver::Init(std::shared_ptr<const MonodomainMesh> mesh)
+{
+	this->mesh = std::move(mesh);
+	Reset();
+}
+
+void MonodomainSolver::Reset()
+{
+	size_t n = mesh->mass.size();
+	u.assign(n, 0.0f);
+	v.assign(n, 0.0f);
+	next.assign(n, 0.0f);
+	time = 0.0;
+	nextPace = 0.0;
+	nextSample = 0.0;
+	sampleTimes.clear();
+	sampleValues.clear();
+	accumulated = Stats();
+	steps = 0;
+}
+
+void MonodomainSolver::Restore(const float* potential, const float* recovery, double time, double nextPace)
+{
+	u.assign(potential, potential + u.size());
+	v.assign(recovery, recovery + v.size());
+	this->time = time;
+	this->nextPace = nextPace;
+	nextSample = time;
+	sampleTimes.clear();
+	sampleValues.clear();
+}
+
+void MonodomainSolver::Stimulate(const std::vector<unsigned int>& nodes)
+{
+	for (unsigned int i : nodes) {
+		if (i < u.size()) u[i] = 1.0f;
+	}
+}
+
+void MonodomainSolver::SetProbes(std::shared_ptr<const std::vector<float>> weights, int probes, double interval)
+{
+	if (!weights || probes <= 0 || probes > MaxProbes || weights->size() != u.size() * probes) {
+		std::cout << "ERROR::MONODOMAIN::Probe weights do not match the mesh" << std::endl;
+		return;
+	}
+	probeWeights = std::move(weights);
+	probeCount = probes;
+	probeInterval = interval;
+	nextSample = time;
+	sampleTimes.clear();
+	sampleValues.clear();
+}
+
+void MonodomainSolver::TakeSamples(std::vector<double>& times, std::vector<float>& values)
+{
+	times.insert(times.end(), sampleTimes.begin(), sampleTimes.end());
+	values.insert(values.end(), sampleValues.begin(), sampleValues.end());
+	sampleTimes.clear();
+	sampleValues.clear();
+}
+
+void MonodomainSolver::react(float* U, float* V, long count, float h) const
+{
+	// Each model is its own branch free loop over flat arrays so the compiler can vectorise it
+	if (model == Model::AlievPanfilov) {
+		const float k = this->k, a = this->a, e0 = epsilon0, m1 = mu1, m2 = mu2;
+		for (long i = 0; i < count; i++) {
+			float x = U[i], y = V[i];
+			float du = -k * x * (x - a) * (x - 1.0f) - x * y;
+			float dv = (e0 + m1 * y / (x + m2)) * (-y - k * x * (x - a - 1.0f));
+			U[i] = x + h * du;
+			V[i] = y + h * dv;
+		}
+	}
+	else {
+		const float a = fhnA, b = fhnB, c1 = fhnC1, c2 = fhnC2, d = fhnD;
+		for (long i = 0; i < count; i++) {
+			float x = U[i], y = V[i];
+			float du = c1 * x * (x - a) * (1.0f - x) - c2 * x * y;
+			float dv = b * (x - d * y);
+			U[i] = x + h * du;
+			V[i] = y + h * dv;
+		}
+	}
+}
+
+void MonodomainSolver::Step(float dt)
+{
+	if (!mesh || dt <= 0.0f) return;
+	auto start = std::chrono::steady_clock::now();
+
+	// Pacemaker
+	if (pacingPeriod > 0.0f && time >= nextPace) {
+		Stimulate(pacingSites);
+		nextPace = time + pacingPeriod;
+	}
+
+	// Diffusion substeps as long as explicit diffusion allows (h * D * |lambda| <= 2 for every eigenvalue,
+	// with some margin), the reaction sub-cycles inside each one down to maxStep
+	float span = dt * timeScale;
+	float stable = span;
+	if (diffusivity > 0.0f && mesh->spectralBound > 0.0f) stable = 1.9f / (diffusivity * mesh->spectralBound);
+	if (probeCount > 0 && probeInterval > 0.0) stable = std::min(stable, (float)(probeInterval * timeScale));
+	int substeps = std::clamp((int)std::ceil(span / stable), 1, maxSubsteps);
+	float h = std::min(span / substeps, stable);
+	int reactionSteps = std::max(1, (int)std::ceil(h / maxStep));
+	float hr = h / reactionSteps;
+
+	// Diffusion then reaction (Lie splitting), fused per block of rows: the block's SpMV output is still in
+	// cache while the reaction runs over it, so a substep is a single sweep over the mesh. Probes due at the
+	// end of a substep are dotted with the block in the same sweep.
+	const Sparse::CsrMatrix& L = mesh->laplacian;
+	const unsigned int* offsets = L.rowOffsets.data();
+	const unsigned int* columns = L.columns.data();
+	const float* values = L.values.data();
+	const float hd = h * diffusivity;
+	const long count = (long)u.size();
+	const long grain = 1024;
+	const int probes = probeCount;
+	const float* W = probes > 0 ? probeWeights->data() : nullptr;
+	probePartials.assign((size_t)((count + grain - 1) / grain) * probes, 0.0);
+	const double substepSeconds = (double)h / timeScale;
+	for (int s = 0; s < substeps; s++) {
+		const float* U = u.data();
+		float* N = next.data();
+		float* V = v.data();
+		double substepEnd = time + substepSeconds * (s + 1);
+		bool sample = probes > 0 && substepEnd >= nextSample;
+		Jobs::ParallelForChunks(0, count, grain, [&](long begin, long end) {
+			for (long i = begin; i < end; i++) {
+				float sum = 0.0f;
+				for (unsigned int k = offsets[i]; k < offsets[i + 1]; k++) sum += values[k] * U[columns[k]];
+				N[i] = U[i] + hd * sum;
+			}
+			for (int r = 0; r < reactionSteps; r++) react(N + begin, V + begin, end - begin, hr);
+			if (!sample) return;
+
+			float dot[MaxProbes] = {};
+			for (long i = begin; i < end; i++) {
+				const float* w = W + (size_t)i * probes;
+				for (int p = 0; p < probes; p++) dot[p] += w[p] * N[i];
+			}
+			double* partial = probePartials.data() + (size_t)(begin / grain) * probes;
+			for (int p = 0; p < probes; p++) partial[p] = dot[p];
+		});
+		u.swap(next);
+
+		if (sample) {
+			double sum[MaxProbes] = {};
+			for (size_t c = 0; c < probePartials.size(); c += probes) {
+				for (int p = 0; p < probes; p++) sum[p] += probePartials[c + p];
+			}
+			sampleTimes.push_back(substepEnd);
+			for (int p = 0; p < probes; p++) sampleValues.push_back((float)sum[p]);
+			while (nextSample <= substepEnd) nextSample += probeInterval > 0.0 ? probeInterval : substepSeconds;
+		}
+	}
+	double seconds = substepSeconds * substeps;
+	time += seconds;
+
+	last.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	last.seconds = seconds;
+	last.substeps = substeps;
+	if (reportInterval > 0) {
+		accumulated.ms += last.ms;
+		accumulated.seconds += seconds;
+		accumulated.substeps += substeps;
+		if (++steps >= reportInterval) report();
+	}
+}
+
+void MonodomainSolver::report()
+{
+	double n = steps;
+	double stepMs = accumulated.ms / n;
+	size_t excited = std::count_if(u.begin(), u.end(), [](float x) { return x > 0.5f; });
+	std::cout << "::MONODOMAIN:: avg over " << steps << " steps" << std::endl;
+	std::cout << "nodes: " << u.size() << ", diffusion substeps/step: " << accumulated.substeps / n << ", excited: " << excited << std::endl;
+	std::cout << "step: " << stepMs << " ms, substep: " << accumulated.ms / accumulated.substeps << " ms, "
+		<< accumulated.seconds * 1000.0 / accumulated.ms << "x real time" << std::endl;
+	std::cout << std::endl;
+	accumulated = Stats();
+	steps = 0;
+}
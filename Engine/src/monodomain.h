@@ -0,0 +1,116 @@
+/*
+ * MONODOMAIN: Reaction-diffusion excitation (Aliev-Panfilov or FitzHugh-Nagumo) on the nodes of a tet mesh
+ */
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "sparse.h"
+
+// Mesh operators of the monodomain equation, built once per tet mesh and shared between bodies (AssetCache)
+struct MonodomainMesh {
+	Sparse::CsrMatrix laplacian; // -M^-1 K of linear tets with lumped mass: du/dt = D * laplacian * u + reaction
+	std::vector<float> mass;     // lumped nodal volume
+	float spectralBound = 0.0f;  // Gershgorin bound on the laplacian's eigenvalues, limits the explicit step
+
+	static std::shared_ptr<MonodomainMesh> Build(const std::vector<glm::vec3>& nodes, const std::vector<std::array<int, 4>>& tetrahedra);
+	size_t Bytes() const { return laplacian.Bytes() + mass.size() * sizeof(float); }
+};
+
+// Operator splitting per substep: the diffusion term with one parallel SpMV, then the reaction term node by
+// node (explicit Euler over flat arrays, vectorised by the compiler). The SpMV is the expensive half, so a
+// substep is as long as explicit diffusion stays stable and the reaction sub-cycles within it.
+class MonodomainSolver {
+public:
+	enum class Model { AlievPanfilov, FitzHughNagumo };
+
+	Model model = Model::AlievPanfilov;
+	float diffusivity = 0.01f;   // mesh units^2 per model time unit
+	float timeScale = 77.5f;     // model time units per second, one Aliev-Panfilov unit is 12.9 ms
+	float maxStep = 0.05f;       // reaction step limit, model time units
+	int maxSubsteps = 256;       // diffusion substeps per Step, a long frame slows the excitation down instead of stalling
+
+	// Aliev-Panfilov, nondimensional
+	float k = 8.0f;
+	float a = 0.15f;
+	float epsilon0 = 0.002f;
+	float mu1 = 0.2f;
+	float mu2 = 0.3f;
+
+	// FitzHugh-Nagumo (Rogers-McCulloch form, u in [0, 1])
+	float fhnA = 0.13f;
+	float fhnB = 0.013f;
+	float fhnC1 = 0.26f;
+	float fhnC2 = 0.1f;
+	float fhnD = 1.0f;
+
+	float pacingPeriod = 0.8f;   // seconds between stimuli at the pacing sites (<= 0 disables)
+
+	// Step timings for benchmarking, averaged every reportInterval steps (0 = no report)
+	struct Stats {
+		double ms = 0.0;
+		double seconds = 0.0; // simulated
+		int substeps = 0;
+	};
+	Stats last;
+	int reportInterval = 0;
+
+	// Resting state on every node of mesh
+	void Init(std::shared_ptr<const MonodomainMesh> mesh);
+	void Reset(); // back to rest, pacing restarts
+	bool Active() const { return mesh != nullptr; }
+	size_t NodeCount() const { return u.size(); }
+
+	// Nodes excited by the pacemaker every pacingPeriod
+	void SetPacingSites(std::vector<unsigned int> nodes) { pacingSites = std::move(nodes); }
+
+	// Raises the nodes to the excited state now
+	void Stimulate(const std::vector<unsigned int>& nodes);
+
+	// Advances dt seconds
+	void Step(float dt);
+
+	// Linear probes of the potential (ECG electrodes): weights hold probes values per node. They are sampled
+	// every interval seconds inside the substep sweep, substeps are shortened to the interval if needed.
+	void SetProbes(std::shared_ptr<const std::vector<float>> weights, int probes, double interval);
+	void ClearProbes() { probeWeights.reset(); probeCount = 0; }
+	int ProbeCount() const { return probeCount; }
+
+	// Moves the samples taken since the last call to the end of times and values (ProbeCount per sample)
+	void TakeSamples(std::vector<double>& times, std::vector<float>& values);
+
+	const std::vector<float>& Potential() const { return u; } // transmembrane potential, 0 rest to 1 excited
+	const std::vector<float>& Recovery() const { return v; }
+	double Time() const { return time; } // seconds
+	double NextPace() const { return nextPace; }
+
+	// Puts back a saved field (NodeCount values each), pending samples are dropped and sampling restarts at time
+	void Restore(const float* potential, const float* recovery, double time, double nextPace);
+	const MonodomainMesh& Mesh() const { return *mesh; }
+
+private:
+	std::shared_ptr<const MonodomainMesh> mesh;
+	std::vector<float> u, v;
+	std::vector<float> next; // diffusion output, swapped with u
+	std::vector<unsigned int> pacingSites;
+	double time = 0.0;
+	double nextPace = 0.0;
+
+	static constexpr int MaxProbes = 16;
+	std::shared_ptr<const std::vector<float>> probeWeights;
+	int probeCount = 0;
+	double probeInterval = 0.0;
+	double nextSample = 0.0;
+	std::vector<double> probePartials; // probeCount per chunk of the sweep, summed in chunk order
+	std::vector<double> sampleTimes;
+	std::vector<float> sampleValues;
+
+	Stats accumulated;
+	int steps = 0;
+
+	void react(float* U, float* V, long count, float h) const; // one block of nodes
+	void report();
+};
@@ -0,0 +1,227 @@
+/*
+ * OFFSCREEN: Framebuffer render target with asynchronous readback, frames are encoded to disk on a worker
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <filesystem>
+#include <algorithm>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "offscreen.h"
+
+FrameEncoder::FrameEncoder(int width, int height, HeadlessConfig::Format format, const std::string& output)
+    : width(width), height(height), format(format), output(output) {
+    std::error_code error;
+    if (format == HeadlessConfig::Format::PNG) {
+        std::filesystem::create_directories(output, error);
+    }
+    else {
+        std::filesystem::path parent = std::filesystem::path(output).parent_path();
+        if (!parent.empty()) std::filesystem::create_directories(parent, error);
+        yuvFile = std::fopen(output.c_str(), "wb");
+        if (!yuvFile) std::cout << "ERROR::OFFSCREEN::Cannot open " << output << std::endl;
+    }
+}
+
+FrameEncoder::~FrameEncoder() {
+    Finish();
+    if (yuvFile) std::fclose(yuvFile);
+}
+
+void FrameEncoder::Submit(const unsigned char* rgba) {
+    size_t bytes = (size_t)width * height * 4;
+
+    // Offline rendering must not drop frames, so a full queue waits for the encoder
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (queue.size() < maxQueued) break;
+        }
+        Jobs::Wait(encoding);
+        schedule();
+    }
+
+    Frame frame;
+    frame.index = submitted++;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!spare.empty()) {
+            frame.rgba = std::move(spare.back());
+            spare.pop_back();
+        }
+    }
+    frame.rgba.assign(rgba, rgba + bytes);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(std::move(frame));
+    }
+    schedule();
+}
+
+void FrameEncoder::Finish() {
+    // The job drains the queue, a frame queued just as it returned needs another one
+    while (true) {
+        Jobs::Wait(encoding);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (queue.empty()) break;
+        }
+        schedule();
+    }
+    if (yuvFile) std::fflush(yuvFile);
+}
+
+void FrameEncoder::schedule() {
+    // One encoder at a time keeps the frames in order
+    if (encoding && !encoding->done) return;
+    encoding = Jobs::SubmitBackground([this]() { encode(); });
+}
+
+void FrameEncoder::encode() {
+    while (true) {
+        Frame frame;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (queue.empty()) return;
+            frame = std::move(queue.front());
+            queue.pop_front();
+        }
+        write(frame);
+        std::lock_guard<std::mutex> guard(lock);
+        spare.push_back(std::move(frame.rgba));
+    }
+}
+
+void FrameEncoder::write(const Frame& frame) {
+    // GL rows start at the bottom
+    int stride = width * 4;
+    const unsigned char* top = frame.rgba.data() + (size_t)(height - 1) * stride;
+
+    if (format == HeadlessConfig::Format::PNG) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%06d.png", frame.index);
+        std::string path = (std::filesystem::path(output) / name).string();
+        if (!stbi_write_png(path.c_str(), width, height, 4, top, -stride)) {
+            std::cout << "ERROR::OFFSCREEN::Cannot write " << path << std::endl;
+        }
+        return;
+    }
+
+    if (!yuvFile) return;
+
+    // I420, BT.601 limited range: full resolution Y, then U and V averaged over 2x2 blocks
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    yuv.resize((size_t)width * height + 2 * (size_t)cw * ch);
+    unsigned char* Y = yuv.data();
+    unsigned char* U = Y + (size_t)width * height;
+    unsigned char* V = U + (size_t)cw * ch;
+
+    for (int y = 0; y < height; y++) {
+        const unsigned char* row = top - (size_t)y * stride;
+        for (int x = 0; x < width; x++) {
+            const unsigned char* p = row + x * 4;
+            Y[(size_t)y * width + x] = (unsigned char)((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) / 256 + 16);
+        }
+    }
+    for (int cy = 0; cy < ch; cy++) {
+        for (int cx = 0; cx < cw; cx++) {
+            int r = 0, g = 0, b = 0, n = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    int x = std::min(cx * 2 + dx, width - 1), y = std::min(cy * 2 + dy, height - 1);
+                    const unsigned char* p = top - (size_t)y * stride + x * 4;
+                    r += p[0]; g += p[1]; b += p[2]; n++;
+                }
+            }
+            r /= n; g /= n; b /= n;
+            U[(size_t)cy * cw + cx] = (unsigned char)((-38 * r - 74 * g + 112 * b + 128) / 256 + 128);
+            V[(size_t)cy * cw + cx] = (unsigned char)((112 * r - 94 * g - 18 * b + 128) / 256 + 128);
+        }
+    }
+    std::fwrite(yuv.data(), 1, yuv.size(), yuvFile);
+}
+
+OffscreenTarget::OffscreenTarget(const HeadlessConfig& config)
+    : width(config.width), height(config.height), encoder(config.width, config.height, config.format, config.output) {
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ERROR::OFFSCREEN::Framebuffer incomplete" << std::endl;
+    }
+
+    // Two pack buffers so a readback is always in flight while the previous one is mapped
+    glGenBuffers(2, pbo);
+    for (GLuint buffer : pbo) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+OffscreenTarget::~OffscreenTarget() {
+    for (GLsync& sync : fence) {
+        if (sync) glDeleteSync(sync);
+    }
+    glDeleteBuffers(2, pbo);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteFramebuffers(1, &fbo);
+}
+
+void OffscreenTarget::Bind() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+}
+
+void OffscreenTarget::Capture() {
+    int slot = frame % 2;
+
+    // Into the pack buffer, glReadPixels returns without waiting for the GPU
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[slot]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    if (frame > 0) collect(1 - slot);
+    frame++;
+}
+
+void OffscreenTarget::Finish() {
+    if (frame > 0) collect((frame - 1) % 2);
+    frame = 0;
+    encoder.Finish();
+}
+
+void OffscreenTarget::collect(int slot) {
+    if (!fence[slot]) return;
+
+    // Issued a frame ago, so this is normally already signalled
+    glClientWaitSync(fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fence[slot]);
+    fence[slot] = nullptr;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[slot]);
+    const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)width * height * 4, GL_MAP_READ_BIT);
+    if (pixels) {
+        encoder.Submit(pixels);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
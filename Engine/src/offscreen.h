@@ -0,0 +1,94 @@
+/*
+ * OFFSCREEN: Framebuffer render target with asynchronous readback, frames are encoded to disk on a worker
+ */
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include "jobs.h"
+
+// Settings for Engine::RenderHeadless
+struct HeadlessConfig {
+    enum class Context { OSMesa, EGL };
+    enum class Format { PNG, YUV420 };
+
+    int width = 1280;           // keep 16:9, the renderer projects with the engine's target aspect ratio
+    int height = 720;
+    int frames = 600;           // frames to render, the game can also end the run by closing the window
+    float dt = 1.0f / 60.0f;    // fixed step per frame, runs render in simulated time
+    Context context = Context::OSMesa; // OSMesa needs no display at all, EGL picks up a GPU if there is one
+    Format format = Format::PNG;
+    std::string output = "frames"; // directory of numbered PNGs, or the .yuv file (I420, for ffmpeg -f rawvideo)
+};
+
+// Writes RGBA frames (bottom-up, as read from GL) in order on a background job
+class FrameEncoder {
+public:
+    FrameEncoder(int width, int height, HeadlessConfig::Format format, const std::string& output);
+    ~FrameEncoder();
+
+    // Copies the pixels, blocks only when maxQueued frames are already waiting
+    void Submit(const unsigned char* rgba);
+
+    // Waits until every submitted frame is on disk
+    void Finish();
+
+    size_t maxQueued = 4;
+
+private:
+    struct Frame {
+        int index;
+        std::vector<unsigned char> rgba;
+    };
+
+    void schedule();
+    void encode();
+    void write(const Frame& frame);
+
+    int width, height;
+    HeadlessConfig::Format format;
+    std::string output;
+    int submitted = 0;
+
+    std::mutex lock;             // guards queue and spare
+    std::deque<Frame> queue;
+    std::vector<std::vector<unsigned char>> spare; // recycled pixel buffers
+    Jobs::Handle encoding;
+
+    // Encoder only
+    std::vector<unsigned char> yuv;
+    FILE* yuvFile = nullptr;
+};
+
+// Renders into an FBO and reads each frame back through two pixel buffers: the read for frame N is queued
+// on the GPU and frame N-1, whose copy had a whole frame to finish, is mapped and handed to the encoder.
+class OffscreenTarget {
+public:
+    OffscreenTarget(const HeadlessConfig& config); // needs a current GL context
+    ~OffscreenTarget();
+
+    // Draw after this, the FBO replaces the default framebuffer
+    void Bind();
+
+    // Queues the readback of what was just drawn and encodes the frame before it
+    void Capture();
+
+    // Collects the last readback and waits for the encoder
+    void Finish();
+
+private:
+    int width, height;
+    GLuint fbo = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    GLuint pbo[2] = { 0, 0 };
+    GLsync fence[2] = { nullptr, nullptr };
+    int frame = 0;
+    FrameEncoder encoder;
+
+    void collect(int slot);
+};
@@ -0,0 +1,29 @@
+/*
+ * PARTICLES: Structure-of-arrays storage for the point masses of a soft body
+ */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// One entry per mesh vertex, positions are in the body's local space. Scalar is the storage precision,
+// everything outside the physics core (rendering, collisions, files) works on the float store.
+template<typename Scalar>
+struct ParticleStoreT {
+	using vec = glm::vec<3, Scalar>;
+
+	std::vector<vec> position;
+	std::vector<vec> velocity;
+	std::vector<vec> force;
+
+	size_t size() const { return position.size(); }
+
+	void resize(size_t n) {
+		position.resize(n, vec(0));
+		velocity.resize(n, vec(0));
+		force.resize(n, vec(0));
+	}
+};
+
+using ParticleStore = ParticleStoreT<float>;
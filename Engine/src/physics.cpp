@@ -3,7 +3,12 @@
  */
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "physics.h"
+#include "jobs.h"
+#include "assetCache.h"
 #include <glad/glad.h>
 #include  "ThreeCoupledOscillator.h"
 
@@ -11,9 +16,7 @@
  * Soft body
  */
 
-int springCount = 0;
-
-SoftBody::SoftBody(std::string path, float restitution, float mass, float stiffness, float damping) : Model(path), restitution(restitution), mass(mass), stiffness(stiffness), damping(damping)
+SoftBody::SoftBody(std::string path, float restitution, float mass, float stiffness, float damping, bool deferGL, Precision precision, const ImportOptions& options) : Model(path, deferGL, options), restitution(restitution), mass(mass), stiffness(stiffness), damping(damping)
 {
 	assert(meshes.size() > 0 && "ERROR: More than one mesh provided for softbody in this model, provide a single mesh!");
 	
@@ -23,33 +26,81 @@ SoftBody::SoftBody(std::string path, float restitution, float mass, float stiffn
 	this->stiffness = stiffness;
 	this->damping = damping;
 	
-	// Create copy of mesh's initial vertices
-	dynamicVertices = vector<Vertex>(meshes[0].vertices);
+	// Point masses start at the mesh's initial vertices
+	const vector<Vertex>& vertices = meshes[0].Vertices();
+	particles.resize(vertices.size());
+	normals.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		particles.position[i] = vertices[i].position;
+		normals[i] = vertices[i].normal;
+	}
 
-	for (Vertex& v : dynamicVertices) {
-		PointMass p(&v, this, restitution, mass, stiffness, damping);
-		pointMasses.push_back(p);
+	// Springs, surface and zones only depend on the asset, built once and shared by every instance
+	const ModelAsset::MeshPart& part = asset->meshes[0];
+	bool tetrahedral = !asset->tetrahedra.empty();
+	assetKey = options.Key(path);
+	topology = AssetCache::Get<SoftBodyTopology>(assetKey, [&]() {
+		return buildTopology(part, tetrahedral);
+	});
+	assignZones();
+
+	// Tet meshes only draw their boundary
+	if (tetrahedral) {
+		meshes[0].UpdateIndices(topology->drawIndices);
+	}
+	topology->surface.RecomputeNormals(particles.position, normals, faceNormals);
+	selfCollision.Init(topology->surface, particles.position, stiffness);
+	SetPrecision(precision);
+	oscillator.setDefaults();
+
+	// Positions and normals change every step, stream only those through a mapped ring
+	meshes[0].EnableStreaming(StreamFormat::Quantized);
+
+	// Spring debug view: endpoint indices into the same streamed positions
+	meshes[0].SetLineIndices(topology->lineIndices);
+
+	std::cout << "::SOFTBODY STATS::" << std::endl;
+	std::cout << "vertices:" << particles.size() << std::endl;
+	std::cout << "indices: " << part.indices->size() << std::endl;
+	std::cout << "springs: " << topology->springs.size() << std::endl;
+	std::cout << "precision: " << PrecisionName(precision) << std::endl;
+	std::cout << "surface triangles: " << topology->surface.triangles.size() / 3 << std::endl;
+	std::cout << "shared topology: " << topology->Bytes() / 1024 << " KB, instance state: " << InstanceBytes() / 1024 << " KB" << std::endl;
+	Footprint footprint = BytesPerVertex();
+	// Physics is the measured per instance total, the layout is the fixed position, velocity, force part of it
+	size_t particleLayout = 3 * sizeof(glm::vec3) + (precision == Precision::Double ? 3 * sizeof(glm::dvec3) : 0);
+	std::cout << "bytes per vertex: physics " << footprint.physics << " (particle layout " << particleLayout
+		<< "), render " << footprint.render << ", shared mesh " << footprint.shared << std::endl;
+	std::cout << std::endl;
+}
+
+std::shared_ptr<SoftBodyTopology> SoftBody::buildTopology(const ModelAsset::MeshPart& part, bool tetrahedral)
+{
+	std::shared_ptr<SoftBodyTopology> topology = std::make_shared<SoftBodyTopology>();
+	const vector<Vertex>& vertices = *part.vertices;
+	const vector<unsigned int>& indices = *part.indices;
+
+	std::vector<glm::vec3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		positions[i] = vertices[i].position;
 	}
 
 	// DanielaHz implementation 
 	// Tetahedral springs creation (for .msh files)
-	indices = vector<unsigned int>(meshes[0].indices);
 	std::cout << "indices size : " << indices.size() << std::endl;
 	
 	std::set<std::pair<unsigned int, unsigned int>> springSet;
 
-	std::set<std::pair<int, int>> addedSprings;
-
 	auto addSpring = [&](unsigned int a, unsigned int b) {
 		if (a > b) std::swap(a, b);
 		auto edge = std::make_pair(a, b);
 		if (springSet.find(edge) == springSet.end()) {
 			springSet.insert(edge);
-			AddSpring(&pointMasses[a], &pointMasses[b]);
+			topology->springs.push_back({ a, b, glm::distance(positions[a], positions[b]) });
 		}
 	};
 
-	for (size_t i = 0; i < indices.size(); i += 4) {
+	for (size_t i = 0; i + 3 < indices.size(); i += 4) {
 		int i0 = indices[i];
 		int i1 = indices[i + 1];
 		int i2 = indices[i + 2];
@@ -75,7 +126,7 @@ SoftBody::SoftBody(std::string path, float restitution, float mass, float stiffn
 
 	// 		if (springSet.find(edge) == springSet.end()) {
 	// 			springSet.insert(edge);
-	// 			AddSpring(&pointMasses[a], &pointMasses[b]);
+	// 			AddSpring(a, b);
 	// 		}
 	// 	};
 
@@ -95,283 +146,612 @@ SoftBody::SoftBody(std::string path, float restitution, float mass, float stiffn
 	// 	}
 	// }
 
-	std::cout << "::SOFTBODY STATS::" << std::endl;
-	std::cout << "vertices:" << dynamicVertices.size() << std::endl;
-	std::cout << "indices: " << indices.size() << std::endl;
-	std::cout << "springs: " << springs.size() << std::endl;
-	std::cout << std::endl;
+	// Surface used for rendering, normals and self-collision
+	topology->surface.Build(indices, positions, tetrahedral);
+	topology->drawIndices = tetrahedral ? std::make_shared<const std::vector<unsigned int>>(topology->surface.triangles) : part.indices;
+
+	std::vector<unsigned int> springIndices;
+	springIndices.reserve(topology->springs.size() * 2);
+	for (const Spring& s : topology->springs) {
+		springIndices.push_back(s.a);
+		springIndices.push_back(s.b);
+	}
+	topology->lineIndices = std::make_shared<const std::vector<unsigned int>>(std::move(springIndices));
+
+	// Springs touching each particle, in spring order, so the force gather adds in the same order as a serial loop
+	topology->springOffsets.assign(vertices.size() + 1, 0);
+	for (const Spring& s : topology->springs) {
+		topology->springOffsets[s.a + 1]++;
+		topology->springOffsets[s.b + 1]++;
+	}
+	for (size_t i = 0; i < vertices.size(); i++) topology->springOffsets[i + 1] += topology->springOffsets[i];
+	topology->springRefs.resize(topology->springOffsets.back());
+	std::vector<unsigned int> cursor(topology->springOffsets.begin(), topology->springOffsets.end() - 1);
+	for (unsigned int k = 0; k < (unsigned int)topology->springs.size(); k++) {
+		const Spring& s = topology->springs[k];
+		topology->springRefs[cursor[s.a]++] = k * 2;
+		topology->springRefs[cursor[s.b]++] = k * 2 + 1;
+	}
+
+	return topology;
 }
 
-SoftBody::~SoftBody() {
-	dynamicVertices.clear();
-	springs.clear();
-	pointMasses.clear();
+size_t SoftBodyTopology::Bytes() const
+{
+	size_t bytes = springs.size() * sizeof(Spring);
+	bytes += (springOffsets.size() + springRefs.size()) * sizeof(unsigned int);
+	bytes += (surface.triangles.size() + surface.vertices.size() + surface.faceOffsets.size() + surface.faceIndices.size()) * sizeof(unsigned int);
+	if (drawIndices && drawIndices->data() != surface.triangles.data()) bytes += drawIndices->size() * sizeof(unsigned int);
+	if (lineIndices) bytes += lineIndices->size() * sizeof(unsigned int);
+	return bytes;
 }
 
-void SoftBody::AddForce(glm::vec3(force)) {
-	for (PointMass &p : pointMasses) {
-		p.forces += force;
-	}
+size_t SoftBody::InstanceBytes() const
+{
+	size_t bytes = particles.size() * 3 * sizeof(glm::vec3) + (normals.size() + faceNormals.size()) * sizeof(glm::vec3);
+	bytes += springTerms.size() * sizeof(glm::vec2) + springTermsD.size() * sizeof(glm::dvec2);
+	bytes += colliderScratch.Bytes();
+	bytes += doubleState.size() * 3 * sizeof(glm::dvec3);
+	if (excitation) bytes += excitation->NodeCount() * 3 * sizeof(float);
+	bytes += (fibreScale.size() + tension.size()) * sizeof(float) + particleZone.size();
+	return bytes;
 }
 
-void SoftBody::AddSpring(PointMass* a, PointMass* b) {
-	Spring s;
-	s.a = a;
-	s.b = b;
-	s.restLength = glm::distance(a->vert->position, b->vert->position);
-	springs.push_back(s);
-	springCount++;
+SoftBody::Footprint SoftBody::BytesPerVertex() const
+{
+	Footprint footprint;
+	double n = (double)std::max<size_t>(particles.size(), 1);
+	size_t render = (normals.size() + faceNormals.size()) * sizeof(glm::vec3);
+	footprint.physics = (InstanceBytes() - render) / n;
+	footprint.render = render / n;
+	footprint.shared = (meshes[0].Vertices().size() * sizeof(Vertex) + topology->Bytes()) / n;
+	return footprint;
 }
 
-void SoftBody::Update(float dt) {
-	// Calculate spring forces (Hooke's law)
-	for (Spring s : springs) {
-		glm::vec3 aPos = s.a->vert->position;
-		glm::vec3 bPos = s.b->vert->position;
-		glm::vec3 dir = glm::normalize(bPos - aPos);
-
-		float currentLength = glm::distance(aPos, bPos);
-		float dX = currentLength - s.restLength;
-
-		// Hooke's law
-		s.a->forces += dir * dX * stiffness;
-		s.b->forces -= dir * dX * stiffness;
-
-		// Damping
-		float relativeVelocity = glm::dot(dir, s.b->velocity - s.a->velocity);
-		s.a->forces += dir * relativeVelocity * damping * s.a->mass;
-		s.b->forces -= dir * relativeVelocity * damping * s.b->mass;
+Sparse::BsrMatrix SoftBody::StiffnessMatrix(float shift) const
+{
+	const std::vector<Spring>& springs = topology->springs;
+	std::vector<std::pair<unsigned int, unsigned int>> edges(springs.size());
+	for (size_t k = 0; k < springs.size(); k++) edges[k] = { springs[k].a, springs[k].b };
+	Sparse::BsrMatrix K = Sparse::BlockPatternFromEdges(particles.size(), std::move(edges));
+
+	// Per spring: k d d^T along it, plus the tension term k (1 - L0 / l) (I - d d^T) across it. Under
+	// compression that term would make K indefinite, so it is dropped there.
+	std::vector<glm::mat3> blocks(springs.size());
+	Jobs::ParallelFor(0, (long)springs.size(), 1024, [&](long k) {
+		const Spring& s = springs[k];
+		glm::vec3 delta = particles.position[s.b] - particles.position[s.a];
+		float length = glm::length(delta);
+		if (length <= 0.0f) {
+			blocks[k] = glm::mat3(0.0f);
+			return;
+		}
+		glm::vec3 d = delta / length;
+		glm::mat3 ddT = glm::outerProduct(d, d);
+		float tension = std::max(0.0f, 1.0f - s.restLength / length);
+		blocks[k] = stiffness * ddT + (stiffness * tension) * (glm::mat3(1.0f) - ddT);
+	});
+
+	// Gather per block row through the particle's spring list, no two rows write the same block
+	const unsigned int* offsets = topology->springOffsets.data();
+	const unsigned int* refs = topology->springRefs.data();
+	Jobs::ParallelFor(0, (long)particles.size(), 1024, [&](long i) {
+		glm::mat3 diagonal(shift);
+		for (unsigned int r = offsets[i]; r < offsets[i + 1]; r++) {
+			unsigned int k = refs[r] >> 1;
+			unsigned int other = (refs[r] & 1) ? springs[k].a : springs[k].b;
+			diagonal += blocks[k];
+			float* block = K.Block(K.Find((unsigned int)i, other));
+			for (int row = 0; row < 3; row++) {
+				for (int col = 0; col < 3; col++) block[row * 3 + col] -= blocks[k][col][row];
+			}
+		}
+		float* block = K.Block(K.Find((unsigned int)i, (unsigned int)i));
+		for (int row = 0; row < 3; row++) {
+			for (int col = 0; col < 3; col++) block[row * 3 + col] = diagonal[col][row];
+		}
+	});
+	return K;
+}
+
+bool SoftBody::EnableExcitation()
+{
+	if (excitation) return true;
+	if (asset->tetrahedra.empty()) {
+		std::cout << "ERROR::SOFTBODY::Excitation needs a tetrahedral mesh" << std::endl;
+		return false;
 	}
 
-	//Integrate all point masses with their forces
-	for (PointMass& p : pointMasses) {
-		p.Integrate(dt);
+	// Operators in the rest configuration
+	std::shared_ptr<const MonodomainMesh> mesh = AssetCache::Get<MonodomainMesh>(assetKey, [&]() {
+		std::vector<glm::vec3> nodes(meshes[0].Vertices().size());
+		for (size_t i = 0; i < nodes.size(); i++) nodes[i] = meshes[0].Vertices()[i].position;
+		return MonodomainMesh::Build(nodes, asset->tetrahedra);
+	});
+	excitation = std::make_unique<MonodomainSolver>();
+	excitation->Init(mesh);
+
+	auto sa = heartZones->find("sa");
+	if (sa != heartZones->end() && !sa->second.empty()) {
+		excitation->SetPacingSites(sa->second);
+		return true;
 	}
 
-	// Update vertices for rendering
-	meshes[0].UpdateVertices(dynamicVertices);
+	// No painted zones: the topmost node and its spring neighbours
+	unsigned int top = 0;
+	for (unsigned int i = 1; i < (unsigned int)particles.size(); i++) {
+		if (meshes[0].Vertices()[i].position.y > meshes[0].Vertices()[top].position.y) top = i;
+	}
+	std::vector<unsigned int> sites = { top };
+	for (unsigned int r = topology->springOffsets[top]; r < topology->springOffsets[top + 1]; r++) {
+		const Spring& s = topology->springs[topology->springRefs[r] >> 1];
+		sites.push_back(s.a == top ? s.b : s.a);
+	}
+	excitation->SetPacingSites(std::move(sites));
+	return true;
 }
 
-void SoftBody::Reset() {
-	// Reset soft body to original state (original position included)
-	dynamicVertices.clear();
-	dynamicVertices.reserve(meshes[0].vertices.size());
-
-	for (const Vertex& vertex : meshes[0].vertices) {
-		dynamicVertices.push_back(vertex);
+bool SoftBody::EnableECG(const Ecg::ElectrodeLayout& layout, float sampleRate)
+{
+	if (!excitation) {
+		std::cout << "ERROR::SOFTBODY::The ECG needs the excitation field" << std::endl;
+		return false;
 	}
+	std::shared_ptr<const Ecg::LeadField> field = AssetCache::Get<Ecg::LeadField>(assetKey + layout.Key(), [&]() {
+		std::vector<glm::vec3> nodes(meshes[0].Vertices().size());
+		for (size_t i = 0; i < nodes.size(); i++) nodes[i] = meshes[0].Vertices()[i].position;
+		return Ecg::LeadField::Build(nodes, asset->tetrahedra, layout);
+	});
+	// The solver shares the weights, the alias keeps the whole field alive
+	excitation->SetProbes(std::shared_ptr<const std::vector<float>>(field, &field->weights), Ecg::ElectrodeCount, 1.0 / sampleRate);
+	return excitation->ProbeCount() > 0;
+}
 
-	for (PointMass& p : pointMasses) {
-		p.velocity = glm::vec3(0.0);
-		p.acceleration = glm::vec3(0.0);
-		p.forces = glm::vec3(0.0);
+Ecg::ElectrodeLayout SoftBody::StandardElectrodes(float distance) const
+{
+	glm::vec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+	for (const Vertex& v : meshes[0].Vertices()) {
+		min = glm::min(min, v.position);
+		max = glm::max(max, v.position);
 	}
+	return Ecg::ElectrodeLayout::Standard(min, max, distance);
 }
 
-// DanielaHz implementation to visualize the springs created in the models (visual debugging)
-void SoftBody::RenderSprings(Shader& shader) {
-    std::vector<glm::vec3> lineVertices;
-    
-    for (const Spring& spring : springs) {
-		// Asegura que los pointers están dentro del rango del vector pointMasses
-		bool validA = (spring.a >= &pointMasses[0]) && (spring.a < &pointMasses[0] + pointMasses.size());
-		bool validB = (spring.b >= &pointMasses[0]) && (spring.b < &pointMasses[0] + pointMasses.size());
-	
-		if (validA && validB && spring.a->vert && spring.b->vert) {
-			glm::vec3 posA = spring.a->vert->position;
-			glm::vec3 posB = spring.b->vert->position;
-	
-			lineVertices.push_back(posA);
-			lineVertices.push_back(posB);
-		} else {
-			std::cout << "Warning: Spring connected to invalid PointMass!\n";
+void SoftBody::TakeECG(std::vector<double>& times, std::vector<std::array<float, Ecg::LeadCount>>& leads)
+{
+	if (!excitation || excitation->ProbeCount() != Ecg::ElectrodeCount) return;
+	size_t first = times.size();
+	std::vector<float> electrodes;
+	excitation->TakeSamples(times, electrodes);
+	for (size_t k = 0; k < times.size() - first; k++) leads.push_back(Ecg::Leads(electrodes.data() + k * Ecg::ElectrodeCount));
+}
+
+void SoftBody::SetActiveTension(const ActiveTension& settings)
+{
+	if (settings == active) return;
+	active = settings;
+	activeTopology = nullptr; // fibres may have changed
+	if (active.source == ActiveTension::Source::Excitation && !excitation) EnableExcitation();
+}
+
+void SoftBody::prepareActive()
+{
+	if (activeTopology == topology.get()) return;
+	activeTopology = topology.get();
+	const std::vector<Vertex>& rest = meshes[0].Vertices();
+	const std::vector<Spring>& springs = topology->springs;
+
+	// Fibre direction at each spring's rest midpoint. Helical fibres wind around the long axis through the
+	// centroid, circumferential turned by helixAngle towards the axis.
+	glm::vec3 axis = glm::length(active.axis) > 0.0f ? glm::normalize(active.axis) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec3 centroid(0.0f);
+	for (const Vertex& v : rest) centroid += v.position;
+	if (!rest.empty()) centroid /= (float)rest.size();
+	float helix = glm::radians(active.helixAngle);
+
+	fibreScale.resize(springs.size());
+	Jobs::ParallelFor(0, (long)springs.size(), 1024, [&](long k) {
+		const Spring& s = springs[k];
+		glm::vec3 a = rest[s.a].position, b = rest[s.b].position;
+		glm::vec3 fibre = axis;
+		if (active.fibres == ActiveTension::Fibres::Helical) {
+			glm::vec3 offset = 0.5f * (a + b) - centroid;
+			glm::vec3 radial = offset - axis * glm::dot(offset, axis);
+			if (glm::length(radial) > 1e-6f) fibre = std::cos(helix) * glm::normalize(glm::cross(axis, radial)) + std::sin(helix) * axis;
 		}
-	}	
+		float along = b != a ? glm::dot(glm::normalize(b - a), fibre) : 0.0f;
+		fibreScale[k] = s.restLength * along * along;
+	});
+
+	// "not" and unassigned particles are passive tissue, their level stays 0
+	particleZone.assign(particles.size(), RestZone);
+	for (const auto& [zone, verts] : *heartZones) {
+		unsigned char id = zone == "sa" ? 0 : zone == "av" ? 1 : zone == "hpc" ? 2 : RestZone;
+		for (unsigned int i : verts) particleZone[i] = id;
+	}
+	tension.resize(particles.size(), 0.0f);
+}
 
-    if (lineVertices.empty()) return; 
+void SoftBody::SetPrecision(Precision precision)
+{
+	this->precision = precision;
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// Only the scratch of the precision in use is kept, sized now so the reported footprint is the stepping one
+	if (precision == Precision::Float) {
+		springTermsD = std::vector<glm::dvec2>();
+		springTerms.resize(topology->springs.size());
+	}
+	else {
+		springTerms = std::vector<glm::vec2>();
+		springTermsD.resize(topology->springs.size());
+	}
+	if (precision != Precision::Double) {
+		doubleState = ParticleStoreT<double>();
+		return;
+	}
+	doubleState.resize(particles.size());
+	for (size_t i = 0; i < particles.size(); i++) {
+		doubleState.position[i] = glm::dvec3(particles.position[i]);
+		doubleState.velocity[i] = glm::dvec3(particles.velocity[i]);
+	}
+}
 
-    unsigned int VAO, VBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+void SoftBody::pullMirror()
+{
+	// Only particles something else moved differ from the rounded double state, the rest keep full precision
+	Jobs::ParallelFor(0, (long)particles.size(), 1024, [&](long i) {
+		if (particles.position[i] != glm::vec3(doubleState.position[i])) doubleState.position[i] = glm::dvec3(particles.position[i]);
+		if (particles.velocity[i] != glm::vec3(doubleState.velocity[i])) doubleState.velocity[i] = glm::dvec3(particles.velocity[i]);
+	});
+}
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, lineVertices.size() * sizeof(glm::vec3), &lineVertices[0], GL_DYNAMIC_DRAW);
+void SoftBody::pushMirror()
+{
+	Jobs::ParallelFor(0, (long)particles.size(), 1024, [&](long i) {
+		particles.position[i] = glm::vec3(doubleState.position[i]);
+		particles.velocity[i] = glm::vec3(doubleState.velocity[i]);
+		particles.force[i] = glm::vec3(0.0f);
+	});
+}
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+uint64_t SoftBody::StateHash() const
+{
+	// Raw bytes, so runs only match when they are bit-identical
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&hash](const void* data, size_t bytes) {
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < bytes; i++) {
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+	};
+	mix(particles.position.data(), particles.size() * sizeof(glm::vec3));
+	mix(particles.velocity.data(), particles.size() * sizeof(glm::vec3));
+	mix(&simTime, sizeof(simTime));
+	return hash;
+}
 
-    shader.use();
-	
-	// defining the color of the shader
-	int colorLoc = glGetUniformLocation(shader.ID, "color");
-	glUniform3f(colorLoc,1.0 , 1.0 , 1.0);
+SoftBody::~SoftBody() {
+}
 
-	// Si tu shader tiene esta flag para iluminación, desactívala si quieres líneas simples
-	int boolLoc = glGetUniformLocation(shader.ID, "calculateLighting");
-	glUniform1i(boolLoc, 0);  // desactiva iluminación para que se vea solo el color
-	glLineWidth(1.0f);
-    glDrawArrays(GL_LINES, 0, lineVertices.size());
+void SoftBody::AddForce(glm::vec3(force)) {
+	for (glm::vec3& f : particles.force) {
+		f += force;
+	}
+}
 
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+void SoftBody::Update(float dt) {
+	Simulate(dt);
+	Upload();
 }
 
-// DanielaHz Human heart processing
-void SoftBody::processMeshZones(vector<PointMass> &pointMasses, std::map<std::string,std::vector<PointMass>> &heartZones)
+// Active term of the spring pass. Springs read the tension of their ends, the gather then relaxes each
+// particle's tension towards its activation for the next step, so neither needs a pass of its own.
+struct ActiveInput {
+	const float* fibreScale;     // per spring
+	float* tension;              // per particle
+	const float* potential;      // per particle activation (excitation source), or null
+	const unsigned char* zone;   // otherwise per particle zone into level
+	float level[4];              // sa, av, hpc, rest (always 0)
+	float contraction;
+	float rate;                  // fraction of the way to the activation per step
+};
+
+// Spring forces (Hooke's law + damping, active tension shortens the rest length) added to force. One writer
+// per spring into the scratch, then a gather per particle in spring order: the same additions, in the same
+// order, as a serial loop over the springs, so the result is bit-identical whatever the partitioning or
+// thread count. The scratch keeps two scalars per spring and the gather recomputes the direction from the
+// positions (the same operations, so the same bits), a third of the memory of storing both force vectors.
+template<typename P>
+static void springForces(const SoftBodyTopology& topology, const typename P::vec* position, const typename P::vec* velocity,
+	typename P::vec* force, long count, float stiffness, float damping, float mass,
+	std::vector<glm::vec<2, typename P::accum>>& terms, const ActiveInput* active)
 {
-    float delta = 0.200f;
-
-    auto isClose = [&](const glm::vec3& a, const glm::vec3& b) {
-        return fabs(a.r - b.r) <= delta &&
-            fabs(a.g - b.g) <= delta &&
-            fabs(a.b - b.b) <= delta;
-    };
+	using A = typename P::accum;
+	using V = typename P::accumVec;
+
+	const std::vector<Spring>& springs = topology.springs;
+	terms.resize(springs.size());
+	Jobs::ParallelFor(0, (long)springs.size(), 1024, [&](long k) {
+		const Spring& s = springs[k];
+		V aPos = V(position[s.a]);
+		V bPos = V(position[s.b]);
+		V dir = glm::normalize(bPos - aPos);
+
+		A currentLength = glm::distance(aPos, bPos);
+		A dX = currentLength - A(s.restLength);
+		if (active) dX += A(active->contraction * 0.5f * (active->tension[s.a] + active->tension[s.b]) * active->fibreScale[k]);
+
+		// Stretch for Hooke's law, closing speed for damping
+		A relativeVelocity = glm::dot(dir, V(velocity[s.b]) - V(velocity[s.a]));
+		terms[k] = glm::vec<2, A>(dX, relativeVelocity);
+	});
+
+	const unsigned int* offsets = topology.springOffsets.data();
+	const unsigned int* refs = topology.springRefs.data();
+	Jobs::ParallelFor(0, count, 1024, [&](long i) {
+		V f = V(force[i]);
+		for (unsigned int r = offsets[i]; r < offsets[i + 1]; r++) {
+			unsigned int k = refs[r] >> 1;
+			const Spring& s = springs[k];
+			V dir = glm::normalize(V(position[s.b]) - V(position[s.a]));
+			V elastic = dir * terms[k].x * A(stiffness);
+			V damp = dir * terms[k].y * A(damping) * A(mass);
+			if (refs[r] & 1) {
+				f -= elastic;
+				f -= damp;
+			}
+			else {
+				f += elastic;
+				f += damp;
+			}
+		}
+		force[i] = typename P::vec(f);
 
-    glm::vec3 hpcColor = glm::vec3(1.0f, 0.4f, 0.8392f);
-    glm::vec3 avColor  = glm::vec3(0.6039f, 0.251f, 1.0f);
-    glm::vec3 saColor  = glm::vec3(0.2784f, 0.6039f, 1.0f);
-
-    for (const auto& vertex : pointMasses) {
-        if (isClose(vertex.vert->rgb, hpcColor)) {
-            heartZones["hpc"].push_back(vertex);
-        } else if (isClose(vertex.vert->rgb, avColor)) {
-            heartZones["av"].push_back(vertex);
-        } else if (isClose(vertex.vert->rgb, saColor)) {
-            heartZones["sa"].push_back(vertex);
-        } else {
-            heartZones["not"].push_back(vertex);
-        }
-    }
+		if (active) {
+			float goal = active->potential ? std::clamp(active->potential[i], 0.0f, 1.0f) : active->level[active->zone[i]];
+			active->tension[i] += (goal - active->tension[i]) * active->rate;
+		}
+	});
 }
 
-void SoftBody::EvalCoupleOscillator(float t, float dt)
+// Semi-implicit Euler, external holds forces kept in a separate float array (double mode) or is null
+template<typename P>
+static void integrate(typename P::vec* position, typename P::vec* velocity, typename P::vec* force, const glm::vec3* external,
+	long count, float mass, float dt)
 {
-	// SA node variables
-	oscillator.sa.a = 3;
-	oscillator.sa.w1 = 0.2;
-	oscillator.sa.w2 = -1.9;
-	oscillator.sa.d = 3;
-	oscillator.sa.e = 4.9;
-	oscillator.sa.omega = 1;
-	oscillator.sa.q =1;
-	oscillator.sa.kSA_to_AV = 0;
-	oscillator.sa.kSA_to_HP = 0;
-	
-	// AV node variables 
-	oscillator.av.a = 3;
-	oscillator.av.w1 = 0.1;
-	oscillator.av.w2 = -0.1;
-	oscillator.av.d = 3;
-	oscillator.av.e = 3;
-	oscillator.av.omega = 0;
-	oscillator.av.q = 1;
-	oscillator.av.kAV_to_HP = 0;
-	oscillator.av.kAV_to_SA = 5;
-
-	// HPC Node
-	oscillator.hpc.a = 5;
-	oscillator.hpc.w1 = 1;
-	oscillator.hpc.w2 = -1;
-	oscillator.hpc.d = 3;
-	oscillator.hpc.e = 7;
-	oscillator.hpc.omega = 0;
-	oscillator.hpc.q = 20;
-	oscillator.hpc.kHP_to_SA = 0;
-	oscillator.hpc.kHP_to_AV = 20;
-
-	oscillator.a0 = 1;
-	oscillator.a1 = 0.1;
-	oscillator.a3 = 0.05;
-	oscillator.a5 = 0.4;
-
-	oscillator.update(t, dt, heartZones);
+	using A = typename P::accum;
+	using V = typename P::accumVec;
+
+	const A invMass = A(1) / A(mass);
+	const A step = A(dt);
+	Jobs::ParallelFor(0, count, 1024, [&](long i) {
+		V f = V(force[i]);
+		if (external) f += V(external[i]);
+		V v = V(velocity[i]) + f * invMass * step;
+		V x = V(position[i]) + v * step;
+		velocity[i] = typename P::vec(v);
+		position[i] = typename P::vec(x);
+		force[i] = typename P::vec(0);
+	});
 }
 
-/*
- * Point mass
- */
+void SoftBody::Simulate(float dt) {
+	const long count = (long)particles.size();
+
+	if (excitation) excitation->Step(dt);
+
+	// Activation for the active tension, from the excitation field or the zone oscillators
+	ActiveInput activeInput;
+	const ActiveInput* activeTerm = nullptr;
+	if (active.source != ActiveTension::Source::Off) {
+		prepareActive();
+		glm::vec2 range = active.oscillatorRange;
+		auto level = [&](double x) {
+			if (active.source != ActiveTension::Source::Oscillator || range.y == range.x) return 0.0f;
+			return std::clamp(((float)x - range.x) / (range.y - range.x), 0.0f, 1.0f);
+		};
+		activeInput.fibreScale = fibreScale.data();
+		activeInput.tension = tension.data();
+		activeInput.potential = active.source == ActiveTension::Source::Excitation && excitation ? excitation->Potential().data() : nullptr;
+		activeInput.zone = particleZone.data();
+		activeInput.level[0] = level(oscillator.sa.x);
+		activeInput.level[1] = level(oscillator.av.x);
+		activeInput.level[2] = level(oscillator.hpc.x);
+		activeInput.level[RestZone] = 0.0f;
+		activeInput.contraction = active.contraction;
+		activeInput.rate = active.timeConstant > 0.0f ? std::min(1.0f, dt / active.timeConstant) : 1.0f;
+		activeTerm = &activeInput;
+	}
 
-PointMass::PointMass(Vertex* vert, SoftBody* body, float restitution, float mass, float stiffness, float damping){
-	this->vert = vert; // Reference vertex in dynamic vertices
-	this->body = body;
+	// Spring forces in the body's precision, double mode first picks up whatever moved the float particles
+	switch (precision) {
+	case Precision::Float:
+		springForces<FloatPolicy>(*topology, particles.position.data(), particles.velocity.data(), particles.force.data(),
+			count, stiffness, damping, mass, springTerms, activeTerm);
+		break;
+	case Precision::Mixed:
+		springForces<MixedPolicy>(*topology, particles.position.data(), particles.velocity.data(), particles.force.data(),
+			count, stiffness, damping, mass, springTermsD, activeTerm);
+		break;
+	case Precision::Double:
+		pullMirror();
+		springForces<DoublePolicy>(*topology, doubleState.position.data(), doubleState.velocity.data(), doubleState.force.data(),
+			count, stiffness, damping, mass, springTermsD, activeTerm);
+		break;
+	}
 
-	this->restitution = restitution;
-	this->mass = mass;
-	this->stiffness = stiffness;
-	this->damping = damping;
+	// Keep the surface from passing through itself
+	selfCollision.Apply(topology->surface, particles);
 
-	velocity = glm::vec3(0.0);
-	acceleration = glm::vec3(0.0);
-	forces = glm::vec3(0.0);
+	// Contacts with the scene colliders, one batched pass over all particles
+	if (colliders) {
+		colliders->Resolve(particles, getTransform(), restitution, colliderScratch);
+	}
+
+	//Integrate all point masses with their forces (semi-implicit Euler)
+	switch (precision) {
+	case Precision::Float:
+		integrate<FloatPolicy>(particles.position.data(), particles.velocity.data(), particles.force.data(), nullptr, count, mass, dt);
+		break;
+	case Precision::Mixed:
+		integrate<MixedPolicy>(particles.position.data(), particles.velocity.data(), particles.force.data(), nullptr, count, mass, dt);
+		break;
+	case Precision::Double:
+		// Contact corrections and the float forces (gravity, self and inter-body contacts) join the double state here
+		pullMirror();
+		integrate<DoublePolicy>(doubleState.position.data(), doubleState.velocity.data(), doubleState.force.data(), particles.force.data(), count, mass, dt);
+		pushMirror();
+		break;
+	}
+
+	simTime += dt;
+
+	// Deformed surface needs fresh normals before the upload
+	topology->surface.RecomputeNormals(particles.position, normals, faceNormals);
 }
 
-PointMass::~PointMass() {
+void SoftBody::Upload() {
+	// Pack positions and normals straight into the mapped dynamic stream for rendering
+	if (!meshes[0].HasGLResources()) return; // loaded without GL (headless checks)
+	meshes[0].UpdateVertices(particles.position, normals);
+}
 
+void SoftBody::Reset() {
+	// Reset soft body to original state (original position included)
+	for (size_t i = 0; i < particles.size(); i++) {
+		particles.position[i] = meshes[0].Vertices()[i].position;
+		particles.velocity[i] = glm::vec3(0.0);
+		particles.force[i] = glm::vec3(0.0);
+	}
+	simTime = 0.0;
+	std::fill(tension.begin(), tension.end(), 0.0f);
+	if (excitation) excitation->Reset();
 }
 
-void PointMass::Integrate(float dt) {
+// DanielaHz implementation to visualize the springs created in the models (visual debugging)
+void SoftBody::RenderSprings(Shader& shader) {
+	// Spring endpoints live in a persistent element buffer over the streamed positions,
+	// so this is a single draw with no per-frame CPU work
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// TODO: Make floor collisions not hardcoded, add rigid->soft body collisions
-	glm::mat4 transform = body->getTransform();
-	glm::mat4 inverse = glm::inverse(transform);
+	shader.use();
 
-	glm::vec3 world = transform * glm::vec4(vert->position, 1);
+	// defining the color of the shader, lighting off so the lines show only the color
+	shader.setVec3("color", glm::vec3(1.0f));
+	shader.setBool("calculateLighting", false);
+	glLineWidth(1.0f);
 
-	if (world.y <= 0.1) {
-		velocity = glm::vec4(velocity.x, -velocity.y * restitution, velocity.z, 1);
-		vert->position.y = (inverse * glm::vec4(0, 0.1, 0, 1)).y;
-	} 
-	if (world.x <= -10) {
-		velocity = glm::vec4(-velocity.x * restitution, velocity.y, velocity.z, 1);
-		vert->position.x = (inverse * glm::vec4(-10, 0, 0, 1)).x;
-	} 
-	if (world.z >= 10) {
-		velocity = glm::vec4(velocity.x, velocity.y, -velocity.z * restitution, 1);
-		vert->position.z = (inverse * glm::vec4(0, 0, 10, 1)).z;
-	}
-	if (world.z <= -10) {
-		velocity = glm::vec4(-velocity.x, velocity.y, -velocity.z * restitution, 1);
-		vert->position.z = (inverse * glm::vec4(0, 0, -10, 1)).z;
-	}
+	meshes[0].drawLines(shader);
+}
+
+// DanielaHz Human heart processing
+void SoftBody::processMeshZones(const std::vector<Vertex>& vertices, HeartZoneMap &heartZones, const HeartZoneSettings& zones)
+{
+    float delta = zones.delta;
+
+    auto isClose = [&](const glm::vec3& a, const glm::vec3& b) {
+        return fabs(a.r - b.r) <= delta &&
+            fabs(a.g - b.g) <= delta &&
+            fabs(a.b - b.b) <= delta;
+    };
+
+    const glm::vec3& hpcColor = zones.hpc;
+    const glm::vec3& avColor  = zones.av;
+    const glm::vec3& saColor  = zones.sa;
+
+    for (unsigned int i = 0; i < vertices.size(); i++) {
+        const glm::vec3& rgb = vertices[i].rgb;
+        if (isClose(rgb, hpcColor)) {
+            heartZones["hpc"].push_back(i);
+        } else if (isClose(rgb, avColor)) {
+            heartZones["av"].push_back(i);
+        } else if (isClose(rgb, saColor)) {
+            heartZones["sa"].push_back(i);
+        } else {
+            heartZones["not"].push_back(i);
+        }
+    }
+}
 
-	acceleration = forces / mass;
-	velocity += acceleration * dt;
-	vert->position += velocity * dt;
-	forces = glm::vec3(0.0);
+void SoftBody::SetZones(const HeartZoneSettings& settings)
+{
+	if (settings == zones) return;
+	zones = settings;
+	assignZones();
+	activeTopology = nullptr; // particle zones of the active tension
 }
 
-void PointMass::VerletIntegration(float dt)
+void SoftBody::assignZones()
 {
+	const ModelAsset::MeshPart& part = asset->meshes[0];
+	heartZones = AssetCache::Get<HeartZoneMap>(assetKey + zones.Key(), [&]() {
+		std::shared_ptr<HeartZoneMap> result = std::make_shared<HeartZoneMap>();
+		const std::vector<Vertex>& vertices = *part.vertices;
+		std::vector<glm::vec3> positions(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++) positions[i] = vertices[i].position;
+
+		switch (zones.method) {
+		case HeartZoneSettings::Method::Colours:
+			if (part.hasColors) processMeshZones(vertices, *result, zones);
+			break;
+		case HeartZoneSettings::Method::Groups:
+			*result = HeartZoning::FromGroups(vertices.size(), asset->nodeGroups, zones);
+			break;
+		case HeartZoneSettings::Method::NearestSeed:
+			*result = HeartZoning::NearestSeed(positions, zones);
+			break;
+		case HeartZoneSettings::Method::Geodesic: {
+			// Neighbours along the springs, the same CSR as the force gather
+			std::vector<unsigned int> neighbours(topology->springRefs.size());
+			for (size_t r = 0; r < neighbours.size(); r++) {
+				const Spring& s = topology->springs[topology->springRefs[r] >> 1];
+				neighbours[r] = topology->springRefs[r] & 1 ? s.a : s.b;
+			}
+			*result = HeartZoning::Geodesic(positions, topology->springOffsets, neighbours, zones);
+			break;
+		}
+		}
+		return result;
+	});
+}
 
+void SoftBody::EvalCoupleOscillator(double t, float dt)
+{
+	// Parameters are set once (setDefaults, then the config file), only the state advances here. The zone
+	// sweep only runs while active tension is off: with the oscillator source the zones contract through the
+	// springs instead, with the excitation source the field drives them and the oscillator is not used.
+	switch (active.source) {
+	case ActiveTension::Source::Off:
+		oscillator.update(t, dt, *heartZones, particles);
+		break;
+	case ActiveTension::Source::Oscillator:
+		oscillator.advance(t, dt);
+		break;
+	case ActiveTension::Source::Excitation:
+		break;
+	}
 }
 
 // HUMAN HEART MECHANICS MODEL IMPLEMENTATION
-void HeartOscillatorSystem::updateHeartZones(std::vector<PointMass> heartZoneVec, double dx1, double dx2, float dt)
+void HeartOscillatorSystem::updateHeartZones(const std::vector<unsigned int>& heartZoneVec, ParticleStore& particles, double accel, float dt)
 {
-    for (auto& vertex : heartZoneVec)
+    // Every vertex appears once per zone, so the sweep can be split freely. The kick goes into the
+    // particle's own velocity and carries over to the next steps (the old PointMass copies dropped it).
+    Jobs::ParallelFor(0, (long)heartZoneVec.size(), 1024, [&](long k)
     {
-        // Calcular la fuerza aplicada al punto de masa
-        double force_x = vertex.mass * dx2;
-        double force_y = vertex.mass * dx2;
-        double force_z = vertex.mass * dx2;
+        unsigned int i = heartZoneVec[k];
 
         // Actualizar la velocidad del punto de masa
-        vertex.velocity.x += force_x / vertex.mass * dt;
-        vertex.velocity.y += force_y / vertex.mass * dt;
-        vertex.velocity.z += force_z / vertex.mass * dt;
+        particles.velocity[i] += glm::vec3((float)(accel * dt));
 
         // Actualizar la posición del punto de masa
-        vertex.vert->position.x += vertex.velocity.x * dt;
-        vertex.vert->position.y += vertex.velocity.y * dt;
-        vertex.vert->position.z += vertex.velocity.z * dt;
-    }
+        particles.position[i] += particles.velocity[i] * dt;
+    });
 }
 
-void HeartOscillatorSystem::update(float t, float dt, std::map<std::string, std::vector<PointMass>> heartZones)
+void HeartOscillatorSystem::derivatives(double t, double d[6]) const
 {
     // SA Node
     double x1 = sa.x;
@@ -379,39 +759,61 @@ void HeartOscillatorSystem::update(float t, float dt, std::map<std::string, std:
     double x3 = av.x;
     double x5 = hpc.x;
     
-    double dx1 = x2;
-    // std::cout << "printing the valie of dx1: " << dx1 << "\n";
-    double dx2 = -sa.a * x2 * (x1 - sa.w1) * (x1 - sa.w2) - x1 * (x1 + sa.d) * (x1 + sa.e) + sa.q * glm::sin(sa.omega * t) + sa.kSA_to_AV * (x1 - x3) + sa.kSA_to_HP * (x1 - x5);
-    // std::cout << "printing the value of dx2: " << dx2 << "\n";
+    d[0] = x2;
+    d[1] = -sa.a * x2 * (x1 - sa.w1) * (x1 - sa.w2) - x1 * (x1 + sa.d) * (x1 + sa.e) + sa.q * glm::sin(sa.omega * t) + sa.kSA_to_AV * (x1 - x3) + sa.kSA_to_HP * (x1 - x5);
 
     // AV Node
     double x4 = av.dx;
     double x6 = hpc.dx;
 
-    double dx3 = x4;
-    double dx4 = -av.a * x4 * (x3 - av.w1) * (x2 - av.w2) - x3 * (x3 + av.d) * (x3 + av.e) + av.q * glm::sin(av.omega * t) + av.kAV_to_SA * (x3 - x1) + av.kAV_to_HP * (x3 - x5);
+    d[2] = x4;
+    d[3] = -av.a * x4 * (x3 - av.w1) * (x2 - av.w2) - x3 * (x3 + av.d) * (x3 + av.e) + av.q * glm::sin(av.omega * t) + av.kAV_to_SA * (x3 - x1) + av.kAV_to_HP * (x3 - x5);
 
     // HisPurkinjeComplex
-    double dx5 = x6;
-    double dx6 = -hpc.a * x6 * (x5 - hpc.w1) * (x5 - hpc.w2) - x5 * (x5 + hpc.d) * (x5 + hpc.e) + hpc.q * glm::sin(hpc.omega * t) + hpc.kHP_to_SA * (x5 - x1) + hpc.kHP_to_AV * (x5 - x3);
+    d[4] = x6;
+    d[5] = -hpc.a * x6 * (x5 - hpc.w1) * (x5 - hpc.w2) - x5 * (x5 + hpc.d) * (x5 + hpc.e) + hpc.q * glm::sin(hpc.omega * t) + hpc.kHP_to_SA * (x5 - x1) + hpc.kHP_to_AV * (x5 - x3);
+}
+
+void HeartOscillatorSystem::advance(double t, double dt)
+{
+    // Semi-implicit Euler in short substeps, the HPC coupling is stiff
+    int substeps = std::max(1, (int)std::ceil(dt / maxStep));
+    double h = dt / substeps;
+    double d[6];
+    for (int s = 0; s < substeps; s++) {
+        derivatives(t + s * h, d);
+        sa.dx += h * d[1];
+        av.dx += h * d[3];
+        hpc.dx += h * d[5];
+        sa.x += h * sa.dx;
+        av.x += h * av.dx;
+        hpc.x += h * hpc.dx;
+    }
+}
+
+void HeartOscillatorSystem::update(double t, double dt, const std::map<std::string, std::vector<unsigned int>>& heartZones, ParticleStore& particles)
+{
+    double d[6];
+    derivatives(t, d);
+    double dx2 = d[1], dx4 = d[3], dx6 = d[5]; // each node's acceleration drives its zone
 
     // Procesar los vectores
     for (auto& [zone, verts] : heartZones) {
         if (zone == "sa")
         {
-            updateHeartZones(verts, dx1, dx2, dt);
+            updateHeartZones(verts, particles, dx2, dt);
         }
         else if (zone == "av")
         {
-            updateHeartZones(verts, dx3, dx4, dt);
+            updateHeartZones(verts, particles, dx4, dt);
         }
         else if (zone == "hpc")
         {
-            updateHeartZones(verts, dx5, dx6, dt);
+            updateHeartZones(verts, particles, dx6, dt);
         }
         else
         {
-            updateHeartZones(verts, dx5, dx6, dt);
+            updateHeartZones(verts, particles, dx6, dt);
         }
     }
 }
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
 #include <string>
 #include <glm/glm.hpp>
 #include "model.h"
@@ -17,13 +18,22 @@
 #include "map"
 #include "shader.h"
 #include "ThreeCoupledOscillator.h"
+#include "surface.h"
+#include "spatialHash.h"
+#include "particles.h"
+#include "precision.h"
+#include "collider.h"
+#include "monodomain.h"
+#include "sparse.h"
+#include "pseudoEcg.h"
+#include "heartZones.h"
 #include <memory>
 
 class SoftBody;
-class PointMass;
+class TrajectoryPlayer;
 struct Spring {
-	PointMass* a;
-	PointMass* b;
+	unsigned int a; // index into the body's particles
+	unsigned int b;
 	float restLength;
 };
 
@@ -38,67 +48,152 @@ struct HeartOscillatorSystem
     double a3;
     double a5;
 
-    void update(float t, float dt, std::map<std::string, std::vector<PointMass>> heartZones);
-    void updateHeartZones(std::vector<PointMass> heartZoneVec, double dx1, double dx2, float dt);
-};
-
-class PointMass {
-public:
-	PointMass(Vertex* vert, SoftBody* body, float restitution, float mass, float stiffness, float damping);
-	~PointMass();
-
-	Vertex* vert; // Pointer to vert being integrated
-	SoftBody* body;
-
-	glm::vec3 velocity;
-	glm::vec3 acceleration;
-	glm::vec3 forces;
+    double maxStep = 1e-3; // advance substep, seconds
 
-	float restitution;
-	float mass;
-	float stiffness;
-	float damping;
-
-	void Integrate(float dt);
-	void VerletIntegration(float dt);
-	void RK4Integration(float dt);
+    void update(double t, double dt, const std::map<std::string, std::vector<unsigned int>>& heartZones, ParticleStore& particles);
+    void advance(double t, double dt); // integrates the node states, which then drive active tension instead of the zone sweep
+    void derivatives(double t, double d[6]) const; // x1..x6 of the three nodes
+    void updateHeartZones(const std::vector<unsigned int>& heartZoneVec, ParticleStore& particles, double accel, float dt);
+    double getECG() const; // weighted sum of the three node states
+    void setDefaults();    // the published parameter set, the config file can override it
+};
 
-	bool operator==(const PointMass& other) const {
-		return *this == other;
+// Excitation-contraction coupling: every spring pulls its ends together along the local fibre direction,
+// scaled by the activation of its end nodes. Added to the passive spring force in the same pass.
+struct ActiveTension {
+	enum class Source { Off, Oscillator, Excitation };
+	enum class Fibres { Axis, Helical };
+
+	Source source = Source::Off;      // zone oscillator state, or the monodomain potential per node
+	float contraction = 0.15f;        // fibre shortening at full activation, fraction of the rest length
+	float timeConstant = 0.05f;       // seconds for the tension to follow the activation
+	glm::vec2 oscillatorRange = glm::vec2(0.0f, 1.0f); // oscillator states mapped to activation 0..1
+	Fibres fibres = Fibres::Helical;
+	glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f); // fibre direction (Axis) or long axis of the heart (Helical)
+	float helixAngle = 60.0f;         // Helical: degrees from circumferential towards the long axis
+
+	bool operator==(const ActiveTension& other) const
+	{
+		return source == other.source && contraction == other.contraction && timeConstant == other.timeConstant && oscillatorRange == other.oscillatorRange
+			&& fibres == other.fibres && axis == other.axis && helixAngle == other.helixAngle;
 	}
+};
 
-	bool operator!=(const PointMass& other) const {
-		return !(*this == other);
-	}
+// Rest-state structure derived from a model asset, shared by every body loaded from the same file
+struct SoftBodyTopology {
+	std::vector<Spring> springs;
+	std::vector<unsigned int> springOffsets; // CSR per particle over springRefs
+	std::vector<unsigned int> springRefs;    // spring index * 2 + (0 for end a, 1 for end b), ascending
+	SurfaceTopology surface;
+	std::shared_ptr<const std::vector<unsigned int>> drawIndices; // boundary triangles (tets) or the mesh indices
+	std::shared_ptr<const std::vector<unsigned int>> lineIndices; // spring endpoints for the debug view
+
+	size_t Bytes() const;
 };
 
 class SoftBody : public Model { 
 public:
-	SoftBody(std::string path, float restitution, float mass, float stiffness, float damping);
+	SoftBody(std::string path, float restitution, float mass, float stiffness, float damping, bool deferGL = false, Precision precision = Precision::Float,
+		const ImportOptions& options = ImportOptions());
 	~SoftBody();
 
 	float restitution;
 	float mass;
 	float stiffness;
 	float damping;
-
-	// Vertices we draw, initially set to model's verts
-	vector<Vertex> dynamicVertices;
-	vector<PointMass> pointMasses;
-	std::vector<Spring> springs;
-	std::map <int, std::vector<Spring>> uniqueConnections;
-	vector<unsigned int> indices; 
-	HeartOscillatorSystem oscillator;
-	std::map<std::string, std::vector<PointMass>> heartZones;
+	double simTime = 0.0; // seconds simulated since load (or the restored checkpoint)
+
+	// Point masses (SoA), initially set to model's verts, and the normals we draw with them
+	ParticleStore particles;
+	ParticleStoreT<double> doubleState; // Precision::Double only: the state the core integrates, particles mirror it
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec3> faceNormals; // scratch for the normal recompute
+	std::vector<glm::vec2> springTerms;   // scratch, per spring stretch and closing speed
+	std::vector<glm::dvec2> springTermsD; // the same for double accumulation
+	std::shared_ptr<const SoftBodyTopology> topology; // shared, only the state above is per instance
+	HeartOscillatorSystem oscillator{};
+	SelfCollision selfCollision;
+	ColliderSet* colliders = nullptr; // scene colliders, shared between bodies
+	ColliderScratch colliderScratch;  // this body's contact pass scratch, the set itself is read only
+	TrajectoryPlayer* playback = nullptr; // while set the world replays it instead of simulating (not owned)
+	std::unique_ptr<MonodomainSolver> excitation; // spatial excitation field on the tet nodes, stepped with the body
 
 	// validate the extension of the file
 	bool hasExtension(const std::string& path, const std::string& ext);
 
 	void AddForce(glm::vec3(force));
-	void Update(float dt);
+	void Update(float dt); // Simulate + Upload
+	void Simulate(float dt); // CPU only, safe to run off the GL thread
+	void Upload();           // GL thread only
 	void Reset();
-	void AddSpring(PointMass* a, PointMass* b);	
 	void RenderSprings(Shader& shader);
-	void EvalCoupleOscillator(float t, float dt);
-	void processMeshZones(vector<PointMass> &pointMasses, std::map<std::string,std::vector<PointMass>> &heartZones);
+	void EvalCoupleOscillator(double t, float dt);
+	static void processMeshZones(const std::vector<Vertex>& vertices, HeartZoneMap &heartZones, const HeartZoneSettings& zones = HeartZoneSettings());
+
+	// Starts the monodomain solver (tet meshes only, the operators are shared per asset), paced from the
+	// SA zone or, without zones, from the top of the mesh. Returns false for surface meshes.
+	bool EnableExcitation();
+	void DisableExcitation() { excitation.reset(); }
+
+	// Twelve lead pseudo-ECG of the excitation field, sampled at sampleRate inside its step. The lead field
+	// is built once per mesh and electrode layout. Needs EnableExcitation first.
+	bool EnableECG(const Ecg::ElectrodeLayout& layout, float sampleRate = 1000.0f);
+	void DisableECG() { if (excitation) excitation->ClearProbes(); }
+	Ecg::ElectrodeLayout StandardElectrodes(float distance = 2.0f) const; // around the rest mesh
+	void TakeECG(std::vector<double>& times, std::vector<std::array<float, Ecg::LeadCount>>& leads); // appends the new samples
+
+	// Re-assigns the zones (colours, gmsh groups or seeds), the mesh is not reloaded. Assignments are cached
+	// per mesh and settings, so every instance shares them.
+	const HeartZoneSettings& Zones() const { return zones; }
+	void SetZones(const HeartZoneSettings& settings);
+	const HeartZoneMap& ZoneMap() const { return *heartZones; }
+
+	Precision GetPrecision() const { return precision; }
+	void SetPrecision(Precision precision); // at creation, before stepping
+
+	// Active tension settings; any source stops the zone sweep, the oscillator source integrates the oscillator instead
+	const ActiveTension& Active() const { return active; }
+	void SetActiveTension(const ActiveTension& settings);
+	const std::vector<float>& Tension() const { return tension; } // per particle, empty until the first active step
+	void SetTension(std::vector<float> values) { tension = std::move(values); } // checkpoint restore
+
+	// Tangent stiffness of the springs at the current positions as 3x3 blocks per particle pair, plus shift on
+	// the diagonal (mass / dt^2 gives the system matrix of an implicit Euler step). Symmetric positive semidefinite.
+	Sparse::BsrMatrix StiffnessMatrix(float shift = 0.0f) const;
+
+	size_t InstanceBytes() const; // memory owned by this body alone
+
+	// Bytes per particle: simulated state, render-only state of this body, and the shared mesh vertex plus
+	// topology (springs, surface) that every instance of the asset splits
+	struct Footprint {
+		double physics = 0.0;
+		double render = 0.0;
+		double shared = 0.0;
+	};
+	Footprint BytesPerVertex() const;
+	uint64_t StateHash() const;   // FNV-1a over positions, velocities and sim time, for golden run checks
+
+private:
+	Precision precision = Precision::Float;
+	HeartZoneSettings zones;
+	std::shared_ptr<const HeartZoneMap> heartZones;
+	void assignZones();
+	std::string assetKey; // AssetCache key of the model, for data derived from it later
+
+	// Active tension state: per spring rest length * cos^2 of its angle to the fibres, per particle tension
+	// 0..1 and zone (sa, av, hpc, rest) for the oscillator source
+	static constexpr unsigned char RestZone = 3; // "not" and unassigned particles, never activated
+	ActiveTension active;
+	std::vector<float> fibreScale;
+	std::vector<float> tension;
+	std::vector<unsigned char> particleZone;
+	const SoftBodyTopology* activeTopology = nullptr; // topology the per spring data was built for
+	void prepareActive();
+
+	// Double mode: fold edits made to the float particles (colliders, zones, reset, restore) into the
+	// double state, and copy the double state back out after integrating
+	void pullMirror();
+	void pushMirror();
+
+	static std::shared_ptr<SoftBodyTopology> buildTopology(const ModelAsset::MeshPart& part, bool tetrahedral);
 };
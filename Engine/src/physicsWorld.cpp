@@ -0,0 +1,192 @@
+/*
+ * PHYSICS WORLD: Owns the soft bodies of a scene and steps them concurrently
+ */
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cfloat>
+#include "physicsWorld.h"
+#include "jobs.h"
+
+PhysicsWorld::~PhysicsWorld()
+{
+	for (SoftBody* body : bodies) delete body;
+}
+
+void PhysicsWorld::Add(SoftBody* body)
+{
+	body->colliders = &colliders;
+	bodies.push_back(body);
+	scratch.resize(bodies.size());
+	accumulated = Stats();
+	steps = 0;
+}
+
+void PhysicsWorld::Remove(SoftBody* body)
+{
+	auto it = std::find(bodies.begin(), bodies.end(), body);
+	if (it == bodies.end()) return;
+	bodies.erase(it);
+	scratch.resize(bodies.size());
+	accumulated = Stats();
+	steps = 0;
+	delete body;
+}
+
+uint64_t PhysicsWorld::StateHash() const
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (const SoftBody* body : bodies) {
+		hash ^= body->StateHash();
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+void PhysicsWorld::Step(float dt)
+{
+	const long count = (long)bodies.size();
+	last.bodyMs.assign(count, 0.0);
+	last.contacts = 0;
+
+	// Phase 1: one job per body, a body only touches its own particles and its inner
+	// parallel loops spread over whatever workers are free
+	auto t0 = std::chrono::high_resolution_clock::now();
+	std::vector<Jobs::Handle> bodyJobs;
+	bodyJobs.reserve(count);
+	for (long i = 0; i < count; i++) {
+		if (bodies[i]->playback) continue; // replaying a recording, nothing to simulate
+		bodyJobs.push_back(Jobs::Submit([this, i, dt]() {
+			auto start = std::chrono::high_resolution_clock::now();
+			bodies[i]->AddForce(gravity);
+			bodies[i]->Simulate(dt);
+			last.bodyMs[i] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}));
+	}
+
+	// Phase 2: depends on every body's new positions, forces are picked up by the next step
+	std::chrono::high_resolution_clock::time_point t1;
+	Jobs::Handle collision = Jobs::Submit([this, count, &t1]() {
+		t1 = std::chrono::high_resolution_clock::now();
+		if (interBodyCollision && count > 1) {
+			last.contacts = collideBodies();
+		}
+	}, bodyJobs);
+	Jobs::Wait(collision);
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	// Phase 3: GL uploads stay on the calling thread, playback uploads a frame its decoder has ready
+	for (SoftBody* body : bodies) {
+		if (body->playback) {
+			body->playback->Advance(dt);
+			body->playback->Present(body->meshes[0]);
+		}
+		else body->Upload();
+	}
+	auto t3 = std::chrono::high_resolution_clock::now();
+
+	last.bodiesMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	last.collisionMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	last.uploadMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+
+	if (reportInterval > 0) report();
+}
+
+size_t PhysicsWorld::collideBodies()
+{
+	const long count = (long)bodies.size();
+
+	// World space positions and bounds per body
+	Jobs::ParallelFor(0, count, 1, [&](long i) {
+		SoftBody* body = bodies[i];
+		BodyScratch& s = scratch[i];
+		glm::mat4 transform = body->getTransform();
+		glm::mat3 linear(transform);
+		s.toLocal = glm::inverse(linear);
+
+		glm::vec3 scale(glm::length(linear[0]), glm::length(linear[1]), glm::length(linear[2]));
+		s.thickness = body->selfCollision.thickness * std::max(scale.x, std::max(scale.y, scale.z));
+
+		const std::vector<glm::vec3>& local = body->particles.position;
+		s.world.resize(local.size());
+		s.lo = glm::vec3(FLT_MAX);
+		s.hi = glm::vec3(-FLT_MAX);
+		for (unsigned int v : body->topology->surface.vertices) {
+			glm::vec3 p = glm::vec3(transform * glm::vec4(local[v], 1.0f));
+			s.world[v] = p;
+			s.lo = glm::min(s.lo, p);
+			s.hi = glm::max(s.hi, p);
+		}
+		s.hashed = false;
+	});
+
+	// Broad phase on the body bounds, then hash the triangles of every body that is hit
+	std::vector<std::pair<long, long>> pairs;
+	for (long a = 0; a < count; a++) {
+		for (long b = 0; b < count; b++) {
+			if (a == b || bodies[a]->playback || bodies[b]->playback) continue;
+			const BodyScratch& sa = scratch[a];
+			const BodyScratch& sb = scratch[b];
+			float pad = std::max(sa.thickness, sb.thickness);
+			if (glm::any(glm::greaterThan(sa.lo, sb.hi + pad)) || glm::any(glm::greaterThan(sb.lo, sa.hi + pad))) continue;
+			pairs.emplace_back(a, b);
+		}
+	}
+	if (pairs.empty()) return 0;
+
+	float maxThickness = 0.0f;
+	for (long i = 0; i < count; i++) maxThickness = std::max(maxThickness, scratch[i].thickness);
+
+	for (const auto& pair : pairs) {
+		BodyScratch& sb = scratch[pair.second];
+		if (sb.hashed) continue;
+		sb.hash.cellSize = sb.thickness > 0.0f ? sb.thickness * 4.0f : 1.0f; // mean edge, as in SelfCollision
+		sb.hash.Build(bodies[pair.second]->topology->surface, sb.world, maxThickness);
+		sb.hashed = true;
+	}
+
+	// Narrow phase: vertices of a against the triangles of b, a gets the contact forces and b's triangles the
+	// reactions, so pairs are run one after another with the vertex loop parallel inside
+	size_t contacts = 0;
+	for (const auto& pair : pairs) {
+		SoftBody* a = bodies[pair.first];
+		SoftBody* b = bodies[pair.second];
+		const BodyScratch& sa = scratch[pair.first];
+		const BodyScratch& sb = scratch[pair.second];
+		float thickness = std::max(sa.thickness, sb.thickness);
+		float stiffness = std::min(a->selfCollision.stiffness, b->selfCollision.stiffness);
+
+		contacts += AccumulateRepulsion(sb.hash, b->topology->surface.triangles.data(), sb.world.data(),
+			a->topology->surface.vertices, sa.world.data(), nullptr, thickness, stiffness, sa.toLocal, a->particles.force.data(),
+			sb.toLocal, b->particles.force.data(), contactScratch);
+	}
+	return contacts;
+}
+
+void PhysicsWorld::report()
+{
+	if (accumulated.bodyMs.size() != last.bodyMs.size()) accumulated.bodyMs.assign(last.bodyMs.size(), 0.0);
+	for (size_t i = 0; i < last.bodyMs.size(); i++) accumulated.bodyMs[i] += last.bodyMs[i];
+	accumulated.bodiesMs += last.bodiesMs;
+	accumulated.collisionMs += last.collisionMs;
+	accumulated.uploadMs += last.uploadMs;
+	accumulated.contacts += last.contacts;
+	if (++steps < reportInterval) return;
+
+	double serialMs = 0.0;
+	std::cout << "::PHYSICS WORLD:: bodies: " << bodies.size() << std::endl;
+	for (size_t i = 0; i < accumulated.bodyMs.size(); i++) {
+		std::cout << "  body " << i << ": " << accumulated.bodyMs[i] / steps << " ms" << std::endl;
+		serialMs += accumulated.bodyMs[i] / steps;
+	}
+	double bodiesMs = accumulated.bodiesMs / steps;
+	std::cout << "  bodies (concurrent): " << bodiesMs << " ms"
+		<< " speedup: " << (bodiesMs > 0.0 ? serialMs / bodiesMs : 0.0) << "x" << std::endl;
+	std::cout << "  inter-body collision: " << accumulated.collisionMs / steps << " ms"
+		<< " contacts: " << accumulated.contacts / steps << std::endl;
+	std::cout << "  upload: " << accumulated.uploadMs / steps << " ms" << std::endl;
+
+	accumulated = Stats();
+	steps = 0;
+}
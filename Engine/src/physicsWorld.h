@@ -0,0 +1,68 @@
+/*
+ * PHYSICS WORLD: Owns the soft bodies of a scene and steps them concurrently
+ */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "physics.h"
+#include "collider.h"
+#include "spatialHash.h"
+#include "playback.h"
+
+class PhysicsWorld {
+public:
+	PhysicsWorld() = default;
+	PhysicsWorld(const PhysicsWorld&) = delete;
+	PhysicsWorld& operator=(const PhysicsWorld&) = delete;
+	~PhysicsWorld();
+
+	ColliderSet colliders;                                // shared by every body
+	glm::vec3 gravity = glm::vec3(0.0f, -2.0f, 0.0f);     // added to every particle each step
+	bool interBodyCollision = true;
+
+	// Step timings for benchmarking, averaged every reportInterval steps (0 = no report)
+	struct Stats {
+		std::vector<double> bodyMs; // per body simulate time, runs concurrently
+		double bodiesMs = 0.0;      // wall time of the concurrent phase
+		double collisionMs = 0.0;   // inter-body phase, runs after every body finished
+		double uploadMs = 0.0;
+		size_t contacts = 0;
+	};
+	Stats last;
+	int reportInterval = 0;
+
+	// The world takes ownership, Remove deletes the body
+	void Add(SoftBody* body);
+	void Remove(SoftBody* body);
+	const std::vector<SoftBody*>& Bodies() const { return bodies; }
+
+	// Combined SoftBody::StateHash of every body in order, equal across thread counts for the same inputs
+	uint64_t StateHash() const;
+
+	// Simulates every body as its own task, then resolves body-body contacts and uploads on the calling (GL) thread.
+	// Bodies with a playback attached are not simulated, their recorded frames are uploaded instead.
+	void Step(float dt);
+
+private:
+	std::vector<SoftBody*> bodies;
+
+	// Per body scratch for the inter-body phase, world space
+	struct BodyScratch {
+		std::vector<glm::vec3> world;
+		glm::vec3 lo, hi;
+		glm::mat3 toLocal;
+		float thickness;
+		SpatialHash hash;
+		bool hashed;
+	};
+	std::vector<BodyScratch> scratch;
+	RepulsionScratch contactScratch; // reused by every pair, they run one after another
+
+	Stats accumulated;
+	int steps = 0;
+
+	size_t collideBodies();
+	void report();
+};
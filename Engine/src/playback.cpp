@@ -0,0 +1,182 @@
+/*
+ * PLAYBACK: Replays a recorded trajectory on a soft body's mesh instead of simulating it
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include "playback.h"
+#include "physics.h"
+
+TrajectoryPlayer::~TrajectoryPlayer()
+{
+	Close();
+}
+
+bool TrajectoryPlayer::Open(const std::string& path, const SoftBody& body)
+{
+	Close();
+	if (!reader.Open(path)) return false;
+	if (reader.ParticleCount() != body.particles.size() || reader.FrameCount() == 0) {
+		std::cout << "ERROR::PLAYBACK::" << path << " was not recorded from this mesh" << std::endl;
+		reader.Close();
+		return false;
+	}
+
+	topology = body.topology;
+	slots.assign(prefetch + 2, Slot()); // the window plus room for the frame on screen
+	for (Slot& slot : slots) {
+		slot.positions.resize(reader.ParticleCount());
+		slot.normals.resize(reader.ParticleCount());
+	}
+	clock = 0.0;
+	shown = SIZE_MAX;
+	wanted = 0;
+	schedule();
+
+	std::cout << "::PLAYBACK:: " << path << ", " << reader.FrameCount() << " frames, " << Duration() << " s" << std::endl;
+	return true;
+}
+
+void TrajectoryPlayer::Close()
+{
+	Jobs::Wait(decoding);
+	decoding.reset();
+	reader.Close();
+	slots.clear();
+	topology.reset();
+	shown = SIZE_MAX;
+}
+
+double TrajectoryPlayer::Duration() const
+{
+	if (!Playing()) return 0.0;
+	return reader.FrameTime(reader.FrameCount() - 1) - reader.FrameTime(0);
+}
+
+size_t TrajectoryPlayer::frameAt(double time) const
+{
+	// Last frame recorded at or before the clock (the index is sorted by time)
+	size_t lo = 0, hi = reader.FrameCount();
+	double start = reader.FrameTime(0);
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+		if (reader.FrameTime(mid) - start <= time) lo = mid;
+		else hi = mid;
+	}
+	return lo;
+}
+
+bool TrajectoryPlayer::window(size_t k, size_t& frame) const
+{
+	long count = (long)reader.FrameCount();
+	long f = (long)wanted + direction * (long)k;
+	if (f < 0 || f >= count) {
+		if (!loop) return false;
+		f = ((f % count) + count) % count;
+	}
+	frame = (size_t)f;
+	return true;
+}
+
+void TrajectoryPlayer::Seek(double time)
+{
+	if (!Playing()) return;
+	clock = std::clamp(time, 0.0, Duration());
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		wanted = frameAt(clock);
+	}
+	schedule();
+}
+
+void TrajectoryPlayer::Advance(float dt)
+{
+	if (!Playing()) return;
+	if (!paused) clock += dt * rate;
+
+	double duration = Duration();
+	if (clock < 0.0 || clock > duration) {
+		if (loop && duration > 0.0) clock = std::fmod(std::fmod(clock, duration) + duration, duration);
+		else clock = std::clamp(clock, 0.0, duration);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		wanted = frameAt(clock);
+		direction = rate < 0.0 ? -1 : 1;
+	}
+	schedule();
+}
+
+bool TrajectoryPlayer::Present(Mesh& mesh)
+{
+	if (!Playing()) return false;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (shown == wanted) return false;
+	for (Slot& slot : slots) {
+		if (slot.ready && slot.frame == wanted) {
+			mesh.UpdateVertices(slot.positions, slot.normals);
+			shown = slot.frame;
+			shownHeader = slot.header;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TrajectoryPlayer::schedule()
+{
+	// One decoder at a time, it keeps going until the window is full
+	if (decoding && !decoding->done) return;
+	decoding = Jobs::SubmitBackground([this]() { decode(); });
+}
+
+void TrajectoryPlayer::decode()
+{
+	while (true) {
+		Slot* target = nullptr;
+		size_t frame = SIZE_MAX;
+		int ahead = 1;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			// First frame of the window that no slot holds yet
+			size_t k = 0;
+			for (; k < prefetch && window(k, frame); k++) {
+				bool held = std::any_of(slots.begin(), slots.end(), [&](const Slot& slot) { return slot.frame == frame; });
+				if (!held) break;
+			}
+			if (k == prefetch || !window(k, frame)) return;
+
+			// Reuse a slot outside the window, never the one on screen
+			for (Slot& slot : slots) {
+				bool inWindow = false;
+				size_t f;
+				for (size_t j = 0; j < prefetch && window(j, f); j++) inWindow |= slot.frame == f;
+				if (!inWindow && slot.frame != shown) {
+					target = &slot;
+					break;
+				}
+			}
+			if (!target) return;
+			target->frame = frame;
+			target->ready = false;
+			ahead = direction;
+		}
+
+		// Page in what comes after this frame while decoding it
+		if (ahead > 0) reader.Prefetch(frame + 1, prefetch);
+		else reader.Prefetch(frame - std::min(frame, prefetch), prefetch);
+		bool ok = reader.Read(frame, target->positions.data(), &target->header);
+		if (ok) topology->surface.RecomputeNormals(target->positions, target->normals, target->faceNormals);
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (!ok) {
+			target->frame = SIZE_MAX;
+			return;
+		}
+		target->ready = true;
+	}
+}
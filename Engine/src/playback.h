@@ -0,0 +1,78 @@
+/*
+ * PLAYBACK: Replays a recorded trajectory on a soft body's mesh instead of simulating it
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "jobs.h"
+#include "trajectory.h"
+
+class Mesh;
+class SoftBody;
+struct SoftBodyTopology;
+
+// Frames are decoded (and their normals rebuilt) by a background job into a small ring of slots a few frames
+// ahead of the playback clock. The main thread only advances the clock and uploads a slot that is already
+// decoded, if the decoder falls behind the previous frame stays on screen.
+class TrajectoryPlayer {
+public:
+	double rate = 1.0;   // playback speed, negative plays backwards
+	bool loop = true;
+	bool paused = false;
+	size_t prefetch = 8; // frames decoded ahead of the clock
+
+	TrajectoryPlayer() = default;
+	TrajectoryPlayer(const TrajectoryPlayer&) = delete;
+	TrajectoryPlayer& operator=(const TrajectoryPlayer&) = delete;
+	~TrajectoryPlayer();
+
+	// The recording must have been made from a body with the same topology
+	bool Open(const std::string& path, const SoftBody& body);
+	void Close();
+	bool Playing() const { return reader.FrameCount() != 0; }
+
+	double Time() const { return clock; } // seconds from the first frame
+	double Duration() const;
+	size_t Frame() const { return shown; } // last frame uploaded
+	const Trajectory::FrameHeader& Shown() const { return shownHeader; } // its time, oscillator state and ECG
+
+	void Seek(double time);
+
+	// Main thread: moves the clock by dt * rate and keeps the decoder ahead of it
+	void Advance(float dt);
+
+	// Main thread: uploads the frame under the clock if it is decoded, returns false if nothing new was drawn
+	bool Present(Mesh& mesh);
+
+private:
+	struct Slot {
+		size_t frame = SIZE_MAX;
+		bool ready = false;
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec3> faceNormals;
+		Trajectory::FrameHeader header;
+	};
+
+	Trajectory::Reader reader; // decoder job only, after Open
+	std::shared_ptr<const SoftBodyTopology> topology;
+	std::vector<Slot> slots;
+	std::mutex lock;       // guards slots and wanted
+	size_t wanted = 0;     // frame under the clock
+	int direction = 1;
+	Jobs::Handle decoding;
+
+	double clock = 0.0;
+	size_t shown = SIZE_MAX;
+	Trajectory::FrameHeader shownHeader;
+
+	size_t frameAt(double time) const;
+	bool window(size_t k, size_t& frame) const; // k-th frame ahead of wanted, false past the end
+	void schedule();
+	void decode();
+};
@@ -0,0 +1,33 @@
+/*
+ * PRECISION: Scalar policies for the physics core, the type particles are stored in and the type sums run in
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+enum class Precision {
+	Float,  // float storage and arithmetic
+	Double, // double storage and arithmetic, the float particles mirror it
+	Mixed   // float storage, spring sums and integration in double
+};
+
+template<typename Storage, typename Accum>
+struct PrecisionPolicy {
+	using storage = Storage;
+	using accum = Accum;
+	using vec = glm::vec<3, Storage>;
+	using accumVec = glm::vec<3, Accum>;
+};
+
+using FloatPolicy = PrecisionPolicy<float, float>;
+using DoublePolicy = PrecisionPolicy<double, double>;
+using MixedPolicy = PrecisionPolicy<float, double>;
+
+inline const char* PrecisionName(Precision precision) {
+	switch (precision) {
+	case Precision::Double: return "double";
+	case Precision::Mixed: return "mixed";
+	default: return "float";
+	}
+}
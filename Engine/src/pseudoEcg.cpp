@@ -0,0 +1,138 @@
+/*
+ * PSEUDO ECG: Twelve lead ECG of the transmembrane potential through precomputed lead fields
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include "pseudoEcg.h"
+
+namespace Ecg {
+	const char* LeadName(int lead)
+	{
+		static const char* names[LeadCount] = { "I", "II", "III", "aVR", "aVL", "aVF", "V1", "V2", "V3", "V4", "V5", "V6" };
+		return lead >= 0 && lead < LeadCount ? names[lead] : "?";
+	}
+
+	const char* ElectrodeName(int electrode)
+	{
+		static const char* names[ElectrodeCount] = { "RA", "LA", "LL", "V1", "V2", "V3", "V4", "V5", "V6" };
+		return electrode >= 0 && electrode < ElectrodeCount ? names[electrode] : "?";
+	}
+
+	ElectrodeLayout ElectrodeLayout::Standard(glm::vec3 min, glm::vec3 max, float distance)
+	{
+		// Directions from the heart, x left, y up, z anterior
+		static const glm::vec3 directions[ElectrodeCount] = {
+			glm::vec3(-1.0f, 0.8f, 0.3f),  // RA
+			glm::vec3(1.0f, 0.8f, 0.3f),   // LA
+			glm::vec3(0.4f, -1.5f, 0.3f),  // LL
+			glm::vec3(-0.25f, 0.1f, 1.0f), // V1, fourth intercostal space right of the sternum
+			glm::vec3(0.25f, 0.1f, 1.0f),  // V2
+			glm::vec3(0.6f, 0.0f, 0.85f),  // V3
+			glm::vec3(0.85f, -0.1f, 0.6f), // V4, midclavicular line
+			glm::vec3(1.0f, -0.1f, 0.25f), // V5
+			glm::vec3(1.05f, -0.1f, -0.1f) // V6, midaxillary line
+		};
+		glm::vec3 centre = 0.5f * (min + max);
+		float radius = 0.5f * glm::length(max - min);
+
+		ElectrodeLayout layout;
+		for (int e = 0; e < ElectrodeCount; e++) {
+			float reach = distance * radius * (e <= LL ? 2.0f : 1.0f);
+			layout.positions[e] = centre + glm::normalize(directions[e]) * reach;
+		}
+		return layout;
+	}
+
+	std::string ElectrodeLayout::Key() const
+	{
+		std::ostringstream key;
+		key << "#ecg";
+		for (const glm::vec3& p : positions) key << ":" << p.x << "," << p.y << "," << p.z;
+		return key.str();
+	}
+
+	std::shared_ptr<LeadField> LeadField::Build(const std::vector<glm::vec3>& nodes, const std::vector<std::array<int, 4>>& tetrahedra,
+		const ElectrodeLayout& layout, float conductivity)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::shared_ptr<LeadField> result = std::make_shared<LeadField>();
+		LeadField& field = *result;
+		field.nodes = nodes.size();
+
+		// w_ei += -V / (4 pi sigma) * grad(phi_i) . (x_e - c) / |x_e - c|^3 over the tets around node i, in double
+		std::vector<double> weights(nodes.size() * ElectrodeCount, 0.0);
+		const double scale = -1.0 / (4.0 * 3.14159265358979323846 * conductivity);
+		for (const std::array<int, 4>& tet : tetrahedra) {
+			glm::dvec3 p0 = nodes[tet[0]];
+			glm::dmat3 J = glm::dmat3(glm::dvec3(nodes[tet[1]]) - p0, glm::dvec3(nodes[tet[2]]) - p0, glm::dvec3(nodes[tet[3]]) - p0);
+			double volume = std::abs(glm::determinant(J)) / 6.0;
+			if (volume < 1e-18) continue;
+
+			glm::dmat3 inverse = glm::inverse(J);
+			glm::dvec3 gradient[4];
+			for (int i = 0; i < 3; i++) gradient[i + 1] = glm::dvec3(inverse[0][i], inverse[1][i], inverse[2][i]);
+			gradient[0] = -(gradient[1] + gradient[2] + gradient[3]);
+			glm::dvec3 centroid = (p0 + glm::dvec3(nodes[tet[1]]) + glm::dvec3(nodes[tet[2]]) + glm::dvec3(nodes[tet[3]])) * 0.25;
+
+			for (int e = 0; e < ElectrodeCount; e++) {
+				glm::dvec3 r = glm::dvec3(layout.positions[e]) - centroid;
+				double distance = glm::length(r);
+				if (distance < 1e-9) continue; // electrode inside the tissue
+				glm::dvec3 lead = r * (scale * volume / (distance * distance * distance));
+				for (int i = 0; i < 4; i++) weights[(size_t)tet[i] * ElectrodeCount + e] += glm::dot(gradient[i], lead);
+			}
+		}
+		field.weights.assign(weights.begin(), weights.end());
+
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "::LEAD FIELD:: nodes: " << field.nodes << ", electrodes: " << ElectrodeCount << ", " << field.Bytes() / 1024
+			<< " KB, built in " << ms << " ms" << std::endl;
+		return result;
+	}
+
+	std::array<float, LeadCount> Leads(const float* electrodes)
+	{
+		float ra = electrodes[RA], la = electrodes[LA], ll = electrodes[LL];
+		float wilson = (ra + la + ll) / 3.0f;
+
+		std::array<float, LeadCount> leads;
+		leads[0] = la - ra;
+		leads[1] = ll - ra;
+		leads[2] = ll - la;
+		leads[3] = ra - 0.5f * (la + ll);
+		leads[4] = la - 0.5f * (ra + ll);
+		leads[5] = ll - 0.5f * (ra + la);
+		for (int v = 0; v < 6; v++) leads[6 + v] = electrodes[V1 + v] - wilson;
+		return leads;
+	}
+
+	bool Writer::Open(const std::string& path)
+	{
+		Close();
+		out.open(path, std::ios::trunc);
+		if (!out) {
+			std::cout << "ERROR::ECG::Could not open " << path << std::endl;
+			return false;
+		}
+		out << "time";
+		for (int lead = 0; lead < LeadCount; lead++) out << "," << LeadName(lead);
+		out << "\n";
+		return true;
+	}
+
+	void Writer::Write(double time, const std::array<float, LeadCount>& leads)
+	{
+		if (!out.is_open()) return;
+		out << time;
+		for (float value : leads) out << "," << value;
+		out << "\n";
+	}
+
+	void Writer::Close()
+	{
+		if (out.is_open()) out.close();
+	}
+}
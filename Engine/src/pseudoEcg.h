@@ -0,0 +1,58 @@
+/*
+ * PSEUDO ECG: Twelve lead ECG of the transmembrane potential through precomputed lead fields
+ */
+
+#pragma once
+
+#include <array>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace Ecg {
+	enum Electrode { RA, LA, LL, V1, V2, V3, V4, V5, V6, ElectrodeCount };
+	constexpr int LeadCount = 12;
+
+	const char* LeadName(int lead); // I, II, III, aVR, aVL, aVF, V1..V6
+	const char* ElectrodeName(int electrode);
+
+	// Electrode positions in the mesh's model space
+	struct ElectrodeLayout {
+		std::array<glm::vec3, ElectrodeCount> positions{};
+
+		// Limb leads and the precordial arc placed around the bounding box, distance in half diagonals from the
+		// centre (limbs twice as far). The mesh is assumed y up (head) and z anterior, x to the patient's left.
+		static ElectrodeLayout Standard(glm::vec3 min, glm::vec3 max, float distance = 2.0f);
+		std::string Key() const; // AssetCache key suffix
+	};
+
+	// phi_e = -1/(4 pi sigma) * integral grad(Vm) . grad(1/r) dV. Gradients are constant per linear tet and
+	// 1/r is taken at its centroid, so every electrode is a fixed weighted sum of the nodal potentials.
+	struct LeadField {
+		size_t nodes = 0;
+		std::vector<float> weights; // ElectrodeCount per node, node major so a sample is one pass over the nodes
+
+		static std::shared_ptr<LeadField> Build(const std::vector<glm::vec3>& nodes, const std::vector<std::array<int, 4>>& tetrahedra,
+			const ElectrodeLayout& layout, float conductivity = 1.0f);
+		size_t Bytes() const { return weights.size() * sizeof(float); }
+	};
+
+	// Bipolar limb leads, augmented leads and V1-V6 against the Wilson central terminal
+	std::array<float, LeadCount> Leads(const float* electrodes);
+
+	// CSV of the leads, one line per sample: time in seconds, then the twelve leads
+	class Writer {
+	public:
+		~Writer() { Close(); }
+
+		bool Open(const std::string& path);
+		void Write(double time, const std::array<float, LeadCount>& leads);
+		void Close();
+		bool Recording() const { return out.is_open(); }
+
+	private:
+		std::ofstream out;
+	};
+}
@@ -23,6 +23,7 @@ namespace Renderer {
     Model* light;
     Model* plane;
     SoftBody* body = nullptr;
+    unsigned int frameUBO = 0;
 
     void Setup() {
         camera = new Camera();
@@ -41,67 +42,59 @@ namespace Renderer {
         // Use default shader
         shader->use();
 
+        // Camera and light data are uploaded once per frame into a uniform buffer
+        glGenBuffers(1, &frameUBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UBO_BINDING, frameUBO);
+
         // Enable openGL color/alpha blending.
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
 
-    void Draw(Model* light, vector<Model*> scene) {
-        // Check we have a light and models
-        assert(light != nullptr && "ERROR: No light provided!");
-        assert(scene.size() > 0 && "ERROR: Scene is empty!");
+    void Draw(Model* light, const vector<Model*>& scene) {
+        // Light and models may still be loading, camera and shader come from Setup
         assert(camera != nullptr && "ERROR: Camera is null!");
         assert(shader != nullptr && "ERROR: Shader is null!");
 
         // BG and clearing buffers
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Projection matrix
-        float fov = glm::radians(camera->Zoom);
         float aspectRatio = (float)windowWidth / (float)windowHeight;
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera->Zoom), aspectRatio, 0.1f, 100.0f);
-
-        // View matrix
-        glm::mat4 view = camera->GetViewMatrix();
-
-        // Uniforms
-        int transformLoc = glGetUniformLocation(shader->ID, "transform");
-        int modelViewLoc = glGetUniformLocation(shader->ID, "view");
-        int modelViewPosLoc = glGetUniformLocation(shader->ID, "viewPos");
-        int modelProjectionLoc = glGetUniformLocation(shader->ID, "projection");
-        int boolLoc = glGetUniformLocation(shader->ID, "calculateLighting");
-        int colorLoc = glGetUniformLocation(shader->ID, "color");
-
-        // Update light translate, send to uniform
-        glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(light->getTransform()));
-
-        // Update light color, enable rendering calculations 
-        glUniform3f(colorLoc, light->color.x, light->color.y, light->color.z);
-        glUniform1i(boolLoc, 0);
-
-        int lightPosLoc = glGetUniformLocation(shader->ID, "lightPos");
-        glUniform3f(lightPosLoc, light->p.x, light->p.y, light->p.z);// Set light position.
-        light->draw(*shader);
+        // Frame uniforms: view, projection, camera and light position
+        FrameUniforms frame;
+        frame.view = camera->GetViewMatrix();
+        frame.projection = glm::perspective(glm::radians(camera->Zoom), aspectRatio, 0.1f, 100.0f);
+        frame.viewPos = glm::vec4(camera->Position, 1.0f);
+        frame.lightPos = glm::vec4(light ? light->p : glm::vec3(0.0f), 1.0f);
+
+        glBindBuffer(GL_UNIFORM_BUFFER, frameUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+
+        // Light: per object data only, no lighting calculations (may still be loading)
+        if (light) {
+            shader->setMat4("transform", light->getTransform());
+            shader->setVec3("color", light->color);
+            shader->setBool("calculateLighting", false);
+            light->draw(*shader);
+        }
 
         // Render all other objects in the scene
+        shader->setBool("calculateLighting", true);
         for (Model* model : scene) {
-            glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(model->getTransform()));
-            glUniformMatrix4fv(modelViewLoc, 1, GL_FALSE, glm::value_ptr(view));
-            glUniformMatrix4fv(modelProjectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
             // Send model data
-            glUniform3f(colorLoc, model->color.x, model->color.y, model->color.z);
-            glUniform3f(modelViewPosLoc, camera->Position.x, camera->Position.y, camera->Position.z);
-            glUniform1i(boolLoc, 1);
+            shader->setMat4("transform", model->getTransform());
+            shader->setVec3("color", model->color);
 
             // Render model
             model->draw(*shader);    
         }
 
-        if (body && !body->springs.empty()) {
+        if (body && !body->topology->springs.empty()) {
             body->RenderSprings(*shader);
         }        
     }
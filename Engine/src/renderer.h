@@ -15,10 +15,19 @@
 #include "physics.h"
 
 namespace Renderer {
+	// Per-frame data shared by every draw, mirrors the std140 FrameData block in the shaders
+	struct FrameUniforms {
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::vec4 viewPos;
+		glm::vec4 lightPos;
+	};
+	const unsigned int FRAME_UBO_BINDING = 0;
+
 	extern Camera* camera;
 	extern Shader* shader;
 	extern SoftBody* body;
 
 	void Setup();
-	void Draw(Model* light, vector<Model*> scene);
+	void Draw(Model* light, const vector<Model*>& scene);
 }
\ No newline at end of file
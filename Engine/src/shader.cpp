@@ -106,6 +106,8 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
     glDeleteShader(vertex);
     glDeleteShader(fragment);
 
+    reflectUniforms();
+
     cout << "Loaded and compiled: " << vertexPath << endl;
     cout << "Loaded and compiled: " << fragmentPath << endl << endl;
 }
@@ -118,17 +120,59 @@ void Shader::stop() {
     glUseProgram(0);
 }
 
+void Shader::reflectUniforms()
+{
+    // Cache every active uniform so draws never call glGetUniformLocation
+    int count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+    std::string name(maxLength, '\0');
+    for (int i = 0; i < count; i++) {
+        int length = 0, size = 0;
+        GLenum type;
+        glGetActiveUniform(ID, i, maxLength, &length, &size, &type, &name[0]);
+
+        // Uniform block members have no location, they're set through their buffer
+        std::string uniformName = name.substr(0, length);
+        int location = glGetUniformLocation(ID, uniformName.c_str());
+        if (location < 0) continue;
+
+        // Arrays are reported as "name[0]", make them reachable by their plain name too
+        if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0) {
+            uniforms[uniformName.substr(0, uniformName.size() - 3)] = location;
+        }
+        uniforms[uniformName] = location;
+    }
+}
+
+int Shader::location(const std::string& name) const
+{
+    auto it = uniforms.find(name);
+    return it != uniforms.end() ? it->second : -1;
+}
+
 void Shader::setBool(const std::string& name, bool value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(location(name), (int)value);
 }
 
 void Shader::setInt(const std::string& name, int value) const
 {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(location(name), value);
 }
 
 void Shader::setFloat(const std::string& name, float value) const
 {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(location(name), value);
+}
+
+void Shader::setVec3(const std::string& name, const glm::vec3& value) const
+{
+    glUniform3f(location(name), value.x, value.y, value.z);
+}
+
+void Shader::setMat4(const std::string& name, const glm::mat4& value) const
+{
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, &value[0][0]);
 }
\ No newline at end of file
@@ -11,6 +11,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <glm/glm.hpp>
 
 class Shader
 {
@@ -26,8 +28,18 @@ public:
     // stop using the shader (set to 0)
     void stop();
 
+    // location of an active uniform, -1 if the program doesn't use it
+    int location(const std::string& name) const;
+
     // utility uniform functions
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
     void setFloat(const std::string& name, float value) const;
+    void setVec3(const std::string& name, const glm::vec3& value) const;
+    void setMat4(const std::string& name, const glm::mat4& value) const;
+
+private:
+    // active uniforms reflected once after linking
+    std::unordered_map<std::string, int> uniforms;
+    void reflectUniforms();
 };
\ No newline at end of file
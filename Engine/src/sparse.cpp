@@ -0,0 +1,504 @@
+/*
+ * SPARSE: Sparse matrices (CSR, 3x3 block BSR, SELL-C-sigma), parallel products and preconditioned CG
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include "sparse.h"
+#include "jobs.h"
+
+namespace Sparse {
+	// Rows per chunk, about 2 KB of row offsets plus their entries per task
+	static constexpr long rowGrain = 512;
+
+	// Vector operations in CG
+	static constexpr long vectorGrain = 8192;
+
+	long CsrMatrix::Find(unsigned int row, unsigned int col) const
+	{
+		const unsigned int* begin = columns.data() + rowOffsets[row];
+		const unsigned int* end = columns.data() + rowOffsets[row + 1];
+		const unsigned int* it = std::lower_bound(begin, end, col);
+		if (it == end || *it != col) return -1;
+		return (long)(it - columns.data());
+	}
+
+	long BsrMatrix::Find(unsigned int row, unsigned int col) const
+	{
+		const unsigned int* begin = columns.data() + rowOffsets[row];
+		const unsigned int* end = columns.data() + rowOffsets[row + 1];
+		const unsigned int* it = std::lower_bound(begin, end, col);
+		if (it == end || *it != col) return -1;
+		return (long)(it - columns.data());
+	}
+
+	CsrMatrix PatternFromEdges(size_t n, std::vector<std::pair<unsigned int, unsigned int>> edges)
+	{
+		// Both directions plus the diagonal, sorted once so rows come out with ascending columns
+		for (auto& edge : edges) {
+			if (edge.first > edge.second) std::swap(edge.first, edge.second);
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+		CsrMatrix A;
+		A.rows = A.cols = n;
+		A.rowOffsets.assign(n + 1, 0);
+		for (size_t i = 0; i < n; i++) A.rowOffsets[i + 1] = 1;
+		for (const auto& [a, b] : edges) {
+			if (a == b) continue;
+			A.rowOffsets[a + 1]++;
+			A.rowOffsets[b + 1]++;
+		}
+		for (size_t i = 0; i < n; i++) A.rowOffsets[i + 1] += A.rowOffsets[i];
+
+		A.columns.resize(A.rowOffsets[n]);
+		std::vector<unsigned int> cursor(A.rowOffsets.begin(), A.rowOffsets.end() - 1);
+		for (size_t i = 0; i < n; i++) A.columns[cursor[i]++] = (unsigned int)i;
+		for (const auto& [a, b] : edges) {
+			if (a == b) continue;
+			A.columns[cursor[a]++] = b;
+			A.columns[cursor[b]++] = a;
+		}
+		Jobs::ParallelFor(0, (long)n, rowGrain, [&](long i) {
+			std::sort(A.columns.begin() + A.rowOffsets[i], A.columns.begin() + A.rowOffsets[i + 1]);
+		});
+		A.values.assign(A.columns.size(), 0.0f);
+		return A;
+	}
+
+	CsrMatrix PatternFromTetrahedra(size_t n, const std::vector<std::array<int, 4>>& tetrahedra)
+	{
+		std::vector<std::pair<unsigned int, unsigned int>> edges;
+		edges.reserve(tetrahedra.size() * 6);
+		for (const std::array<int, 4>& tet : tetrahedra) {
+			for (int i = 0; i < 4; i++) {
+				for (int j = i + 1; j < 4; j++) edges.push_back({ (unsigned int)tet[i], (unsigned int)tet[j] });
+			}
+		}
+		return PatternFromEdges(n, std::move(edges));
+	}
+
+	BsrMatrix BlockPatternFromEdges(size_t n, std::vector<std::pair<unsigned int, unsigned int>> edges)
+	{
+		CsrMatrix pattern = PatternFromEdges(n, std::move(edges));
+		BsrMatrix A;
+		A.blockRows = A.blockCols = n;
+		A.rowOffsets = std::move(pattern.rowOffsets);
+		A.columns = std::move(pattern.columns);
+		A.values.assign(A.columns.size() * 9, 0.0f);
+		return A;
+	}
+
+	CsrMatrix ToCsr(const BsrMatrix& A)
+	{
+		CsrMatrix B;
+		B.rows = A.blockRows * 3;
+		B.cols = A.blockCols * 3;
+		B.rowOffsets.resize(B.rows + 1);
+		B.columns.resize(A.NonZeros());
+		B.values.resize(A.NonZeros());
+		B.rowOffsets[0] = 0;
+		for (size_t i = 0; i < A.blockRows; i++) {
+			unsigned int width = (A.rowOffsets[i + 1] - A.rowOffsets[i]) * 3;
+			for (int r = 0; r < 3; r++) B.rowOffsets[i * 3 + r + 1] = B.rowOffsets[i * 3 + r] + width;
+		}
+		Jobs::ParallelFor(0, (long)A.blockRows, rowGrain, [&](long i) {
+			for (int r = 0; r < 3; r++) {
+				unsigned int out = B.rowOffsets[i * 3 + r];
+				for (unsigned int k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+					const float* block = A.Block(k);
+					for (int c = 0; c < 3; c++) {
+						B.columns[out] = A.columns[k] * 3 + c;
+						B.values[out++] = block[r * 3 + c];
+					}
+				}
+			}
+		});
+		return B;
+	}
+
+	SellMatrix ToSell(const CsrMatrix& A, unsigned int sigma)
+	{
+		const unsigned int C = SellMatrix::C;
+		SellMatrix S;
+		S.rows = A.rows;
+		S.cols = A.cols;
+
+		// Longest rows first within each window, so the rows sharing a slice have similar lengths
+		size_t padded = (A.rows + C - 1) / C * C;
+		S.rowOf.resize(padded);
+		std::iota(S.rowOf.begin(), S.rowOf.begin() + A.rows, 0u);
+		auto length = [&](unsigned int row) { return A.rowOffsets[row + 1] - A.rowOffsets[row]; };
+		sigma = std::max(sigma, C);
+		for (size_t w = 0; w < A.rows; w += sigma) {
+			auto first = S.rowOf.begin() + w;
+			auto last = S.rowOf.begin() + std::min(A.rows, w + sigma);
+			std::stable_sort(first, last, [&](unsigned int a, unsigned int b) { return length(a) > length(b); });
+		}
+		// Lanes past the last row repeat it with zero values, their results are never stored
+		for (size_t r = A.rows; r < padded; r++) S.rowOf[r] = A.rows ? S.rowOf[A.rows - 1] : 0;
+
+		size_t slices = padded / C;
+		S.sliceOffsets.resize(slices + 1);
+		S.sliceOffsets[0] = 0;
+		for (size_t s = 0; s < slices; s++) {
+			unsigned int width = 0;
+			for (unsigned int lane = 0; lane < C; lane++) {
+				size_t r = s * C + lane;
+				if (r < A.rows) width = std::max(width, length(S.rowOf[r]));
+			}
+			S.sliceOffsets[s + 1] = S.sliceOffsets[s] + width * C;
+		}
+		S.columns.assign(S.sliceOffsets[slices], 0);
+		S.values.assign(S.sliceOffsets[slices], 0.0f);
+		Jobs::ParallelFor(0, (long)slices, 64, [&](long s) {
+			for (unsigned int lane = 0; lane < C; lane++) {
+				size_t r = s * C + lane;
+				if (r >= A.rows) break;
+				unsigned int row = S.rowOf[r];
+				unsigned int j = 0;
+				for (unsigned int k = A.rowOffsets[row]; k < A.rowOffsets[row + 1]; k++, j++) {
+					S.columns[S.sliceOffsets[s] + j * C + lane] = A.columns[k];
+					S.values[S.sliceOffsets[s] + j * C + lane] = A.values[k];
+				}
+			}
+		});
+		return S;
+	}
+
+	void Multiply(const CsrMatrix& A, const float* x, float* y)
+	{
+		const unsigned int* offsets = A.rowOffsets.data();
+		const unsigned int* columns = A.columns.data();
+		const float* values = A.values.data();
+		Jobs::ParallelForChunks(0, (long)A.rows, rowGrain, [&](long begin, long end) {
+			for (long i = begin; i < end; i++) {
+				float sum = 0.0f;
+				for (unsigned int k = offsets[i]; k < offsets[i + 1]; k++) sum += values[k] * x[columns[k]];
+				y[i] = sum;
+			}
+		});
+	}
+
+	void Multiply(const BsrMatrix& A, const float* x, float* y)
+	{
+		const unsigned int* offsets = A.rowOffsets.data();
+		const unsigned int* columns = A.columns.data();
+		const float* values = A.values.data();
+		Jobs::ParallelForChunks(0, (long)A.blockRows, rowGrain, [&](long begin, long end) {
+			for (long i = begin; i < end; i++) {
+				// One index per 9 values, and x is read as whole vec3s
+				float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f;
+				for (unsigned int k = offsets[i]; k < offsets[i + 1]; k++) {
+					const float* b = values + k * 9;
+					const float* v = x + columns[k] * 3;
+					s0 += b[0] * v[0] + b[1] * v[1] + b[2] * v[2];
+					s1 += b[3] * v[0] + b[4] * v[1] + b[5] * v[2];
+					s2 += b[6] * v[0] + b[7] * v[1] + b[8] * v[2];
+				}
+				y[i * 3] = s0;
+				y[i * 3 + 1] = s1;
+				y[i * 3 + 2] = s2;
+			}
+		});
+	}
+
+	void Multiply(const SellMatrix& A, const float* x, float* y)
+	{
+		const unsigned int C = SellMatrix::C;
+		const unsigned int* offsets = A.sliceOffsets.data();
+		const unsigned int* columns = A.columns.data();
+		const float* values = A.values.data();
+		const unsigned int* rowOf = A.rowOf.data();
+		long slices = (long)A.sliceOffsets.size() - 1;
+		Jobs::ParallelForChunks(0, slices, rowGrain / C, [&](long begin, long end) {
+			for (long s = begin; s < end; s++) {
+				// Fixed trip count lane loop, vectorised as a gather and a multiply-add per column
+				float sum[C] = {};
+				for (unsigned int k = offsets[s]; k < offsets[s + 1]; k += C) {
+					for (unsigned int lane = 0; lane < C; lane++) sum[lane] += values[k + lane] * x[columns[k + lane]];
+				}
+				for (unsigned int lane = 0; lane < C; lane++) {
+					size_t r = s * C + lane;
+					if (r < A.rows) y[rowOf[r]] = sum[lane];
+				}
+			}
+		});
+	}
+
+	void MultiplyAdd(const CsrMatrix& A, const float* x, float alpha, const float* y, float* out)
+	{
+		const unsigned int* offsets = A.rowOffsets.data();
+		const unsigned int* columns = A.columns.data();
+		const float* values = A.values.data();
+		Jobs::ParallelForChunks(0, (long)A.rows, rowGrain, [&](long begin, long end) {
+			for (long i = begin; i < end; i++) {
+				float sum = 0.0f;
+				for (unsigned int k = offsets[i]; k < offsets[i + 1]; k++) sum += values[k] * x[columns[k]];
+				out[i] = y[i] + alpha * sum;
+			}
+		});
+	}
+
+	// IC(0): L with A's lower pattern, L_ij = (A_ij - sum_k<j L_ik L_jk) / L_jj. False on a non positive pivot.
+	static bool factorize(const CsrMatrix& A, float shift, CsrMatrix& L)
+	{
+		L.rows = L.cols = A.rows;
+		L.rowOffsets.assign(A.rows + 1, 0);
+		L.columns.clear();
+		L.values.clear();
+		for (size_t i = 0; i < A.rows; i++) {
+			for (unsigned int k = A.rowOffsets[i]; k < A.rowOffsets[i + 1] && A.columns[k] <= i; k++) {
+				L.columns.push_back(A.columns[k]);
+				L.values.push_back(A.values[k]);
+			}
+			L.rowOffsets[i + 1] = (unsigned int)L.columns.size();
+		}
+
+		std::vector<double> row(A.rows, 0.0); // dense scatter of the current row
+		for (size_t i = 0; i < A.rows; i++) {
+			unsigned int begin = L.rowOffsets[i], end = L.rowOffsets[i + 1];
+			if (begin == end || L.columns[end - 1] != i) return false; // missing diagonal
+			for (unsigned int k = begin; k < end; k++) row[L.columns[k]] = L.values[k];
+			row[i] *= 1.0 + shift;
+
+			for (unsigned int k = begin; k < end - 1; k++) {
+				unsigned int j = L.columns[k];
+				double sum = row[j];
+				for (unsigned int m = L.rowOffsets[j]; m < L.rowOffsets[j + 1] - 1; m++) sum -= L.values[m] * row[L.columns[m]];
+				row[j] = sum / L.values[L.rowOffsets[j + 1] - 1];
+			}
+			double pivot = row[i];
+			for (unsigned int k = begin; k < end - 1; k++) pivot -= row[L.columns[k]] * row[L.columns[k]];
+			if (!(pivot > 0.0)) return false;
+
+			for (unsigned int k = begin; k < end - 1; k++) {
+				L.values[k] = (float)row[L.columns[k]];
+				row[L.columns[k]] = 0.0;
+			}
+			L.values[end - 1] = (float)std::sqrt(pivot);
+			row[i] = 0.0;
+		}
+		return true;
+	}
+
+	static CsrMatrix transpose(const CsrMatrix& A)
+	{
+		CsrMatrix T;
+		T.rows = A.cols;
+		T.cols = A.rows;
+		T.rowOffsets.assign(T.rows + 1, 0);
+		for (unsigned int c : A.columns) T.rowOffsets[c + 1]++;
+		for (size_t i = 0; i < T.rows; i++) T.rowOffsets[i + 1] += T.rowOffsets[i];
+		T.columns.resize(A.columns.size());
+		T.values.resize(A.values.size());
+		std::vector<unsigned int> cursor(T.rowOffsets.begin(), T.rowOffsets.end() - 1);
+		for (size_t i = 0; i < A.rows; i++) {
+			for (unsigned int k = A.rowOffsets[i]; k < A.rowOffsets[i + 1]; k++) {
+				unsigned int out = cursor[A.columns[k]]++;
+				T.columns[out] = (unsigned int)i;
+				T.values[out] = A.values[k];
+			}
+		}
+		return T;
+	}
+
+	Preconditioner Preconditioner::Build(const CsrMatrix& A, Type type)
+	{
+		Preconditioner M;
+		M.type = type;
+		M.rows = A.rows;
+		if (type == Type::Jacobi) {
+			M.inverseDiagonal.resize(A.rows);
+			Jobs::ParallelFor(0, (long)A.rows, rowGrain, [&](long i) {
+				long k = A.Find((unsigned int)i, (unsigned int)i);
+				float d = k >= 0 ? A.values[k] : 0.0f;
+				M.inverseDiagonal[i] = d != 0.0f ? 1.0f / d : 1.0f;
+			});
+		}
+		else if (type == Type::IncompleteCholesky) {
+			// A positive definite matrix can still break down without fill, shifting the diagonal restores it
+			bool ok = factorize(A, 0.0f, M.lower);
+			while (!ok && M.shift < 1.0f) {
+				M.shift = M.shift == 0.0f ? 1e-3f : M.shift * 2.0f;
+				ok = factorize(A, M.shift, M.lower);
+			}
+			if (!ok) {
+				std::cout << "ERROR::SPARSE::Incomplete Cholesky broke down, falling back to Jacobi" << std::endl;
+				return Build(A, Type::Jacobi);
+			}
+			M.upper = transpose(M.lower);
+		}
+		return M;
+	}
+
+	void Preconditioner::Apply(const float* r, float* z) const
+	{
+		if (type == Type::Jacobi) {
+			long n = (long)inverseDiagonal.size();
+			Jobs::ParallelForChunks(0, n, vectorGrain, [&](long begin, long end) {
+				for (long i = begin; i < end; i++) z[i] = inverseDiagonal[i] * r[i];
+			});
+		}
+		else if (type == Type::IncompleteCholesky) {
+			// L y = r, then L^T z = y, both in place in z
+			for (size_t i = 0; i < lower.rows; i++) {
+				unsigned int end = lower.rowOffsets[i + 1] - 1;
+				float sum = r[i];
+				for (unsigned int k = lower.rowOffsets[i]; k < end; k++) sum -= lower.values[k] * z[lower.columns[k]];
+				z[i] = sum / lower.values[end];
+			}
+			for (size_t i = upper.rows; i-- > 0;) {
+				unsigned int begin = upper.rowOffsets[i];
+				float sum = z[i];
+				for (unsigned int k = begin + 1; k < upper.rowOffsets[i + 1]; k++) sum -= upper.values[k] * z[upper.columns[k]];
+				z[i] = sum / upper.values[begin];
+			}
+		}
+		else {
+			std::copy(r, r + rows, z);
+		}
+	}
+
+	// Deterministic parallel dot product: partial sums per fixed chunk, added in chunk order
+	static double dot(const float* a, const float* b, long n, std::vector<double>& partials)
+	{
+		long chunks = (n + vectorGrain - 1) / vectorGrain;
+		partials.assign(chunks, 0.0);
+		Jobs::ParallelForChunks(0, n, vectorGrain, [&](long begin, long end) {
+			double sum = 0.0;
+			for (long i = begin; i < end; i++) sum += (double)a[i] * b[i];
+			partials[begin / vectorGrain] = sum;
+		});
+		double sum = 0.0;
+		for (double p : partials) sum += p;
+		return sum;
+	}
+
+	SolveStats SolveCG(const CsrMatrix& A, const float* b, float* x, const Preconditioner& M, float tolerance, int maxIterations)
+	{
+		auto start = std::chrono::steady_clock::now();
+		long n = (long)A.rows;
+		std::vector<float> r(n), z(n), p(n), q(n);
+		std::vector<double> partials;
+		auto precondition = [&](const float* in, float* out) {
+			if (M.type == Preconditioner::Type::None) std::copy(in, in + n, out); // M may be default constructed
+			else M.Apply(in, out);
+		};
+
+		// r = b - A x
+		Multiply(A, x, q.data());
+		Jobs::ParallelForChunks(0, n, vectorGrain, [&](long begin, long end) {
+			for (long i = begin; i < end; i++) r[i] = b[i] - q[i];
+		});
+		double bNorm = std::sqrt(dot(b, b, n, partials));
+		if (bNorm == 0.0) bNorm = 1.0;
+
+		SolveStats stats;
+		precondition(r.data(), z.data());
+		p = z;
+		double rz = dot(r.data(), z.data(), n, partials);
+		double rNorm = std::sqrt(dot(r.data(), r.data(), n, partials));
+		while (rNorm / bNorm > tolerance && stats.iterations < maxIterations) {
+			Multiply(A, p.data(), q.data());
+			double pq = dot(p.data(), q.data(), n, partials);
+			if (!(pq > 0.0)) break; // not positive definite along p
+			float alpha = (float)(rz / pq);
+			Jobs::ParallelForChunks(0, n, vectorGrain, [&](long begin, long end) {
+				for (long i = begin; i < end; i++) {
+					x[i] += alpha * p[i];
+					r[i] -= alpha * q[i];
+				}
+			});
+			precondition(r.data(), z.data());
+			double rzNext = dot(r.data(), z.data(), n, partials);
+			float beta = (float)(rzNext / rz);
+			rz = rzNext;
+			Jobs::ParallelForChunks(0, n, vectorGrain, [&](long begin, long end) {
+				for (long i = begin; i < end; i++) p[i] = z[i] + beta * p[i];
+			});
+			rNorm = std::sqrt(dot(r.data(), r.data(), n, partials));
+			stats.iterations++;
+		}
+
+		stats.residual = (float)(rNorm / bNorm);
+		stats.converged = stats.residual <= tolerance;
+		stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return stats;
+	}
+
+	// Best of repeats, in ms
+	template<typename F>
+	static double timeBest(int repeats, F&& run)
+	{
+		double best = 1e30;
+		for (int i = 0; i < repeats; i++) {
+			auto start = std::chrono::steady_clock::now();
+			run();
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	void Benchmark(const BsrMatrix& A, int repeats)
+	{
+		CsrMatrix csr = ToCsr(A);
+		SellMatrix sell = ToSell(csr);
+		size_t n = csr.rows;
+		std::vector<float> x(n, 1.0f), y(n), reference(n);
+
+		// Reference bandwidth: a = b + s c over arrays well past the last level cache
+		size_t streamCount = 8 << 20;
+		std::vector<float> a(streamCount), b(streamCount, 1.0f), c(streamCount, 2.0f);
+		double triadMs = timeBest(std::max(repeats / 5, 3), [&]() {
+			Jobs::ParallelForChunks(0, (long)streamCount, 1 << 16, [&](long begin, long end) {
+				for (long i = begin; i < end; i++) a[i] = b[i] + 3.0f * c[i];
+			});
+		});
+		double bandwidth = 3.0 * streamCount * sizeof(float) / (triadMs * 1e6); // GB/s
+
+		std::cout << "::SPARSE BENCH::" << std::endl;
+		std::cout << "rows: " << n << ", non-zeros: " << csr.NonZeros() << ", threads: " << Jobs::ThreadCount()
+			<< ", triad bandwidth: " << bandwidth << " GB/s" << std::endl;
+
+		// Bytes every product has to move at least once: the matrix plus x and y
+		auto report = [&](const char* name, double ms, size_t matrixBytes, size_t stored) {
+			double gflops = 2.0 * csr.NonZeros() / (ms * 1e6);
+			double gbs = (matrixBytes + 2.0 * n * sizeof(float)) / (ms * 1e6);
+			float error = 0.0f;
+			for (size_t i = 0; i < n; i++) error = std::max(error, std::abs(y[i] - reference[i]));
+			std::cout << name << ": " << ms << " ms, " << gflops << " GFLOP/s, " << gbs << " GB/s ("
+				<< 100.0 * gbs / bandwidth << "% of triad), stored " << stored << ", max diff " << error << std::endl;
+		};
+
+		Multiply(csr, x.data(), reference.data());
+		double csrMs = timeBest(repeats, [&]() { Multiply(csr, x.data(), y.data()); });
+		report("CSR", csrMs, csr.Bytes(), csr.NonZeros());
+		double bsrMs = timeBest(repeats, [&]() { Multiply(A, x.data(), y.data()); });
+		report("BSR 3x3", bsrMs, A.Bytes(), A.NonZeros());
+		double sellMs = timeBest(repeats, [&]() { Multiply(sell, x.data(), y.data()); });
+		report("SELL-8-256", sellMs, sell.Bytes(), sell.Stored());
+
+		// Solves with a known answer, x = 1
+		const Preconditioner::Type types[] = { Preconditioner::Type::None, Preconditioner::Type::Jacobi, Preconditioner::Type::IncompleteCholesky };
+		const char* names[] = { "CG", "PCG Jacobi", "PCG IC(0)" };
+		for (int t = 0; t < 3; t++) {
+			auto start = std::chrono::steady_clock::now();
+			Preconditioner M = Preconditioner::Build(csr, types[t]);
+			double setupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			std::vector<float> solution(n, 0.0f);
+			SolveStats stats = SolveCG(csr, reference.data(), solution.data(), M, 1e-5f, 2000);
+			float error = 0.0f;
+			for (float v : solution) error = std::max(error, std::abs(v - 1.0f));
+			std::cout << names[t] << ": " << stats.iterations << " iterations, " << stats.ms << " ms (+" << setupMs << " ms setup), residual "
+				<< stats.residual << (stats.converged ? "" : " NOT CONVERGED") << ", max error " << error;
+			if (M.shift > 0.0f) std::cout << ", diagonal shift " << M.shift;
+			std::cout << std::endl;
+		}
+		std::cout << std::endl;
+	}
+}
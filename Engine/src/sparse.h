@@ -0,0 +1,114 @@
+/*
+ * SPARSE: Sparse matrices (CSR, 3x3 block BSR, SELL-C-sigma), parallel products and preconditioned CG
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace Sparse {
+	// Rows are stored back to back, columns ascending within a row
+	struct CsrMatrix {
+		size_t rows = 0;
+		size_t cols = 0;
+		std::vector<unsigned int> rowOffsets; // rows + 1 entries
+		std::vector<unsigned int> columns;
+		std::vector<float> values;
+
+		size_t NonZeros() const { return columns.size(); }
+		size_t Bytes() const { return rowOffsets.size() * sizeof(unsigned int) + columns.size() * sizeof(unsigned int) + values.size() * sizeof(float); }
+
+		// Position of (row, col) in columns/values, or -1 if it is not stored
+		long Find(unsigned int row, unsigned int col) const;
+	};
+
+	// CSR over 3x3 blocks, one block row per node of a vec3 field. Blocks are row major, 9 floats each.
+	struct BsrMatrix {
+		size_t blockRows = 0;
+		size_t blockCols = 0;
+		std::vector<unsigned int> rowOffsets; // blockRows + 1 entries
+		std::vector<unsigned int> columns;    // block columns, ascending within a row
+		std::vector<float> values;
+
+		size_t Blocks() const { return columns.size(); }
+		size_t NonZeros() const { return columns.size() * 9; }
+		size_t Bytes() const { return rowOffsets.size() * sizeof(unsigned int) + columns.size() * sizeof(unsigned int) + values.size() * sizeof(float); }
+
+		long Find(unsigned int row, unsigned int col) const;
+		float* Block(size_t k) { return values.data() + k * 9; }
+		const float* Block(size_t k) const { return values.data() + k * 9; }
+	};
+
+	// SELL-C-sigma: rows sorted by length within windows of sigma, cut into slices of C rows, each slice padded
+	// to its longest row and stored column major. The C rows of a slice run in lockstep, one per SIMD lane.
+	struct SellMatrix {
+		static constexpr unsigned int C = 8;
+
+		size_t rows = 0;
+		size_t cols = 0;
+		std::vector<unsigned int> sliceOffsets; // slices + 1 entries, into columns/values
+		std::vector<unsigned int> columns;      // padding points at column 0 with a zero value
+		std::vector<float> values;
+		std::vector<unsigned int> rowOf;        // slice row -> matrix row, rows * padded to C
+
+		size_t Stored() const { return columns.size(); } // non-zeros plus padding
+		size_t Bytes() const { return (sliceOffsets.size() + columns.size() + rowOf.size()) * sizeof(unsigned int) + values.size() * sizeof(float); }
+	};
+
+	// Symmetric pattern with a full diagonal over n nodes and the given undirected edges (duplicates allowed), values zeroed
+	CsrMatrix PatternFromEdges(size_t n, std::vector<std::pair<unsigned int, unsigned int>> edges);
+
+	// The same for the six edges of every tetrahedron
+	CsrMatrix PatternFromTetrahedra(size_t n, const std::vector<std::array<int, 4>>& tetrahedra);
+
+	// Block version: a 3x3 block for every node pair joined by an edge (springs) and on the diagonal
+	BsrMatrix BlockPatternFromEdges(size_t n, std::vector<std::pair<unsigned int, unsigned int>> edges);
+
+	// Format conversions, values are copied
+	CsrMatrix ToCsr(const BsrMatrix& A);
+	SellMatrix ToSell(const CsrMatrix& A, unsigned int sigma = 256);
+
+	// y = A x
+	void Multiply(const CsrMatrix& A, const float* x, float* y);
+	void Multiply(const BsrMatrix& A, const float* x, float* y); // x and y hold 3 floats per block row
+	void Multiply(const SellMatrix& A, const float* x, float* y);
+
+	// out = y + alpha A x (out may alias y, not x)
+	void MultiplyAdd(const CsrMatrix& A, const float* x, float alpha, const float* y, float* out);
+
+	// z = M^-1 r for CG. Jacobi is fully parallel; incomplete Cholesky (zero fill on A's pattern) converges in
+	// fewer iterations but its triangular solves are sequential.
+	struct Preconditioner {
+		enum class Type { None, Jacobi, IncompleteCholesky };
+
+		Type type = Type::None;
+		size_t rows = 0;
+		std::vector<float> inverseDiagonal; // Jacobi
+		CsrMatrix lower;                    // IC: L, diagonal last in each row
+		CsrMatrix upper;                    // IC: L^T, diagonal first in each row
+		float shift = 0.0f;                 // IC: diagonal shift that was needed to avoid a breakdown
+
+		static Preconditioner Build(const CsrMatrix& A, Type type);
+		void Apply(const float* r, float* z) const;
+		size_t Bytes() const { return inverseDiagonal.size() * sizeof(float) + lower.Bytes() + upper.Bytes(); }
+	};
+
+	struct SolveStats {
+		int iterations = 0;
+		float residual = 0.0f; // |b - A x| / |b|
+		bool converged = false;
+		double ms = 0.0;
+	};
+
+	// Conjugate gradients on a symmetric positive definite A, x holds the initial guess. Reductions are summed
+	// per fixed chunk, so the iterates are the same for any thread count.
+	SolveStats SolveCG(const CsrMatrix& A, const float* b, float* x, const Preconditioner& M = Preconditioner(),
+		float tolerance = 1e-5f, int maxIterations = 1000);
+
+	// Measures streaming bandwidth with a triad, times SpMV in every format against it (GFLOP/s and GB/s), then
+	// solves A x = A 1 with each preconditioner. Prints ::SPARSE BENCH::.
+	void Benchmark(const BsrMatrix& A, int repeats = 50);
+}
@@ -0,0 +1,251 @@
+/*
+ * SPATIAL HASH: Uniform grid hash over surface triangles, used for soft body self-collision
+ */
+
+#include <iostream>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include "spatialHash.h"
+#include "collider.h"
+#include "jobs.h"
+
+// Fixed number of histogram chunks for the counting sort, independent of the thread count
+static const long SORT_CHUNKS = 8;
+
+// Cells covered by triangle t's padded AABB, false for a non-finite one
+bool SpatialHash::CellRange(long t, glm::ivec3& lo, glm::ivec3& hi) const
+{
+	const glm::vec3& min = triangleBounds[t * 2];
+	const glm::vec3& max = triangleBounds[t * 2 + 1];
+	for (int k = 0; k < 3; k++) {
+		if (!std::isfinite(min[k]) || !std::isfinite(max[k])) return false;
+	}
+
+	// Clamp before the int conversion, far away coordinates would overflow it
+	const float limit = (float)(1 << 30);
+	lo = glm::ivec3(glm::clamp(glm::floor(min / cellSize), -limit, limit));
+	hi = glm::ivec3(glm::clamp(glm::floor(max / cellSize), -limit, limit));
+	hi = glm::min(hi, lo + (MaxSpan - 1));
+	return true;
+}
+
+void SpatialHash::Build(const SurfaceTopology& surface, const std::vector<glm::vec3>& positions, float padding)
+{
+	const long triCount = (long)(surface.triangles.size() / 3);
+	const unsigned int* tri = surface.triangles.data();
+
+	// Table sized to the next power of two >= triangle count
+	unsigned int tableSize = 1;
+	while (tableSize < (unsigned int)triCount) tableSize <<= 1;
+	tableMask = tableSize - 1;
+
+	// Pass 1: padded triangle AABBs and how many cells each one covers
+	entryOffset.resize(triCount + 1);
+	entryOffset[0] = 0;
+	triangleBounds.resize(triCount * 2);
+	Jobs::ParallelFor(0, triCount, 1024, [&](long t) {
+		glm::vec3 a = positions[tri[t * 3]], b = positions[tri[t * 3 + 1]], c = positions[tri[t * 3 + 2]];
+		triangleBounds[t * 2] = glm::min(a, glm::min(b, c)) - padding;
+		triangleBounds[t * 2 + 1] = glm::max(a, glm::max(b, c)) + padding;
+		glm::ivec3 lo, hi;
+		if (!CellRange(t, lo, hi)) {
+			// Empty box so Overlaps never accepts it
+			triangleBounds[t * 2] = glm::vec3(1.0f);
+			triangleBounds[t * 2 + 1] = glm::vec3(0.0f);
+			entryOffset[t + 1] = 0;
+			return;
+		}
+		glm::ivec3 span = hi - lo + 1;
+		entryOffset[t + 1] = (unsigned int)(span.x * span.y * span.z);
+	});
+	for (long t = 0; t < triCount; t++) entryOffset[t + 1] += entryOffset[t];
+
+	// Pass 2: emit one (bucket, triangle) entry per covered cell
+	const long total = (long)entryOffset[triCount];
+	entryKey.resize(total);
+	entryTriangle.resize(total);
+	Jobs::ParallelFor(0, triCount, 1024, [&](long t) {
+		glm::ivec3 lo, hi;
+		if (entryOffset[t + 1] == entryOffset[t] || !CellRange(t, lo, hi)) return;
+		unsigned int e = entryOffset[t];
+		for (int x = lo.x; x <= hi.x; x++)
+			for (int y = lo.y; y <= hi.y; y++)
+				for (int z = lo.z; z <= hi.z; z++) {
+					entryKey[e] = Hash(glm::ivec3(x, y, z));
+					entryTriangle[e] = (unsigned int)t;
+					e++;
+				}
+	});
+
+	// Pass 3: parallel counting sort, one histogram per chunk of entries
+	chunkCounts.assign(SORT_CHUNKS * tableSize, 0);
+	Jobs::ParallelFor(0, SORT_CHUNKS, 1, [&](long c) {
+		unsigned int* counts = chunkCounts.data() + c * tableSize;
+		for (long e = c * total / SORT_CHUNKS; e < (c + 1) * total / SORT_CHUNKS; e++) {
+			counts[entryKey[e]]++;
+		}
+	});
+
+	// Turn the histograms into write cursors: bucket-major, chunk-minor keeps the sort stable
+	bucketStart.resize(tableSize + 1);
+	Jobs::ParallelFor(0, (long)tableSize, 1024, [&](long b) {
+		unsigned int sum = 0;
+		for (long c = 0; c < SORT_CHUNKS; c++) {
+			unsigned int n = chunkCounts[c * tableSize + b];
+			chunkCounts[c * tableSize + b] = sum;
+			sum += n;
+		}
+		bucketStart[b + 1] = sum;
+	});
+	bucketStart[0] = 0;
+	for (unsigned int b = 0; b < tableSize; b++) bucketStart[b + 1] += bucketStart[b];
+
+	// Pass 4: scatter
+	sortedTriangles.resize(total);
+	Jobs::ParallelFor(0, SORT_CHUNKS, 1, [&](long c) {
+		unsigned int* cursor = chunkCounts.data() + c * tableSize;
+		for (long e = c * total / SORT_CHUNKS; e < (c + 1) * total / SORT_CHUNKS; e++) {
+			unsigned int key = entryKey[e];
+			sortedTriangles[bucketStart[key] + cursor[key]++] = entryTriangle[e];
+		}
+	});
+}
+
+void SelfCollision::Init(const SurfaceTopology& surface, const std::vector<glm::vec3>& positions, float stiffness)
+{
+	// Scale everything from the rest pose mean edge length
+	double edgeSum = 0.0;
+	size_t edges = surface.triangles.size();
+	for (size_t t = 0; t + 2 < surface.triangles.size(); t += 3) {
+		glm::vec3 a = positions[surface.triangles[t]];
+		glm::vec3 b = positions[surface.triangles[t + 1]];
+		glm::vec3 c = positions[surface.triangles[t + 2]];
+		edgeSum += glm::distance(a, b) + glm::distance(b, c) + glm::distance(c, a);
+	}
+	float meanEdge = edges > 0 ? (float)(edgeSum / edges) : 1.0f;
+
+	this->stiffness = stiffness;
+	thickness = 0.25f * meanEdge;
+	hash.cellSize = meanEdge;
+}
+
+// Weights of p (a point on the triangle) against its corners
+static glm::vec3 Barycentric(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 e0 = b - a, e1 = c - a, e2 = p - a;
+	float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+	float d20 = glm::dot(e2, e0), d21 = glm::dot(e2, e1);
+	float denom = d00 * d11 - d01 * d01;
+	if (denom <= 1e-20f) return glm::vec3(1.0f / 3.0f); // sliver, split evenly
+	float v = glm::clamp((d11 * d20 - d01 * d21) / denom, 0.0f, 1.0f);
+	float w = glm::clamp((d00 * d21 - d01 * d20) / denom, 0.0f, 1.0f - v);
+	return glm::vec3(1.0f - v - w, v, w);
+}
+
+size_t AccumulateRepulsion(const SpatialHash& hash, const unsigned int* triangles, const glm::vec3* trianglePositions,
+	const std::vector<unsigned int>& queryVertices, const glm::vec3* queryPositions, const SurfaceTopology* ring,
+	float thickness, float stiffness, const glm::mat3& forceTransform, glm::vec3* forces,
+	const glm::mat3& reactionTransform, glm::vec3* reactions, RepulsionScratch& scratch)
+{
+	const long count = (long)queryVertices.size();
+	const long grain = 256;
+	const float thickness2 = thickness * thickness;
+	scratch.chunks.resize((count + grain - 1) / grain);
+
+	// Pass 1: each query vertex writes only its own force and records its contacts in its chunk's list
+	Jobs::ParallelForChunks(0, count, grain, [&](long chunkBegin, long chunkEnd) {
+		std::vector<RepulsionScratch::Contact>& chunkContacts = scratch.chunks[chunkBegin / grain];
+		chunkContacts.clear();
+		for (long i = chunkBegin; i < chunkEnd; i++) {
+			unsigned int v = queryVertices[i];
+			glm::vec3 p = queryPositions[v];
+			glm::vec3 force(0.0f);
+
+			// Same body: v's one-ring is the faces around its surface slot i, their corners are v and its neighbours
+			auto nearV = [&](unsigned int x) {
+				if (x == v) return true;
+				for (unsigned int k = ring->faceOffsets[i]; k < ring->faceOffsets[i + 1]; k++) {
+					const unsigned int* f = triangles + ring->faceIndices[k] * 3;
+					if (f[0] == x || f[1] == x || f[2] == x) return true;
+				}
+				return false;
+			};
+
+			const unsigned int* begin;
+			const unsigned int* end;
+			hash.Query(p, begin, end);
+
+			unsigned int previous = UINT_MAX;
+			for (const unsigned int* it = begin; it != end; it++) {
+				unsigned int t = *it;
+				if (t == previous) continue; // same triangle through a colliding cell
+				previous = t;
+
+				// Cheap padded AABB reject before touching the triangle's vertices
+				if (!hash.Overlaps(t, p)) continue;
+
+				unsigned int a = triangles[t * 3], b = triangles[t * 3 + 1], c = triangles[t * 3 + 2];
+				if (ring && (nearV(a) || nearV(b) || nearV(c))) continue;
+
+				const glm::vec3& pa = trianglePositions[a];
+				const glm::vec3& pb = trianglePositions[b];
+				const glm::vec3& pc = trianglePositions[c];
+				glm::vec3 q = ClosestPointOnTriangle(p, pa, pb, pc);
+				glm::vec3 d = p - q;
+				float dist2 = glm::dot(d, d);
+				if (dist2 >= thickness2 || dist2 <= 1e-12f) continue;
+
+				float dist = glm::sqrt(dist2);
+				glm::vec3 contact = d * ((thickness - dist) * stiffness / dist);
+				force += contact;
+				chunkContacts.push_back({ t, Barycentric(q, pa, pb, pc), contact });
+			}
+			forces[v] += forceTransform * force;
+		}
+	});
+
+	// Pass 2: the reactions, one writer walking the chunks in order so the sums do not depend on the threads
+	size_t total = 0;
+	for (const std::vector<RepulsionScratch::Contact>& chunkContacts : scratch.chunks) {
+		for (const RepulsionScratch::Contact& contact : chunkContacts) {
+			glm::vec3 reaction = reactionTransform * -contact.force;
+			const unsigned int* tri = triangles + contact.triangle * 3;
+			for (int k = 0; k < 3; k++) reactions[tri[k]] += reaction * contact.weights[k];
+		}
+		total += chunkContacts.size();
+	}
+	return total;
+}
+
+void SelfCollision::Apply(const SurfaceTopology& surface, ParticleStore& particles)
+{
+	if (!enabled || surface.triangles.empty()) return;
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	hash.Build(surface, particles.position, thickness);
+	auto t1 = std::chrono::high_resolution_clock::now();
+
+	// One query per surface vertex, each vertex only writes its own force
+	last.contacts = AccumulateRepulsion(hash, surface.triangles.data(), particles.position.data(), surface.vertices,
+		particles.position.data(), &surface, thickness, stiffness, glm::mat3(1.0f), particles.force.data(),
+		glm::mat3(1.0f), particles.force.data(), contacts);
+	auto t2 = std::chrono::high_resolution_clock::now();
+
+	last.buildMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	last.queryMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+
+	if (reportInterval <= 0) return;
+
+	accumulated.buildMs += last.buildMs;
+	accumulated.queryMs += last.queryMs;
+	accumulated.contacts += last.contacts;
+	if (++steps == reportInterval) {
+		std::cout << "::SELF COLLISION:: triangles: " << surface.triangles.size() / 3
+			<< " build: " << accumulated.buildMs / steps << " ms"
+			<< " query: " << accumulated.queryMs / steps << " ms"
+			<< " contacts: " << accumulated.contacts / steps << std::endl;
+		accumulated = Stats();
+		steps = 0;
+	}
+}
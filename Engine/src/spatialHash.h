@@ -0,0 +1,100 @@
+/*
+ * SPATIAL HASH: Uniform grid hash over surface triangles, used for soft body self-collision
+ */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "surface.h"
+#include "particles.h"
+
+class SpatialHash {
+public:
+	float cellSize = 1.0f;
+
+	// Rebuilds the table from the surface triangles, AABBs grown by padding. Triangles with a non-finite
+	// AABB are left out, huge ones only cover the first MaxSpan cells per axis from their low corner.
+	void Build(const SurfaceTopology& surface, const std::vector<glm::vec3>& positions, float padding);
+
+	// Triangles stored in the cell containing p (may contain hash collisions, never misses)
+	inline void Query(const glm::vec3& p, const unsigned int*& begin, const unsigned int*& end) const {
+		unsigned int b = Hash(Cell(p));
+		begin = sortedTriangles.data() + bucketStart[b];
+		end = sortedTriangles.data() + bucketStart[b + 1];
+	}
+
+	// p inside the padded AABB of triangle t from the last build
+	inline bool Overlaps(unsigned int t, const glm::vec3& p) const {
+		const glm::vec3& lo = triangleBounds[t * 2];
+		const glm::vec3& hi = triangleBounds[t * 2 + 1];
+		return p.x >= lo.x && p.y >= lo.y && p.z >= lo.z && p.x <= hi.x && p.y <= hi.y && p.z <= hi.z;
+	}
+
+private:
+	unsigned int tableMask = 0;
+	std::vector<glm::vec3> triangleBounds;     // padded lo/hi per triangle
+	std::vector<unsigned int> bucketStart;     // tableSize + 1 offsets into sortedTriangles
+	std::vector<unsigned int> sortedTriangles; // triangle ids grouped by bucket
+
+	// Scratch reused between builds
+	std::vector<unsigned int> entryOffset;
+	std::vector<unsigned int> entryKey;
+	std::vector<unsigned int> entryTriangle;
+	std::vector<unsigned int> chunkCounts;
+
+	static const int MaxSpan = 16; // cells per axis, bounds the entries a blown up triangle can emit
+
+	inline glm::ivec3 Cell(const glm::vec3& p) const { return glm::ivec3(glm::floor(p / cellSize)); }
+	bool CellRange(long t, glm::ivec3& lo, glm::ivec3& hi) const;
+	inline unsigned int Hash(const glm::ivec3& c) const {
+		return ((unsigned int)c.x * 73856093u ^ (unsigned int)c.y * 19349663u ^ (unsigned int)c.z * 83492791u) & tableMask;
+	}
+};
+
+// Contacts of one AccumulateRepulsion call, kept per chunk of query vertices so the reactions on the
+// triangles can be added afterwards in a fixed order
+struct RepulsionScratch {
+	struct Contact {
+		unsigned int triangle;
+		glm::vec3 weights; // barycentric weights of the closest point
+		glm::vec3 force;   // on the query vertex, before forceTransform
+	};
+	std::vector<std::vector<Contact>> chunks;
+};
+
+// Vertex-triangle penalty forces for the query vertices against the triangles in hash. The query vertex gets
+// the force (mapped through forceTransform), the triangle's corners the opposite one split by barycentric
+// weight (mapped through reactionTransform), so contacts add no net momentum. With ring set the query
+// vertices are ring->vertices of the same body, and triangles touching a vertex or its one-ring are skipped.
+size_t AccumulateRepulsion(const SpatialHash& hash, const unsigned int* triangles, const glm::vec3* trianglePositions,
+	const std::vector<unsigned int>& queryVertices, const glm::vec3* queryPositions, const SurfaceTopology* ring,
+	float thickness, float stiffness, const glm::mat3& forceTransform, glm::vec3* forces,
+	const glm::mat3& reactionTransform, glm::vec3* reactions, RepulsionScratch& scratch);
+
+class SelfCollision {
+public:
+	bool enabled = false; // opt in per body ("selfCollision" in the scene's body section)
+	float thickness = 0.0f; // repulsion distance, set from the mean edge length on Init
+	float stiffness = 0.0f;
+
+	// Step timings for benchmarking, averaged every reportInterval steps (0 = no report)
+	struct Stats {
+		double buildMs = 0.0;
+		double queryMs = 0.0;
+		size_t contacts = 0;
+	};
+	Stats last;
+	int reportInterval = 0;
+
+	void Init(const SurfaceTopology& surface, const std::vector<glm::vec3>& positions, float stiffness);
+
+	// Adds vertex-triangle repulsion forces to the surface particles
+	void Apply(const SurfaceTopology& surface, ParticleStore& particles);
+
+private:
+	SpatialHash hash;
+	RepulsionScratch contacts;
+	Stats accumulated;
+	int steps = 0;
+};
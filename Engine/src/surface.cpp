@@ -0,0 +1,126 @@
+/*
+ * SURFACE: Boundary extraction and per-frame normal recomputation for soft bodies
+ */
+
+#include <algorithm>
+#include <array>
+#include "surface.h"
+#include "jobs.h"
+
+struct TetFace {
+	std::array<unsigned int, 3> key; // sorted, used to match shared faces
+	std::array<unsigned int, 3> tri; // original winding
+	unsigned int opposite;           // tet vertex not on this face
+
+	bool operator<(const TetFace& other) const { return key < other.key; }
+};
+
+void SurfaceTopology::Build(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions, bool tetrahedral)
+{
+	triangles.clear();
+
+	if (!tetrahedral) {
+		triangles = indices;
+	}
+	else {
+		// A face of the tetrahedral mesh is on the boundary when exactly one tet owns it
+		std::vector<TetFace> faces;
+		faces.reserve(indices.size());
+
+		auto addFace = [&](unsigned int a, unsigned int b, unsigned int c, unsigned int opposite) {
+			TetFace f;
+			f.key = { a, b, c };
+			std::sort(f.key.begin(), f.key.end());
+			f.tri = { a, b, c };
+			f.opposite = opposite;
+			faces.push_back(f);
+		};
+
+		for (size_t i = 0; i + 3 < indices.size(); i += 4) {
+			unsigned int a = indices[i], b = indices[i + 1], c = indices[i + 2], d = indices[i + 3];
+			addFace(a, b, c, d);
+			addFace(a, b, d, c);
+			addFace(a, c, d, b);
+			addFace(b, c, d, a);
+		}
+		std::sort(faces.begin(), faces.end());
+
+		for (size_t i = 0; i < faces.size();) {
+			size_t j = i + 1;
+			while (j < faces.size() && faces[j].key == faces[i].key) j++;
+
+			if (j - i == 1) {
+				const TetFace& f = faces[i];
+				glm::vec3 p0 = positions[f.tri[0]];
+				glm::vec3 n = glm::cross(positions[f.tri[1]] - p0, positions[f.tri[2]] - p0);
+
+				// Flip so the face points away from the rest of its tet
+				if (glm::dot(n, positions[f.opposite] - p0) > 0.0f) {
+					triangles.insert(triangles.end(), { f.tri[0], f.tri[2], f.tri[1] });
+				}
+				else {
+					triangles.insert(triangles.end(), { f.tri[0], f.tri[1], f.tri[2] });
+				}
+			}
+			i = j;
+		}
+	}
+
+	BuildAdjacency(positions.size());
+}
+
+void SurfaceTopology::BuildAdjacency(size_t vertexCount)
+{
+	size_t faceCount = triangles.size() / 3;
+
+	// Count faces per vertex, then compact to the vertices that are actually on the surface
+	std::vector<unsigned int> valence(vertexCount, 0);
+	for (unsigned int idx : triangles) valence[idx]++;
+
+	std::vector<unsigned int> surfaceSlot(vertexCount, 0);
+	vertices.clear();
+	faceOffsets.assign(1, 0);
+	for (unsigned int v = 0; v < vertexCount; v++) {
+		if (valence[v] == 0) continue;
+		surfaceSlot[v] = static_cast<unsigned int>(vertices.size());
+		vertices.push_back(v);
+		faceOffsets.push_back(faceOffsets.back() + valence[v]);
+	}
+
+	// Fill the adjacency, faces end up sorted per vertex so the accumulation order is fixed
+	faceIndices.resize(faceOffsets.back());
+	std::vector<unsigned int> cursor(faceOffsets.begin(), faceOffsets.end() - 1);
+	for (size_t f = 0; f < faceCount; f++) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int slot = surfaceSlot[triangles[f * 3 + k]];
+			faceIndices[cursor[slot]++] = static_cast<unsigned int>(f);
+		}
+	}
+}
+
+void SurfaceTopology::RecomputeNormals(const std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, std::vector<glm::vec3>& faceNormals) const
+{
+	const long faceCount = static_cast<long>(triangles.size() / 3);
+	const long vertexCount = static_cast<long>(vertices.size());
+	const unsigned int* tri = triangles.data();
+	faceNormals.resize(faceCount);
+	glm::vec3* fn = faceNormals.data();
+
+	// Pass 1: area weighted face normals, one writer per face
+	Jobs::ParallelFor(0, faceCount, 1024, [&](long f) {
+		glm::vec3 p0 = positions[tri[f * 3]];
+		glm::vec3 p1 = positions[tri[f * 3 + 1]];
+		glm::vec3 p2 = positions[tri[f * 3 + 2]];
+		fn[f] = glm::cross(p1 - p0, p2 - p0);
+	});
+
+	// Pass 2: gather through the CSR adjacency, one writer per vertex so no atomics are needed
+	Jobs::ParallelFor(0, vertexCount, 1024, [&](long i) {
+		glm::vec3 n(0.0f);
+		for (unsigned int k = faceOffsets[i]; k < faceOffsets[i + 1]; k++) {
+			n += fn[faceIndices[k]];
+		}
+		float len2 = glm::dot(n, n);
+		normals[vertices[i]] = len2 > 0.0f ? n * glm::inversesqrt(len2) : n;
+	});
+}
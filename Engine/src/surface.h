@@ -0,0 +1,29 @@
+/*
+ * SURFACE: Boundary extraction and per-frame normal recomputation for soft bodies
+ */
+
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct SurfaceTopology {
+	// Boundary triangles (3 indices each), wound so the normal points outwards
+	std::vector<unsigned int> triangles;
+
+	// Vertices referenced by at least one boundary triangle
+	std::vector<unsigned int> vertices;
+
+	// CSR vertex -> face adjacency, faceOffsets has vertices.size() + 1 entries
+	std::vector<unsigned int> faceOffsets;
+	std::vector<unsigned int> faceIndices;
+
+	// indices holds 4 entries per tet when tetrahedral, otherwise 3 per triangle
+	void Build(const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& positions, bool tetrahedral);
+
+	// The topology is immutable after Build so it can be shared, faceNormals is the caller's scratch (one per triangle)
+	void RecomputeNormals(const std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, std::vector<glm::vec3>& faceNormals) const;
+
+private:
+	void BuildAdjacency(size_t vertexCount);
+};
@@ -0,0 +1,268 @@
+/*
+ * TRAJECTORY: Streams per step particle positions, oscillator state and ECG to a compressed file for offline analysis
+ */
+
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include "trajectory.h"
+#include "physics.h"
+
+namespace Trajectory {
+	static inline uint8_t* putVarint(uint8_t* out, int32_t value)
+	{
+		// Zigzag keeps small negative deltas small
+		uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+		while (v >= 0x80) {
+			*out++ = (uint8_t)(v | 0x80);
+			v >>= 7;
+		}
+		*out++ = (uint8_t)v;
+		return out;
+	}
+
+	static inline bool getVarint(const uint8_t*& in, const uint8_t* end, int32_t& value)
+	{
+		uint32_t v = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			if (in == end) return false;
+			uint8_t byte = *in++;
+			v |= (uint32_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				value = (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void EncodeFrame(const glm::vec3* positions, size_t count, float quantum, bool keyframe, std::vector<int32_t>& previous, std::vector<uint8_t>& out)
+	{
+		previous.resize(count * 3, 0);
+		if (keyframe) std::fill(previous.begin(), previous.end(), 0);
+		out.resize(count * 3 * 5); // worst case varint length
+
+		const float* components = &positions[0].x;
+		float scale = 1.0f / quantum;
+		uint8_t* write = out.data();
+		for (size_t i = 0; i < count * 3; i++) {
+			int32_t q = (int32_t)std::floor(components[i] * scale + 0.5f);
+			write = putVarint(write, q - previous[i]);
+			previous[i] = q;
+		}
+		out.resize(write - out.data());
+	}
+
+	bool DecodeFrame(const uint8_t* data, size_t bytes, float quantum, bool keyframe, std::vector<int32_t>& previous, glm::vec3* positions, size_t count)
+	{
+		previous.resize(count * 3, 0);
+		if (keyframe) std::fill(previous.begin(), previous.end(), 0);
+
+		const uint8_t* end = data + bytes;
+		float* components = &positions[0].x;
+		for (size_t i = 0; i < count * 3; i++) {
+			int32_t delta;
+			if (!getVarint(data, end, delta)) return false;
+			previous[i] += delta;
+			components[i] = previous[i] * quantum;
+		}
+		return data == end;
+	}
+
+	bool Reader::Open(const std::string& path)
+	{
+		Close();
+		if (!file.Open(path)) return false;
+
+		FileHeader expected;
+		if (file.Size() < sizeof(FileHeader) + sizeof(Trailer)) {
+			std::cout << "ERROR::TRAJECTORY::Not a trajectory " << path << std::endl;
+			Close();
+			return false;
+		}
+		std::memcpy(&header, file.Data(), sizeof(FileHeader));
+		if (std::memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version || header.keyframeInterval == 0) {
+			std::cout << "ERROR::TRAJECTORY::Not a trajectory " << path << std::endl;
+			Close();
+			return false;
+		}
+
+		// The index sits at the end, a file that was never closed has no trailer
+		Trailer trailer;
+		std::memcpy(&trailer, file.Data() + file.Size() - sizeof(Trailer), sizeof(Trailer));
+		size_t indexBytes = trailer.frameCount * sizeof(IndexEntry);
+		if (std::memcmp(trailer.magic, Trailer().magic, 4) != 0 || trailer.indexOffset + indexBytes + sizeof(Trailer) > file.Size()) {
+			std::cout << "ERROR::TRAJECTORY::Missing frame index " << path << std::endl;
+			Close();
+			return false;
+		}
+		index.resize(trailer.frameCount);
+		std::memcpy(index.data(), file.Data() + trailer.indexOffset, indexBytes);
+		return true;
+	}
+
+	void Reader::Close()
+	{
+		file.Close();
+		index.clear();
+		previous.clear();
+		decoded = SIZE_MAX;
+	}
+
+	bool Reader::Read(size_t frame, glm::vec3* positions, FrameHeader* frameHeader)
+	{
+		if (frame >= index.size()) return false;
+
+		// Sequential reads decode one frame, seeks start over from the keyframe
+		size_t first = frame - frame % header.keyframeInterval;
+		if (decoded != SIZE_MAX && decoded <= frame && decoded >= first) first = decoded + 1;
+
+		for (size_t f = first; f <= frame; f++) {
+			FrameHeader current;
+			std::memcpy(&current, file.Data() + index[f].offset, sizeof(FrameHeader));
+			const uint8_t* payload = file.Data() + index[f].offset + sizeof(FrameHeader);
+			if (payload + current.payloadBytes > file.Data() + file.Size()
+				|| !DecodeFrame(payload, current.payloadBytes, header.quantum, current.keyframe != 0, previous, positions, header.particleCount)) {
+				std::cout << "ERROR::TRAJECTORY::Corrupt frame " << f << std::endl;
+				decoded = SIZE_MAX;
+				return false;
+			}
+			decoded = f;
+		}
+
+		// Asked for the frame already decoded: previous holds it
+		if (first > frame) {
+			for (size_t i = 0; i < header.particleCount * 3; i++) (&positions[0].x)[i] = previous[i] * header.quantum;
+		}
+		if (frameHeader) std::memcpy(frameHeader, file.Data() + index[frame].offset, sizeof(FrameHeader));
+		return true;
+	}
+
+	void Reader::Prefetch(size_t frame, size_t count) const
+	{
+		if (frame >= index.size() || count == 0) return;
+		size_t last = std::min(frame + count, index.size()) - 1;
+		size_t end = last + 1 < index.size() ? index[last + 1].offset : (size_t)(file.Size() - sizeof(Trailer));
+		file.Prefetch(index[frame].offset, end - index[frame].offset);
+	}
+}
+
+TrajectoryRecorder::~TrajectoryRecorder()
+{
+	Close();
+}
+
+bool TrajectoryRecorder::Open(const std::string& path, size_t particleCount)
+{
+	Close();
+	if (quantum <= 0.0f || keyframeInterval == 0 || particleCount == 0) {
+		std::cout << "ERROR::TRAJECTORY::Invalid settings" << std::endl;
+		return false;
+	}
+
+	file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cout << "ERROR::TRAJECTORY::Cannot open " << path << std::endl;
+		return false;
+	}
+
+	Trajectory::FileHeader header;
+	header.particleCount = particleCount;
+	header.quantum = quantum;
+	header.keyframeInterval = keyframeInterval;
+	file.write((const char*)&header, sizeof(header));
+
+	this->path = path;
+	this->particleCount = particleCount;
+	offset = sizeof(header);
+	previous.clear();
+	index.clear();
+	encodeMs = 0.0;
+	largestBacklog = 0;
+	for (Batch& batch : batches) {
+		batch.positions.reserve(batchFrames * particleCount);
+		batch.frames.reserve(batchFrames);
+	}
+	return true;
+}
+
+void TrajectoryRecorder::Capture(const SoftBody& body)
+{
+	if (body.particles.size() != particleCount) return;
+	Capture(body.particles.position.data(), body.simTime, body.oscillator);
+}
+
+void TrajectoryRecorder::Capture(const glm::vec3* positions, double simTime, const HeartOscillatorSystem& oscillator)
+{
+	if (!Recording()) return;
+
+	Batch& batch = batches[filling];
+	batch.positions.insert(batch.positions.end(), positions, positions + particleCount);
+
+	Trajectory::FrameHeader frame;
+	frame.simTime = simTime;
+	double state[6] = { oscillator.sa.x, oscillator.sa.dx, oscillator.av.x, oscillator.av.dx, oscillator.hpc.x, oscillator.hpc.dx };
+	std::memcpy(frame.oscillator, state, sizeof(state));
+	frame.ecg = oscillator.getECG();
+	batch.frames.push_back(frame);
+
+	// Hand over a full batch if the writer is free, otherwise keep filling (grows rather than blocks)
+	if (batch.frames.size() >= batchFrames && (!writing || writing->done)) submit();
+	largestBacklog = std::max(largestBacklog, batches[filling].frames.size());
+}
+
+void TrajectoryRecorder::submit()
+{
+	Batch& batch = batches[filling];
+	filling = 1 - filling;
+	writing = Jobs::SubmitBackground([this, &batch]() { writeBatch(batch); });
+}
+
+void TrajectoryRecorder::writeBatch(Batch& batch)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (size_t f = 0; f < batch.frames.size(); f++) {
+		Trajectory::FrameHeader& frame = batch.frames[f];
+		bool keyframe = index.size() % keyframeInterval == 0;
+		Trajectory::EncodeFrame(&batch.positions[f * particleCount], particleCount, quantum, keyframe, previous, encoded);
+
+		frame.payloadBytes = (uint32_t)encoded.size();
+		frame.keyframe = keyframe;
+		index.push_back({ offset, frame.simTime });
+		file.write((const char*)&frame, sizeof(frame));
+		file.write((const char*)encoded.data(), (std::streamsize)encoded.size());
+		offset += sizeof(frame) + encoded.size();
+	}
+	batch.positions.clear();
+	batch.frames.clear();
+	encodeMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void TrajectoryRecorder::Close()
+{
+	if (!Recording()) return;
+
+	Jobs::Wait(writing);
+	writing.reset();
+	writeBatch(batches[filling]);
+
+	Trajectory::Trailer trailer;
+	trailer.indexOffset = offset;
+	trailer.frameCount = index.size();
+	file.write((const char*)index.data(), (std::streamsize)(index.size() * sizeof(Trajectory::IndexEntry)));
+	file.write((const char*)&trailer, sizeof(trailer));
+	bool ok = (bool)file;
+	file.close();
+
+	double rawMB = index.size() * particleCount * sizeof(glm::vec3) / (1024.0 * 1024.0);
+	double fileMB = (offset + index.size() * sizeof(Trajectory::IndexEntry) + sizeof(trailer)) / (1024.0 * 1024.0);
+	std::cout << "::TRAJECTORY::" << std::endl;
+	std::cout << path << (ok ? "" : " (WRITE FAILED)") << std::endl;
+	std::cout << "Frames: " << index.size() << ", raw " << rawMB << " MB -> " << fileMB << " MB (" << (fileMB > 0.0 ? rawMB / fileMB : 0.0) << "x)" << std::endl;
+	std::cout << "Encode + write: " << (index.empty() ? 0.0 : encodeMs / index.size()) << " ms/frame, largest backlog " << largestBacklog << " frames" << std::endl;
+
+	particleCount = 0;
+	index.clear();
+	previous.clear();
+}
@@ -0,0 +1,119 @@
+/*
+ * TRAJECTORY: Streams per step particle positions, oscillator state and ECG to a compressed file for offline analysis
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "jobs.h"
+#include "mappedFile.h"
+
+class SoftBody;
+struct HeartOscillatorSystem;
+
+namespace Trajectory {
+	// File layout: FileHeader, frames (FrameHeader + payload), index (IndexEntry per frame), Trailer
+	struct FileHeader {
+		char magic[4] = { 'J', 'T', 'R', 'J' };
+		uint32_t version = 1;
+		uint64_t particleCount = 0;
+		float quantum = 0.0f;          // position step, body local (model space) units
+		uint32_t keyframeInterval = 0; // every Nth frame is stored absolute, the rest as deltas
+	};
+
+	struct FrameHeader {
+		uint32_t payloadBytes = 0;
+		uint32_t keyframe = 0;
+		double simTime = 0.0;
+		double oscillator[6] = {}; // sa, av, hpc: x then dx
+		double ecg = 0.0;
+	};
+
+	struct IndexEntry {
+		uint64_t offset;  // of the FrameHeader
+		double simTime;
+	};
+
+	struct Trailer {
+		uint64_t indexOffset = 0;
+		uint64_t frameCount = 0;
+		char magic[4] = { 'J', 'I', 'D', 'X' };
+		uint32_t reserved = 0;
+	};
+
+	// Quantises positions and writes zigzag varint deltas against previous (the last frame's quantised values,
+	// so the error never accumulates). Keyframes encode against zero.
+	void EncodeFrame(const glm::vec3* positions, size_t count, float quantum, bool keyframe, std::vector<int32_t>& previous, std::vector<uint8_t>& out);
+	bool DecodeFrame(const uint8_t* data, size_t bytes, float quantum, bool keyframe, std::vector<int32_t>& previous, glm::vec3* positions, size_t count);
+
+	// Random access over a recorded (memory mapped) file, decodes forward from the nearest keyframe
+	class Reader {
+	public:
+		bool Open(const std::string& path);
+		void Close();
+		size_t FrameCount() const { return index.size(); }
+		size_t ParticleCount() const { return header.particleCount; }
+		double FrameTime(size_t frame) const { return index[frame].simTime; }
+
+		// positions needs ParticleCount() entries, frameHeader is optional
+		bool Read(size_t frame, glm::vec3* positions, FrameHeader* frameHeader = nullptr);
+
+		// Asks the OS to page in frames [frame, frame + count) ahead of the Read calls
+		void Prefetch(size_t frame, size_t count) const;
+
+	private:
+		MappedFile file;
+		FileHeader header;
+		std::vector<IndexEntry> index;
+		std::vector<int32_t> previous;
+		size_t decoded = SIZE_MAX; // frame held in previous
+	};
+}
+
+// Records one frame per Capture. The simulation thread only copies positions into the filling buffer,
+// quantisation, encoding and file I/O happen on a background job working through the other one.
+class TrajectoryRecorder {
+public:
+	float quantum = 1e-4f;          // model space units per step, positions are recorded before the body transform
+	uint32_t keyframeInterval = 250; // bounds the decode work for a random seek
+	size_t batchFrames = 32;         // frames handed to the writer at once
+
+	~TrajectoryRecorder();
+
+	bool Open(const std::string& path, size_t particleCount);
+	bool Recording() const { return particleCount != 0; }
+
+	void Capture(const SoftBody& body);
+	void Capture(const glm::vec3* positions, double simTime, const HeartOscillatorSystem& oscillator);
+
+	// Writes what is left, the frame index and the trailer, then prints a summary
+	void Close();
+
+private:
+	struct Batch {
+		std::vector<glm::vec3> positions;           // frames back to back
+		std::vector<Trajectory::FrameHeader> frames;
+	};
+
+	void submit();
+	void writeBatch(Batch& batch);
+
+	size_t particleCount = 0;
+	std::string path;
+	Batch batches[2];
+	int filling = 0;
+	Jobs::Handle writing;
+
+	// Owned by the writer
+	std::ofstream file;
+	uint64_t offset = 0;
+	std::vector<int32_t> previous;
+	std::vector<uint8_t> encoded;
+	std::vector<Trajectory::IndexEntry> index;
+	double encodeMs = 0.0;
+	size_t largestBacklog = 0;
+};
@@ -1,8 +1,13 @@
 #version 460 core
 out vec4 FragColor;
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
+layout (std140, binding = 0) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec4 viewPos;
+	vec4 lightPos;
+};
 
 uniform vec3 color;
 uniform bool calculateLighting = true;
@@ -21,8 +26,8 @@ void main()
 
 		// Light and viewing inputs
 		vec3 norm = normalize(Normal);
-		vec3 lightDir = normalize(lightPos - FragPos);
-		vec3 viewDir = normalize(viewPos - FragPos);
+		vec3 lightDir = normalize(lightPos.xyz - FragPos);
+		vec3 viewDir = normalize(viewPos.xyz - FragPos);
 		vec3 lightReflect = reflect(-lightDir, norm);
 
 		// Scattering approximation of Oren-Nayar lighting model (Credits: GPU Gems, 16.2)
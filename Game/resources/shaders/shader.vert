@@ -2,17 +2,28 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 
+layout (std140, binding = 0) uniform FrameData
+{
+   mat4 view;
+   mat4 projection;
+   vec4 viewPos;
+   vec4 lightPos;
+};
+
 uniform mat4 transform;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Dequantisation of streamed positions (identity for float streams)
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset = vec3(0.0);
 
 out vec3 Normal;
 out vec3 FragPos;
 
 void main()
 {
-   gl_Position = projection * view * transform * vec4(aPos, 1.0);
-   FragPos = vec3(transform * vec4(aPos, 1.0));
+   vec3 pos = aPos * positionScale + positionOffset;
+   gl_Position = projection * view * transform * vec4(pos, 1.0);
+   FragPos = vec3(transform * vec4(pos, 1.0));
 
    // Normal matrix
    Normal = mat3(transpose(inverse(transform))) * aNormal;
@@ -4,6 +4,9 @@
 /// Available from // see https://github.com/Rafapp/jellyengine.git
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
 #include <JellyEngine.h>
 #include <input.h>
 
@@ -21,42 +24,229 @@ public:
 
 		std::cout << "Game initialized" << std::endl;
 
+		// Everything loads on the job system's background workers, Update swaps each model in when it is ready
 		// Create a light
-		std::string pathLight = RESOURCES_PATH "3D/cube.obj";
-		light = new Model(pathLight);
-		light->p = glm::vec3(0, 10, 0);
-		light->color = glm::vec3(1.0f, 1.0f, 1.0f);
-		light->s = glm::vec3(0.5, 0.5, 0.5);
+		lightLoad = AsyncLoad<Model>([]() {
+			Model* model = new Model(RESOURCES_PATH "3D/cube.obj", true);
+			model->p = glm::vec3(0, 10, 0);
+			model->color = glm::vec3(1.0f, 1.0f, 1.0f);
+			model->s = glm::vec3(0.5, 0.5, 0.5);
+			return model;
+		});
 
 		// Create a ground plane
-		std::string pathPlane = RESOURCES_PATH "3D/plane.obj";
-		bottomPlane = new Model(pathPlane);
-		bottomPlane->color = glm::vec3(1.0, 1.0, 1.0);
-		bottomPlane->p = glm::vec3(0.0f, 0.0f, 0.0f);
-		bottomPlane->s = glm::vec3(10.0, -1.0, 10.0);
-		scene.push_back(bottomPlane);
+		planeLoad = AsyncLoad<Model>([]() {
+			Model* model = new Model(RESOURCES_PATH "3D/plane.obj", true);
+			model->color = glm::vec3(1.0, 1.0, 1.0);
+			model->p = glm::vec3(0.0f, 0.0f, 0.0f);
+			model->s = glm::vec3(10.0, -1.0, 10.0);
+			return model;
+		});
 
+		// Scene and parameters, edits to the file are applied while running
+		config.Open(configPath);
+		Config::ApplyWorld(config.Root()["world"], world);
+
+		addColliders(world);
+		world.reportInterval = 600; // print per body step timings every 600 steps
+		checkpointer.interval = 30.0; // snapshot the heart every 30 simulated seconds, 'c' restores the last one
+
+		loadHeart();
+	}
+
+	static inline std::string configPath = RESOURCES_PATH "scene.json";
+	ConfigWatcher config;
+	SoftBody* heart = nullptr; // the body the config's "body" section describes, null after 't'
+	bool loadingHeart = false;
+	Config::Value heartScene; // the document the heart shown or loading was built from or last updated to
+
+	void loadHeart()
+	{
+		Config::Value scene = config.Root();
+		heartScene = scene;
+		bodyLoad = AsyncLoad<SoftBody>([scene]() { return createHeart(scene); });
+		loadingHeart = true;
+	}
+
+	// A reload only re-applies the sections that changed, unless the mesh itself was swapped for another
+	// file. A mesh edit made while another load is pending is picked up when that load is swapped in.
+	void applyConfig()
+	{
+		const Config::Value& scene = config.Root();
+		if (scene["world"] != config.Previous()["world"]) Config::ApplyWorld(scene["world"], world);
+		if (!heart) return;
+		if (scene["body"]["mesh"] != heartScene["body"]["mesh"]) {
+			if (!bodyLoad.Pending()) loadHeart();
+			return;
+		}
+
+		// Re-applying an unchanged section is not free: ECG probes restart their sampling, for one
+		auto changed = [&](const char* section) { return scene[section] != heartScene[section]; };
+		bool excitationChanged = changed("excitation") || changed("active");
+		if (changed("body")) Config::ApplyBody(scene["body"], *heart);
+		if (changed("oscillator")) Config::ApplyOscillator(scene["oscillator"], heart->oscillator);
+		if (changed("excitation")) Config::ApplyExcitation(scene["excitation"], *heart);
+		if (changed("active")) Config::ApplyActive(scene["active"], *heart);
+		if (changed("ecg") || excitationChanged) Config::ApplyEcg(scene["ecg"], *heart); // a new solver has no probes
+		heartScene = scene;
+		openEcg();
+	}
+
+	// The heart's pseudo-ECG goes to the "ecg" section's file, reopened only when the name changes
+	Ecg::Writer ecgWriter;
+	std::string ecgFile;
+	std::vector<double> ecgTimes;
+	std::vector<std::array<float, Ecg::LeadCount>> ecgLeads;
+
+	void openEcg()
+	{
+		const Config::Value& ecg = config.Root()["ecg"];
+		std::string file = ecg["enabled"].Bool(false) ? ecg["file"].String("") : "";
+		if (file == ecgFile) return;
+		ecgFile = file;
+		if (file.empty()) ecgWriter.Close();
+		else ecgWriter.Open(file);
+	}
+
+	void writeEcg()
+	{
+		ecgTimes.clear();
+		ecgLeads.clear();
+		heart->TakeECG(ecgTimes, ecgLeads);
+		for (size_t k = 0; k < ecgTimes.size(); k++) ecgWriter.Write(ecgTimes[k], ecgLeads[k]);
+	}
+
+	// Scene colliders: floor and three walls (restitution comes from the body, combined with max)
+	static void addColliders(PhysicsWorld& world)
+	{
+		world.colliders.AddPlane(glm::vec3(0, 1, 0), 0.1f, 0.0f, 0.0f);
+		world.colliders.AddPlane(glm::vec3(1, 0, 0), -10.0f, 0.0f, 0.0f);
+		world.colliders.AddPlane(glm::vec3(0, 0, -1), -10.0f, 0.0f, 0.0f);
+		world.colliders.AddPlane(glm::vec3(0, 0, 1), -10.0f, 0.0f, 0.0f);
+	}
+
+	// The start up body, CPU side only (GL resources are created when it is swapped in). Keys missing from
+	// the scene fall back to the values below.
+	static SoftBody* createHeart(const Config::Value& scene = Config::Value())
+	{
 		//Soft bodies examples to test (.obj files)
-		//std::string path, float restitution, float mass, float stiffness, float damping
-		// softBody = new SoftBody(RESOURCES_PATH "/3D/fun/ball-low.obj", 0, 1, 5, 0.1);
-		// softBody = new SoftBody(RESOURCES_PATH "/3D/fun/heart15.obj", 0.2, 100, 200, 0.6);
+		//std::string path, float restitution, float mass, float stiffness, float damping, bool deferGL
+		// SoftBody* body = new SoftBody(RESOURCES_PATH "/3D/fun/ball-low.obj", 0, 1, 5, 0.1, true);
+		// SoftBody* body = new SoftBody(RESOURCES_PATH "/3D/fun/heart15.obj", 0.2, 100, 200, 0.6, true);
 
 		//Soft bodies examples to test (.msh files)
-		//std::string path, float restitution, float mass, float stiffness, float damping
-		// softBody = new SoftBody(RESOURCES_PATH "/3D/fun/newHeart-test04.msh", 0.2, 30, 5000, 0.9);
-		softBody = new SoftBody(RESOURCES_PATH "/3D/fun/ball-test2.msh", 0.2, 100, 20000, 0.9);
+		//std::string path, float restitution, float mass, float stiffness, float damping, bool deferGL
+		// SoftBody* body = new SoftBody(RESOURCES_PATH "/3D/fun/newHeart-test04.msh", 0.2, 30, 5000, 0.9, true);
+		const Config::Value& settings = scene["body"];
+		std::string mesh = settings["mesh"].String("3D/fun/ball-test2.msh");
+		if (!std::filesystem::path(mesh).is_absolute()) mesh = RESOURCES_PATH + mesh;
+		SoftBody* body = new SoftBody(mesh, settings["restitution"].Float(0.2f), settings["mass"].Float(100.0f),
+			settings["stiffness"].Float(20000.0f), settings["damping"].Float(0.9f), true);
 
-		softBody->color = glm::vec4(0.87, 0.192, 0.388, 1.0); // cerise jelly color
-		softBody->p = glm::vec3(0.0, 6.0, 0.0);
-		softBody->s = glm::vec3(5);
-		scene.push_back(softBody); 
-		Renderer::body = softBody;
+		body->color = glm::vec4(0.87, 0.192, 0.388, 1.0); // cerise jelly color
+		body->p = settings["position"].Vec3(glm::vec3(0.0, 6.0, 0.0));
+		body->s = settings["scale"].Vec3(glm::vec3(5));
+		Config::ApplyBody(settings, *body);
+		Config::ApplyOscillator(scene["oscillator"], body->oscillator);
+		Config::ApplyExcitation(scene["excitation"], *body);
+		Config::ApplyActive(scene["active"], *body);
+		Config::ApplyEcg(scene["ecg"], *body);
+		body->selfCollision.reportInterval = 600; // print hash build/query timings every 600 steps
+		return body;
+	}
+
+	// Pending loads, the current model keeps running until its replacement is ready
+	AsyncLoad<Model> lightLoad;
+	AsyncLoad<Model> planeLoad;
+	AsyncLoad<SoftBody> bodyLoad;
+
+	Checkpointer checkpointer;
+	TrajectoryRecorder recorder; // 'v' starts/stops writing every step to trajectory.jtrj
+	TrajectoryPlayer player;     // 'p' replays it, up/down change the rate, left/right seek
+
+	// Finishes any load whose CPU side is done (GL resources are created here, on the main thread)
+	void swapInLoads()
+	{
+		if (Model* model = lightLoad.Take()) {
+			light = model;
+		}
+		if (Model* model = planeLoad.Take()) {
+			bottomPlane = model;
+			scene.insert(scene.begin(), bottomPlane);
+		}
+		if (SoftBody* body = bodyLoad.Take()) {
+			player.Close();   // recorded for the old mesh
+			recorder.Close(); // frames are sized for the old particle count
+			auto slot = std::find(scene.begin(), scene.end(), (Model*)softBody);
+			if (softBody) world.Remove(softBody);
+			if (slot != scene.end()) *slot = body;
+			else scene.push_back(body);
+
+			softBody = body;
+			heart = loadingHeart ? body : nullptr;
+			if (loadingHeart) openEcg();
+			loadingHeart = false;
+			world.Add(softBody);
+			Renderer::body = softBody;
+			AssetCache::Trim(); // the old body is gone, drop what only it used
+
+			// Edits made while it loaded: a new mesh starts another load, parameters apply now
+			if (heart) applyConfig();
+		}
+	}
+
+	// CPU side of the model switch, runs on a worker
+	static SoftBody* createObject(int object, const std::string& path)
+	{
+		SoftBody* body = nullptr;
+
+		// Cube
+		if (object == 0) {
+			body = new SoftBody(path, 0.0, 1, 10, 0.1, true);
+			body->color = glm::vec3(0.0, 1.0, 0.0);
+			body->p = glm::vec3(0, 2.0, 0.0);
+			body->s = glm::vec3(1.5);
+		} 
+		// Diamond
+		else if (object == 1) {
+			body = new SoftBody(path, 0.0, 1, 5, 0.1, true);
+			body->color = glm::vec3(0.0, 1.0, 1.0);
+			body->p = glm::vec3(0, 2.0, 0.0);
+			body->s = glm::vec3(2);
+		} 
+		// Star
+		else if (object == 2) {
+			body = new SoftBody(path, 0.0, 1, 5, 0.1, true);
+			body->color = glm::vec3(1.0, 1.0, 0.0);
+			body->p = glm::vec3(0, 2.0, 0.0);
+			body->s = glm::vec3(2);
+		} 
+		// Donut
+		else if (object == 3) {
+			body = new SoftBody(path, 0.0, 1, 5, 0.1, true);
+			body->color = glm::vec3(1, 0, 1);
+			body->p = glm::vec3(0, 2.0, 0.0);
+			body->s = glm::vec3(1.5);
+		} 
+		// Acrobat
+		else if (object == 4) {
+			body = new SoftBody(path, 0.0, .5, 2.5, 0.1, true);
+			body->color = glm::vec3(1, 0.75, 0.0);
+			body->p = glm::vec3(0, 2.0, 0.0);
+			body->s = glm::vec3(0.3);
+		}
+		return body;
 	}
 
 	// Update is called every frame
 	bool rPress = false;
 	bool spacePress = false;
 	bool tPress = false;
+	bool cPress = false;
+	bool vPress = false;
+	bool pPress = false;
+	bool upPress = false;
+	bool downPress = false;
 	int object = 0;
 	vector<std::string> objectPaths = {
 		RESOURCES_PATH "3D/fun/cube.obj",
@@ -69,17 +259,38 @@ public:
 	void Update(float dt) 
 	{
 		// Additive time function
-		static float t = 0;
+		static double t = 0;
 		t += dt;
 	
+		swapInLoads();
+		if (config.Poll(dt)) applyConfig();
+
 		// Make camera and light loop around using time and sin, cos
-		light->p = glm::vec3(glm::cos(t/2) * 3.5, 1, glm::sin(t/2) * 3.5);
+		if (light) light->p = glm::vec3(glm::cos(t/2) * 3.5, 1, glm::sin(t/2) * 3.5);
 		// Renderer::camera->Position = glm::vec3(glm::cos(t/2) * 7.5, 5, glm::sin(t/2) * 7.5);
 		// Renderer::camera->Position = glm::vec3(0.0, 0.0 ,0.0);
 		
-		softBody->AddForce(glm::vec3(0.0, -2.0 , 0.0)); // here is the gravity!!
-		softBody->EvalCoupleOscillator(t, dt);
-		softBody->Update(dt);
+		if (softBody && !softBody->playback) softBody->EvalCoupleOscillator(t, dt);
+		world.Step(dt); // gravity is applied by the world to every body
+		if (softBody) checkpointer.Step(*softBody);
+		if (softBody) recorder.Capture(*softBody);
+		if (heart) writeEcg();
+
+		// 't' to change to the next model, the current one keeps simulating while it loads
+		if (keyPressed("t") && !tPress) {
+			if (!bodyLoad.Pending()) {
+				object++;
+				object %= 5;
+				int next = object;
+				std::string path = objectPaths[next];
+				bodyLoad = AsyncLoad<SoftBody>([next, path]() { return createObject(next, path); });
+				loadingHeart = false;
+			}
+			tPress = true;
+		}
+		if (keyReleased("t")) tPress = false;
+
+		if (!softBody) return;
 
 		// 'r' to reset
 		if (keyPressed("r") && !rPress) {
@@ -88,6 +299,43 @@ public:
 		}
 		if (keyReleased("r")) rPress = false;
 
+		// 'c' to restore the last checkpoint
+		if (keyPressed("c") && !cPress) {
+			recorder.Close();
+			checkpointer.Restore(*softBody);
+			cPress = true;
+		}
+		if (keyReleased("c")) cPress = false;
+
+		// 'v' to start/stop recording the trajectory
+		if (keyPressed("v") && !vPress) {
+			if (recorder.Recording()) recorder.Close();
+			else recorder.Open("trajectory.jtrj", softBody->particles.size());
+			vPress = true;
+		}
+		if (keyReleased("v")) vPress = false;
+
+		// 'p' to start/stop replaying the recorded trajectory instead of simulating
+		if (keyPressed("p") && !pPress) {
+			if (player.Playing()) player.Close();
+			else {
+				recorder.Close();
+				player.Open("trajectory.jtrj", *softBody);
+			}
+			softBody->playback = player.Playing() ? &player : nullptr;
+			pPress = true;
+		}
+		if (keyReleased("p")) pPress = false;
+
+		if (player.Playing()) {
+			if (keyPressed("up") && !upPress) player.rate *= 2.0;
+			if (keyPressed("down") && !downPress) player.rate *= 0.5;
+			upPress = keyPressed("up");
+			downPress = keyPressed("down");
+			if (keyPressed("right")) player.Seek(player.Time() + 2.0 * dt);
+			if (keyPressed("left")) player.Seek(player.Time() - 2.0 * dt);
+		}
+
 		// 'space' to jump
 		if (keyPressed("space") && !spacePress) {
 			softBody->AddForce(glm::vec3(0, 250, 0));
@@ -95,56 +343,6 @@ public:
 		}
 		if (keyReleased("space")) spacePress = false;
 
-		// 't' to change to the next model
-		if (keyPressed("t") && !tPress) {
-			object++;
-			object %= 5;
-
-			delete softBody;
-
-			// Cube
-			if (object == 0) {
-				softBody = new SoftBody(objectPaths[object], 0.0, 1, 10, 0.1);
-				softBody->color = glm::vec3(0.0, 1.0, 0.0);
-				softBody->p = glm::vec3(0, 2.0, 0.0);
-				softBody->s = glm::vec3(1.5);
-			} 
-			// Diamond
-			else if (object == 1) {
-				softBody = new SoftBody(objectPaths[object], 0.0, 1, 5, 0.1);
-				softBody->color = glm::vec3(0.0, 1.0, 1.0);
-				softBody->p = glm::vec3(0, 2.0, 0.0);
-				softBody->s = glm::vec3(2);
-			} 
-			// Star
-			else if (object == 2) {
-				softBody = new SoftBody(objectPaths[object], 0.0, 1, 5, 0.1);
-				softBody->color = glm::vec3(1.0, 1.0, 0.0);
-				softBody->p = glm::vec3(0, 2.0, 0.0);
-				softBody->s = glm::vec3(2);
-			} 
-			// Donut
-			else if (object == 3) {
-				softBody = new SoftBody(objectPaths[object], 0.0, 1, 5, 0.1);
-				softBody->color = glm::vec3(1, 0, 1);
-				softBody->p = glm::vec3(0, 2.0, 0.0);
-				softBody->s = glm::vec3(1.5);
-			} 
-			// Acrobat
-			else if (object == 4) {
-				softBody = new SoftBody(objectPaths[object], 0.0, .5, 2.5, 0.1);
-				softBody->color = glm::vec3(1, 0.75, 0.0);
-				softBody->p = glm::vec3(0, 2.0, 0.0);
-				softBody->s = glm::vec3(0.3);
-			}
-			
-			scene.pop_back();
-			scene.push_back(softBody);
-
-			tPress = true;
-		}
-		if (keyReleased("t")) tPress = false;
-
 		// 'wasd' to move
 		if(keyPressed("w")) softBody->AddForce(glm::vec3(-7.5, 0, 0));
 		if(keyPressed("s")) softBody->AddForce(glm::vec3(7.5, 0, 0));
@@ -156,9 +354,135 @@ public:
 	void Exit() 
 	{
 		std::cout << "Exiting game" << std::endl;
+		checkpointer.Flush();
+		recorder.Close();
+		player.Close();
 	}
 };
 
-int main() {
+// Steps the start up scene with a fixed dt and no window, then prints the state hash. CI runs this with
+// different thread counts and expects the same hash every time.
+static int runStateHash(int steps, int threads)
+{
+	if (threads > 1) {
+		Jobs::Config jobs;
+		jobs.workers = threads - 1;
+		Jobs::Initialize(jobs);
+	}
+	uint64_t hash;
+	{
+		PhysicsWorld world;
+		Game::addColliders(world);
+		SoftBody* body = Game::createHeart();
+		world.Add(body);
+
+		const float dt = 1.0f / 60.0f;
+		double t = 0.0;
+		for (int i = 0; i < steps; i++) {
+			t += dt;
+			body->EvalCoupleOscillator(t, dt);
+			world.Step(dt);
+		}
+		hash = world.StateHash();
+	}
+	Jobs::Shutdown();
+
+	std::printf("::STATE HASH:: %d steps, %d threads: %016llx\n", steps, threads, (unsigned long long)hash);
+	return 0;
+}
+
+// Runs the same steps at every precision and compares the end state with the double run
+static int runPrecisionBench(int steps, int threads)
+{
+	if (threads > 1) {
+		Jobs::Config jobs;
+		jobs.workers = threads - 1;
+		Jobs::Initialize(jobs);
+	}
+
+	const Precision modes[] = { Precision::Double, Precision::Float, Precision::Mixed };
+	std::vector<glm::vec3> reference;
+	for (Precision precision : modes) {
+		PhysicsWorld world;
+		Game::addColliders(world);
+		SoftBody* body = Game::createHeart();
+		body->SetPrecision(precision);
+		world.Add(body);
+
+		const float dt = 1.0f / 60.0f;
+		double t = 0.0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < steps; i++) {
+			t += dt;
+			body->EvalCoupleOscillator(t, dt);
+			world.Step(dt);
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		const std::vector<glm::vec3>& position = body->particles.position;
+		if (precision == Precision::Double) reference = position;
+		double maxError = 0.0, sumSquared = 0.0;
+		for (size_t i = 0; i < position.size(); i++) {
+			double error = glm::distance(glm::dvec3(position[i]), glm::dvec3(reference[i]));
+			maxError = std::max(maxError, error);
+			sumSquared += error * error;
+		}
+		double rms = position.empty() ? 0.0 : std::sqrt(sumSquared / position.size());
+
+		std::printf("::PRECISION BENCH:: %-6s %d steps, %d threads: %.3f ms/step, vs double max %.3g rms %.3g\n",
+			PrecisionName(precision), steps, threads, ms / steps, maxError, rms);
+	}
+	Jobs::Shutdown();
+	return 0;
+}
+
+// Benchmarks the sparse module on the system matrix of an implicit Euler step of the start up body
+static int runSparseBench(int threads)
+{
+	if (threads > 1) {
+		Jobs::Config jobs;
+		jobs.workers = threads - 1;
+		Jobs::Initialize(jobs);
+	}
+	{
+		std::unique_ptr<SoftBody> body(Game::createHeart());
+		const float dt = 1.0f / 60.0f;
+		Sparse::BsrMatrix A = body->StiffnessMatrix(body->mass / (dt * dt));
+		Sparse::Benchmark(A);
+	}
+	Jobs::Shutdown();
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	// --headless [--frames N] [--output path] [--yuv] [--egl] renders to disk without a window
+	// --state-hash N [--threads T] simulates N steps without GL and prints the state hash
+	// --precision-bench N [--threads T] times N steps in float, mixed and double and compares the results
+	// --sparse-bench [--threads T] times SpMV formats and CG solves on the body's implicit system matrix
+	// --config path replaces resources/scene.json
+	HeadlessConfig headless;
+	bool isHeadless = false;
+	int hashSteps = 0;
+	int benchSteps = 0;
+	bool sparseBench = false;
+	int threads = 1;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--headless") isHeadless = true;
+		else if (arg == "--state-hash" && i + 1 < argc) hashSteps = std::atoi(argv[++i]);
+		else if (arg == "--sparse-bench") sparseBench = true;
+		else if (arg == "--config" && i + 1 < argc) Game::configPath = argv[++i];
+		else if (arg == "--precision-bench" && i + 1 < argc) benchSteps = std::atoi(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc) threads = std::atoi(argv[++i]);
+		else if (arg == "--frames" && i + 1 < argc) headless.frames = std::atoi(argv[++i]);
+		else if (arg == "--output" && i + 1 < argc) headless.output = argv[++i];
+		else if (arg == "--yuv") headless.format = HeadlessConfig::Format::YUV420;
+		else if (arg == "--egl") headless.context = HeadlessConfig::Context::EGL;
+	}
+
+	if (hashSteps > 0) return runStateHash(hashSteps, threads);
+	if (benchSteps > 0) return runPrecisionBench(benchSteps, threads);
+	if (sparseBench) return runSparseBench(threads);
+	if (isHeadless) return Engine::RenderHeadless<Game>(headless);
 	Engine::InitializeEngine<Game>();
 }
\ No newline at end of file
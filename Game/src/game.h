@@ -11,4 +11,5 @@ Model* backPlane;
 Model* leftPlane;
 Model* rightPlane;
 Model* cube;
-SoftBody* softBody;
\ No newline at end of file
+SoftBody* softBody;
+PhysicsWorld world; // owns the soft bodies and the scene colliders
\ No newline at end of file